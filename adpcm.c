@@ -0,0 +1,67 @@
+#include "adpcm.h"
+
+// IMA ADPCM keeps the difference from each sample to the next in four bits: a sign,
+// and how many of a step size it is, in eighths. The step size goes up when a
+// difference was a big one and down when it was small, so it follows how loud the
+// sound is, and a sample only has to be put right by a few steps at the most. It's a
+// quarter of the size of the 16-bit samples it's decoded back to, and it's cheap to
+// decode, a sample at a time and in order, which is how they're played.
+
+// Step sizes, each about a tenth bigger than the last
+static const int16_t adpcm_steps[89] = {
+	    7,     8,     9,    10,    11,    12,    13,    14,    16,    17,
+	   19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+	   50,    55,    60,    66,    73,    80,    88,    97,   107,   118,
+	  130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+	  337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+	  876,   963,  1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+	 2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+	 5894,  6484,  7132,  7845,  8630,  9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+// How far along the step sizes to move after each code (its sign bit aside)
+static const int8_t adpcm_moves[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+/*
+ * Starts decoding a sound from the beginning
+ */
+void adpcm_start(adpcm_state_t *state, const adpcm_sound_t *sound) {
+	state->data      = sound->data;
+	state->at        = 0;
+	state->predictor = 0;
+	state->index     = sound->index;
+}
+
+/*
+ * Works out the next sample from its code
+ */
+int16_t adpcm_next(adpcm_state_t *state, uint8_t code) {
+	int32_t step = adpcm_steps[state->index];
+	int32_t diff = step >> 3;
+	int32_t index;
+
+	if (code & 4) diff += step;
+	if (code & 2) diff += step >> 1;
+	if (code & 1) diff += step >> 2;
+
+	state->predictor += code & 8 ? -diff : diff;
+	if (state->predictor > INT16_MAX) state->predictor = INT16_MAX;
+	if (state->predictor < INT16_MIN) state->predictor = INT16_MIN;
+
+	index = state->index + adpcm_moves[code & 7];
+	state->index = index < 0 ? 0 : index > 88 ? 88 : (uint8_t) index;
+
+	return (int16_t) state->predictor;
+}
+
+/*
+ * Decodes the next samples of the sound. There must be that many left in it.
+ */
+void adpcm_decode(adpcm_state_t *state, int16_t *samples, size_t count) {
+	for (size_t n = 0; n < count; n++, state->at++) {
+		uint8_t byte = state->data[state->at >> 1];
+
+		samples[n] = adpcm_next(state, state->at & 1 ? byte >> 4 : byte & 0x0F);
+	}
+}
@@ -0,0 +1,27 @@
+#ifndef _ADPCM_H_
+#define _ADPCM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// A sound kept as IMA ADPCM: four bits a sample, two to a byte, the first in the low
+// half, starting from silence
+typedef struct {
+	const uint8_t *data;
+	uint32_t       length; // In samples
+	uint8_t        index;  // Step size the first sample is worked out with
+} adpcm_sound_t;
+
+// How far a sound has been decoded
+typedef struct {
+	const uint8_t *data;
+	uint32_t       at;        // Next sample
+	int32_t        predictor; // Last sample
+	uint8_t        index;     // Step size for the next one
+} adpcm_state_t;
+
+void    adpcm_start(adpcm_state_t *state, const adpcm_sound_t *sound);
+int16_t adpcm_next(adpcm_state_t *state, uint8_t code);
+void    adpcm_decode(adpcm_state_t *state, int16_t *samples, size_t count);
+
+#endif /*_ADPCM_H_*/
@@ -0,0 +1,314 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <stm32f4xx_rcc.h>
+#include <stm32f4xx_gpio.h>
+#include <stm32f4xx_tim.h>
+#include <stm32f4xx_dma.h>
+#include <stm32f4xx_dac.h>
+#include <misc.h>
+#include <stm32f4xx.h>
+#include "audio.h"
+#include "clock.h"
+#include "synth.h"
+#include "timebase.h"
+#include "serial.h"
+#include "dwt.h"
+
+// The clicks come out of the DAC's channel 2, on PA5, as 12-bit samples.
+// The board's audio codec (on I2S3) is no use here: its reset line is PD4, which is
+// one of the LCD's data lines. PA4, the DAC's other channel, is the codec's word
+// clock, so that's left alone as well.
+//
+// TIM6 triggers the DAC at the sample rate, and each trigger has the DMA copy the
+// next sample across from a buffer of two blocks, going round and round. When the
+// DMA is half-way through the buffer, and again at the end, it interrupts, and the
+// block it has just finished with is filled with the samples that come after the
+// other one (see synth.c). So the processor only ever works out a block at a time,
+// and each sample goes out on TIM6's tick however late it gets round to it, as long
+// as that's within a block.
+//
+// Samples are numbered from when TIM6 was started, and each click starts on the
+// sample nearest its beat. TIM6 and the time base count the same clock, so the
+// samples stay exactly where they were worked out to be. Each click is put in 2ms
+// ahead of its beat (see main.c), which is further ahead than the buffer goes, so
+// the click can always be put on the right sample. The DAC is only kept going while
+// there's a click to play, and stops once the buffer has gone quiet.
+//
+// It has to be DMA1 for the DAC, and channel 2's requests are stream 6, channel 7.
+#define AUDIO_DMA_STREAM  DMA1_Stream6
+#define AUDIO_DMA_CHANNEL DMA_Channel_7
+#define AUDIO_DMA_FLAGS   (DMA_FLAG_FEIF6 | DMA_FLAG_DMEIF6 | DMA_FLAG_TEIF6 | \
+                           DMA_FLAG_HTIF6 | DMA_FLAG_TCIF6)
+
+// DAC value for no sound (the middle of its range), and two of them in a word
+#define AUDIO_SILENCE      2048
+#define AUDIO_SILENCE_PAIR (AUDIO_SILENCE << 16 | AUDIO_SILENCE)
+
+// Samples between TIM6 starting and the first one being played: its first tick only
+// has the DMA fetch it, and it goes out on the second
+#define AUDIO_LATENCY 2
+
+// Blocks in a row that have to be silent before the DAC is stopped, so the whole
+// buffer is
+#define AUDIO_QUIET_BLOCKS 2
+
+// Two samples to a word (see synth_render())
+static uint32_t audio_buffer[AUDIO_BLOCK];
+
+// Whether the DAC's playing, when TIM6 was started, the first sample that hasn't been
+// put in the buffer yet, and how many silent blocks there have been in a row
+static bool     audio_running  = false;
+static uint64_t audio_start_us = 0;
+static uint32_t audio_rendered = 0;
+static uint8_t  audio_quiet    = 0;
+
+// What the clicks sound like. Only changed from the main loop.
+static audio_sound_t audio_sound = AUDIO_SYNTHESISED;
+
+/*
+ * The sample that's played nearest a given time
+ */
+static uint32_t audio_sample_at(uint64_t at_us) {
+	uint64_t since_us = at_us > audio_start_us ? at_us - audio_start_us : 0;
+	uint32_t ticks = (uint32_t) ((since_us * AUDIO_RATE_HZ + TIMEBASE_HZ / 2) / TIMEBASE_HZ);
+
+	return ticks > AUDIO_LATENCY ? ticks - AUDIO_LATENCY : 0;
+}
+
+#if AUDIO_PROFILE
+
+// Processor cycles taken to work out each block, from the cycle counter
+static uint32_t audio_blocks = 0;
+static uint32_t audio_min    = UINT32_MAX;
+static uint32_t audio_max    = 0;
+static uint64_t audio_sum    = 0;
+// The most of the time between two blocks any one has taken, in tenths of a percent
+static uint32_t audio_load   = 0;
+
+/*
+ * Prints how long the blocks have taken to work out over the serial port, then
+ * starts counting again
+ */
+void audio_dump(void) {
+	uint32_t blocks, min, max, load;
+	uint64_t sum;
+
+	// The counts are kept by the DMA's interrupt
+	__disable_irq();
+	blocks = audio_blocks;
+	min    = audio_min;
+	max    = audio_max;
+	sum    = audio_sum;
+	load   = audio_load;
+	audio_blocks = 0;
+	audio_min    = UINT32_MAX;
+	audio_max    = 0;
+	audio_sum    = 0;
+	audio_load   = 0;
+	__enable_irq();
+
+	if (blocks == 0) {
+		printf("audio: no blocks\r\n");
+		return;
+	}
+	printf("audio: %" PRIu32 " blocks, cycles min %" PRIu32 " max %" PRIu32 " mean %" PRIu32
+	       ", load max %" PRIu32 ".%" PRIu32 "%%\r\n",
+	       blocks, min, max, (uint32_t) (sum / blocks), load / 10, load % 10);
+}
+
+#endif
+
+/*
+ * Works out the next block of samples, and counts the blocks in a row that have been
+ * silent. With the profile built in, it also counts how long that took, and what
+ * share it was of the cycles between blocks at the speed the core's running at.
+ */
+static void audio_render(uint32_t *block) {
+#if AUDIO_PROFILE
+	uint32_t start = DWT->CYCCNT;
+	uint32_t cycles, load;
+#endif
+	bool sounding = synth_render(block);
+
+	audio_rendered += AUDIO_BLOCK;
+	audio_quiet = sounding ? 0 : audio_quiet + 1;
+
+#if AUDIO_PROFILE
+	cycles = DWT->CYCCNT - start;
+	load   = (uint32_t) ((uint64_t) cycles * 1000 * AUDIO_RATE_HZ /
+	                     ((uint64_t) SystemCoreClock * AUDIO_BLOCK));
+
+	audio_blocks++;
+	audio_sum += cycles;
+	if (cycles < audio_min)  audio_min  = cycles;
+	if (cycles > audio_max)  audio_max  = cycles;
+	if (load   > audio_load) audio_load = load;
+#endif
+}
+
+/*
+ * Starts the DAC playing from a silent buffer
+ */
+static void audio_start(void) {
+	for (size_t n = 0; n < AUDIO_BLOCK; n++) {
+		audio_buffer[n] = AUDIO_SILENCE_PAIR;
+	}
+	audio_rendered = 2 * AUDIO_BLOCK;
+	audio_quiet    = 0;
+
+	DMA_ClearFlag(AUDIO_DMA_STREAM, AUDIO_DMA_FLAGS);
+	DMA_SetCurrDataCounter(AUDIO_DMA_STREAM, 2 * AUDIO_BLOCK);
+	DMA_Cmd(AUDIO_DMA_STREAM, ENABLE);
+
+	// The samples are counted from here
+	TIM_SetCounter(TIM6, 0);
+	audio_start_us = timebase_now();
+	TIM_Cmd(TIM6, ENABLE);
+	audio_running = true;
+}
+
+/*
+ * Stops the DAC once everything has been played. The output stays where the last
+ * sample left it, which is silent.
+ */
+static void audio_stop(void) {
+	TIM_Cmd(TIM6, DISABLE);
+
+	// Stopping the stream counts as it finishing, so clear the flags afterwards
+	DMA_Cmd(AUDIO_DMA_STREAM, DISABLE);
+	while (DMA_GetCmdStatus(AUDIO_DMA_STREAM) != DISABLE);
+	DMA_ClearFlag(AUDIO_DMA_STREAM, AUDIO_DMA_FLAGS);
+
+	audio_running = false;
+}
+
+/*
+ * Plays a click at a given time, starting the DAC if it isn't already playing. One
+ * that's due before the samples that haven't been worked out yet plays at the first
+ * of them instead, i.e. as soon as it can.
+ *
+ * Must be called from an interrupt at the same priority as the DMA's (as TIM2's is),
+ * so the voices and the buffer can't change under either of them.
+ */
+void audio_click(uint64_t at_us, audio_click_t click) {
+	uint32_t start;
+
+	if (!audio_running) {
+		audio_start();
+	}
+
+	start = audio_sample_at(at_us);
+	synth_play(start > audio_rendered ? start - audio_rendered : 0, audio_sound, click);
+}
+
+/*
+ * Changes what the clicks sound like, to the next sound round. The ones already
+ * playing carry on as they were.
+ */
+void audio_next_sound(void) {
+	audio_sound = (audio_sound_t) ((audio_sound + 1) % AUDIO_SOUNDS);
+}
+
+/*
+ * Whether the DAC is playing
+ */
+bool audio_busy(void) {
+	return audio_running;
+}
+
+/*
+ * The DMA is half-way through the buffer or back at the start of it, so the half it
+ * has just finished is filled again
+ */
+void DMA1_Stream6_IRQHandler(void) {
+	if (DMA_GetITStatus(AUDIO_DMA_STREAM, DMA_IT_HTIF6) != RESET) {
+		DMA_ClearITPendingBit(AUDIO_DMA_STREAM, DMA_IT_HTIF6);
+		audio_render(audio_buffer);
+	}
+	if (DMA_GetITStatus(AUDIO_DMA_STREAM, DMA_IT_TCIF6) != RESET) {
+		DMA_ClearITPendingBit(AUDIO_DMA_STREAM, DMA_IT_TCIF6);
+		audio_render(audio_buffer + AUDIO_BLOCK / 2);
+	}
+
+	if (audio_quiet >= AUDIO_QUIET_BLOCKS) {
+		audio_stop();
+	}
+}
+
+/*
+ * Sets up the DAC, and the timer and DMA that feed it
+ */
+void audio_init(void) {
+	synth_init();
+
+#if AUDIO_PROFILE
+	serial_init();
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+	// The DAC drives PA5 directly, as an analogue pin
+	RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
+	GPIO_InitTypeDef init_data;
+	init_data.GPIO_Pin   = GPIO_Pin_5;
+	init_data.GPIO_Mode  = GPIO_Mode_AN;
+	init_data.GPIO_Speed = GPIO_Speed_50MHz;
+	init_data.GPIO_OType = GPIO_OType_PP;
+	init_data.GPIO_PuPd  = GPIO_PuPd_NOPULL;
+	GPIO_Init(GPIOA, &init_data);
+
+	// TIM6 updates at the sample rate, and each update triggers the DAC
+	RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM6, ENABLE);
+	TIM_TimeBaseInitTypeDef timer_init_data;
+	timer_init_data.TIM_Prescaler     = 0;
+	timer_init_data.TIM_CounterMode   = TIM_CounterMode_Up;
+	timer_init_data.TIM_Period        = clock_timer_hz(TIM6) / AUDIO_RATE_HZ - 1;
+	timer_init_data.TIM_ClockDivision = TIM_CKD_DIV1;
+	timer_init_data.TIM_RepetitionCounter = 0;
+	TIM_TimeBaseInit(TIM6, &timer_init_data);
+	TIM_SelectOutputTrigger(TIM6, TIM_TRGOSource_Update);
+
+	RCC_APB1PeriphClockCmd(RCC_APB1Periph_DAC, ENABLE);
+	DAC_InitTypeDef dac_init_data;
+	DAC_StructInit(&dac_init_data);
+	dac_init_data.DAC_Trigger      = DAC_Trigger_T6_TRGO;
+	dac_init_data.DAC_OutputBuffer = DAC_OutputBuffer_Enable;
+	DAC_Init(DAC_Channel_2, &dac_init_data);
+	DAC_Cmd(DAC_Channel_2, ENABLE);
+
+	// One trigger by hand, before the DMA is listening, brings the output up to
+	// silence rather than leaving it at the bottom of its range until the first click
+	DAC_SetChannel2Data(DAC_Align_12b_R, AUDIO_SILENCE);
+	TIM_GenerateEvent(TIM6, TIM_EventSource_Update);
+	DAC_DMACmd(DAC_Channel_2, ENABLE);
+
+	// Each sample is a half-word for the right-aligned 12-bit holding register, and
+	// the stream goes back to the start of the buffer after the end of it
+	RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1, ENABLE);
+	DMA_InitTypeDef dma_init_data;
+	DMA_StructInit(&dma_init_data);
+	dma_init_data.DMA_Channel            = AUDIO_DMA_CHANNEL;
+	dma_init_data.DMA_PeripheralBaseAddr = (uint32_t) &DAC->DHR12R2;
+	dma_init_data.DMA_Memory0BaseAddr    = (uint32_t) audio_buffer;
+	dma_init_data.DMA_DIR                = DMA_DIR_MemoryToPeripheral;
+	dma_init_data.DMA_BufferSize         = 2 * AUDIO_BLOCK;
+	dma_init_data.DMA_PeripheralInc      = DMA_PeripheralInc_Disable;
+	dma_init_data.DMA_MemoryInc          = DMA_MemoryInc_Enable;
+	dma_init_data.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+	dma_init_data.DMA_MemoryDataSize     = DMA_MemoryDataSize_HalfWord;
+	dma_init_data.DMA_Mode               = DMA_Mode_Circular;
+	dma_init_data.DMA_Priority           = DMA_Priority_High;
+	dma_init_data.DMA_FIFOMode           = DMA_FIFOMode_Disable;
+	DMA_Init(AUDIO_DMA_STREAM, &dma_init_data);
+	DMA_ITConfig(AUDIO_DMA_STREAM, DMA_IT_HT | DMA_IT_TC, ENABLE);
+
+	// Same priority as TIM2, which plays the clicks (see audio_click())
+	NVIC_InitTypeDef nvic_init_data;
+	nvic_init_data.NVIC_IRQChannel    = DMA1_Stream6_IRQn;
+	nvic_init_data.NVIC_IRQChannelCmd = ENABLE;
+	nvic_init_data.NVIC_IRQChannelPreemptionPriority = 1;
+	nvic_init_data.NVIC_IRQChannelSubPriority = 1;
+	NVIC_Init(&nvic_init_data);
+}
@@ -0,0 +1,55 @@
+#ifndef _AUDIO_H_
+#define _AUDIO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Rate the DAC plays samples at. It has to divide the timers' clock exactly (see
+// clock.c), so the samples stay on the same grid as the time base.
+#define AUDIO_RATE_HZ 48000
+
+// Samples in each half of the DAC's buffer, which are worked out together. Must be
+// even, as they go two to a word (see synth.c).
+#define AUDIO_BLOCK 32
+
+// Set to 0 to leave out the quieter click half-way through each beat, with the LEDs
+// going off
+#ifndef AUDIO_SUBDIVISIONS
+#define AUDIO_SUBDIVISIONS 1
+#endif
+
+// Set to 1 to build in a count of the processor cycles each block of samples takes
+// to work out (see audio.c), printed over the serial port with the dump button. The
+// simulation's cycle counter only moves for the peripherals, so it shows nothing there.
+#ifndef AUDIO_PROFILE
+#define AUDIO_PROFILE 0
+#endif
+
+// The clicks there are
+typedef enum {
+	AUDIO_ACCENT,      // The first beat of the bar
+	AUDIO_BEAT,        // Every other beat
+	AUDIO_SUBDIVISION, // Half-way through a beat
+	AUDIO_CLICKS
+} audio_click_t;
+
+// What they sound like (see synth.c)
+typedef enum {
+	AUDIO_SYNTHESISED, // Tones, higher for the accent
+	AUDIO_WOODBLOCK,   // Sampled
+	AUDIO_COWBELL,     // Sampled
+	AUDIO_SOUNDS
+} audio_sound_t;
+
+void audio_init(void);
+void audio_click(uint64_t at_us, audio_click_t click);
+bool audio_busy(void);
+void audio_next_sound(void);
+
+#if AUDIO_PROFILE
+void audio_dump(void);
+#else
+#define audio_dump() ((void) 0)
+#endif
+
+#endif /*_AUDIO_H_*/
@@ -0,0 +1,138 @@
+#include "beat.h"
+#include <stdbool.h>
+
+// A point on the beat grid. Beat periods are rarely a whole number of microseconds
+// (e.g. 7BPM is 8571428.571428...us), so as well as the whole microseconds each
+// point keeps a 32-bit binary fraction of a microsecond, and below that the
+// remainder of the division by the tempo. Carrying the remainder along means the
+// grid is exact: beat n is always at origin + n*period, however long it runs,
+// rather than drifting by a rounding error on every beat (see beat_time_t).
+
+// The beat period (and half-period, for switching the LEDs off) as 32.32 fixed-point
+// microseconds. At 1BPM the period is 60,000,000us, so the whole part fits in 32 bits.
+static uint64_t period_q       = 0;
+static uint32_t period_rem     = 0;
+static uint64_t half_period_q  = 0;
+// Tempo is the divisor the remainders are counted against
+static uint32_t divisor        = 1;
+
+// The most recent beat, and the one that is due next
+static beat_time_t last_beat   = { 0, 0, 0 };
+static beat_time_t next_beat   = { 0, 0, 0 };
+
+/*
+ * Works out t + period, carrying the remainder into the fraction and the fraction
+ * into the whole microseconds. This is the only place time moves along the grid.
+ */
+static beat_time_t beat_add_period(beat_time_t t) {
+	uint64_t frac;
+
+	t.rem += period_rem;
+	bool carry = t.rem >= divisor;
+	if (carry) {
+		t.rem -= divisor;
+	}
+
+	frac   = (uint64_t) t.frac + (uint32_t) period_q + carry;
+	t.frac = (uint32_t) frac;
+	t.us  += (period_q >> 32) + (frac >> 32);
+
+	return t;
+}
+
+/*
+ * Changes the period of the grid. The most recent beat stays where it was and becomes
+ * the new origin, so the next beat is one (new) period after it.
+ */
+void beat_set_tempo(uint16_t bpm) {
+	divisor       = bpm;
+	period_q      = (BEAT_US_PER_MINUTE << 32) / bpm;
+	period_rem    = (uint32_t) ((BEAT_US_PER_MINUTE << 32) % bpm);
+	half_period_q = ((BEAT_US_PER_MINUTE / 2) << 32) / bpm;
+
+	// Any remainder was counted against the old tempo so isn't meaningful any more
+	last_beat.rem = 0;
+	next_beat     = beat_add_period(last_beat);
+}
+
+/*
+ * Puts the grid on a given beat, at a given period (as 32.32 fixed-point microseconds)
+ * rather than one worked out from a whole number of BPM - e.g. from a line fitted to
+ * taps. The beat becomes the most recent one, so the next is one period after it.
+ */
+void beat_lock(uint64_t beat_us, uint64_t period) {
+	// The period's exact, so there's no remainder to carry
+	divisor       = 1;
+	period_q      = period;
+	period_rem    = 0;
+	half_period_q = period / 2;
+
+	last_beat.us   = beat_us;
+	last_beat.frac = 0;
+	last_beat.rem  = 0;
+	next_beat      = beat_add_period(last_beat);
+}
+
+/*
+ * Restarts the grid so that a beat is due right now
+ */
+void beat_synchronise(uint64_t now_us) {
+	last_beat.us   = now_us;
+	last_beat.frac = 0;
+	last_beat.rem  = 0;
+	next_beat      = last_beat;
+}
+
+/*
+ * Moves along to the next beat once the one that was due has been played.
+ *
+ * If that leaves the next beat in the past as well (which can only happen straight
+ * after the tempo has been raised a long way), those beats have been missed and
+ * there's no sense playing them back-to-back to catch up - instead the grid is
+ * restarted from now, which is how the tempo change will be heard anyway.
+ */
+void beat_advance(uint64_t now_us) {
+	last_beat = next_beat;
+	next_beat = beat_add_period(last_beat);
+
+	if (next_beat.us <= now_us) {
+		last_beat.us   = now_us;
+		last_beat.frac = 0;
+		last_beat.rem  = 0;
+		next_beat      = beat_add_period(last_beat);
+	}
+}
+
+/*
+ * Time (in whole microseconds) that the next beat is due
+ */
+uint64_t beat_next_us(void) {
+	return next_beat.us;
+}
+
+/*
+ * Time (in whole microseconds) half-way through the current beat, when the LEDs
+ * should go off. The remainder is below a nanosecond so can be safely ignored here.
+ */
+uint64_t beat_half_us(void) {
+	uint64_t frac = (uint64_t) last_beat.frac + (uint32_t) half_period_q;
+	return last_beat.us + (half_period_q >> 32) + (frac >> 32);
+}
+
+/*
+ * Notes where the grid has got to, so it can be put back there (see beat_restore())
+ */
+void beat_save(beat_mark_t *mark) {
+	mark->last = last_beat;
+	mark->next = next_beat;
+}
+
+/*
+ * Puts the grid back to where it was when it was saved, e.g. to work beats out again
+ * that were worked out ahead of time. The tempo mustn't have changed in between, as
+ * the remainders are counted against it.
+ */
+void beat_restore(const beat_mark_t *mark) {
+	last_beat = mark->last;
+	next_beat = mark->next;
+}
@@ -0,0 +1,31 @@
+#ifndef _BEAT_H_
+#define _BEAT_H_
+
+#include <stdint.h>
+
+// Number of microseconds in a minute (i.e. a beat period at 1 BPM)
+#define BEAT_US_PER_MINUTE 60000000ULL
+
+// A point on the beat grid (see beat.c)
+typedef struct {
+	uint64_t us;   // Whole microseconds
+	uint32_t frac; // Fraction of a microsecond, in units of 2^-32us
+	uint32_t rem;  // Remainder, in units of (2^-32us / bpm)
+} beat_time_t;
+
+// Where the grid has got to: the most recent beat and the one due next
+typedef struct {
+	beat_time_t last;
+	beat_time_t next;
+} beat_mark_t;
+
+void     beat_set_tempo(uint16_t bpm);
+void     beat_lock(uint64_t beat_us, uint64_t period);
+void     beat_synchronise(uint64_t now_us);
+void     beat_advance(uint64_t now_us);
+uint64_t beat_next_us(void);
+uint64_t beat_half_us(void);
+void     beat_save(beat_mark_t *mark);
+void     beat_restore(const beat_mark_t *mark);
+
+#endif /*_BEAT_H_*/
@@ -0,0 +1,97 @@
+#include <stm32f4xx_rcc.h>
+#include <stm32f4xx.h>
+#include "clock.h"
+#include "jitter.h"
+#include "serial.h"
+
+// The core runs at full speed only while there's something to work out, and a
+// quarter of that otherwise. The PLL stays locked at 168MHz throughout, as set up
+// by SystemInit(): re-locking it at another frequency would leave the system clock
+// on the HSE for a while, and the time base counting at the wrong rate with it.
+// The profiles only change how far the bus prescalers divide it down.
+//
+// They're picked so the timers' clock stays at 42MHz in every profile (and as
+// SystemInit() leaves it), as the timers run at twice their bus clock whenever that
+// is divided down from HCLK: 168MHz / 8 * 2 for performance, and 42MHz / 1 for low
+// power. So TIM2 counts at exactly the same rate through a switch, and the time
+// base and the beat grid don't move. The serial port divides its bus clock
+// itself, which does change, so it has to follow.
+typedef struct {
+	uint32_t hclk;  // Dividing the system clock, as for RCC_HCLKConfig()
+	uint32_t pclk1; // Dividing HCLK, as for RCC_PCLK1Config()
+	uint32_t pclk2; // Dividing HCLK, as for RCC_PCLK2Config()
+} clock_settings_t;
+
+static const clock_settings_t clock_settings[] = {
+	[CLOCK_PERFORMANCE] = { RCC_SYSCLK_Div1, RCC_HCLK_Div8, RCC_HCLK_Div8 },
+	[CLOCK_LOW_POWER]   = { RCC_SYSCLK_Div4, RCC_HCLK_Div1, RCC_HCLK_Div1 }
+};
+
+#define CLOCK_CFGR_BUSES (RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2)
+
+static clock_profile_t clock_current;
+
+/*
+ * Switches the clocks to a profile. The prescalers all go in one write, as setting
+ * them one at a time (as RCC_HCLKConfig() and the like do) would have the timers
+ * counting at the wrong rate in between.
+ */
+static void clock_apply(clock_profile_t profile) {
+	const clock_settings_t *settings = &clock_settings[profile];
+
+	RCC->CFGR = (RCC->CFGR & ~CLOCK_CFGR_BUSES) |
+	            settings->hclk | settings->pclk1 | (settings->pclk2 << 3);
+	SystemCoreClockUpdate();
+	clock_current = profile;
+}
+
+/*
+ * Changes how fast the core runs. Not while the serial port is still sending, as its
+ * baud rate would change under the character going out: returns whether it did.
+ * With the jitter recorder built in it always runs at full speed, as that counts
+ * core cycles between edges (see jitter.c).
+ */
+bool clock_set_profile(clock_profile_t profile) {
+#if JITTER_RECORDER
+	profile = CLOCK_PERFORMANCE;
+#endif
+
+	if (profile == clock_current) {
+		return true;
+	}
+	if (serial_busy()) {
+		return false;
+	}
+
+	__disable_irq();
+	clock_apply(profile);
+	serial_clock_changed();
+	__enable_irq();
+
+	return true;
+}
+
+clock_profile_t clock_profile(void) {
+	return clock_current;
+}
+
+/*
+ * The rate a timer counts at before its own prescaler, from whichever bus it's on:
+ * twice the bus clock when that's divided down from HCLK, otherwise the same
+ */
+uint32_t clock_timer_hz(const TIM_TypeDef *timer) {
+	RCC_ClocksTypeDef clocks;
+	uint32_t pclk;
+
+	RCC_GetClocksFreq(&clocks);
+	pclk = (uint32_t) timer >= APB2PERIPH_BASE ? clocks.PCLK2_Frequency : clocks.PCLK1_Frequency;
+	return pclk == clocks.HCLK_Frequency ? pclk : 2 * pclk;
+}
+
+/*
+ * Starts in the performance profile. Must be called before anything else is set up,
+ * as the serial port works out its baud rate from the clocks.
+ */
+void clock_init(void) {
+	clock_apply(CLOCK_PERFORMANCE);
+}
@@ -0,0 +1,19 @@
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stm32f4xx.h>
+
+// How fast the core runs
+typedef enum {
+	CLOCK_PERFORMANCE, // 168MHz
+	CLOCK_LOW_POWER    // 42MHz
+} clock_profile_t;
+
+void            clock_init(void);
+bool            clock_set_profile(clock_profile_t profile);
+clock_profile_t clock_profile(void);
+uint32_t        clock_timer_hz(const TIM_TypeDef *timer);
+
+#endif /*_CLOCK_H_*/
@@ -0,0 +1,111 @@
+#include <stddef.h>
+#include "debounce.h"
+
+// A button only counts as having gone down (or up) once it has read that way for a
+// number of samples in a row, so the contacts bouncing as they close don't look
+// like several presses.
+//
+// Each button needs its own count, but rather than eight separate counters they're
+// kept as "vertical" counters: one byte for each bit of the count, with a bit in
+// each for every button. So bit 0 of the first byte and bit 0 of the second are
+// the two lowest bits of button 0's count. All eight counters can then be stepped,
+// cleared and compared at once with a handful of bitwise operations, which take the
+// same time however many buttons are bouncing.
+#define DEBOUNCE_SETTLE_BITS 3
+#define DEBOUNCE_HOLD_BITS   7
+
+// The debounced state of the buttons
+static uint8_t state = 0;
+
+// How many samples in a row each button has read differently to its state
+static uint8_t settle[DEBOUNCE_SETTLE_BITS];
+static uint8_t settle_samples = 1;
+
+// How many samples each button has been down for, and the buttons that have already
+// been reported as held (which stop counting until they're let go)
+static uint8_t hold[DEBOUNCE_HOLD_BITS];
+static uint8_t hold_samples = DEBOUNCE_MAX_HOLD_SAMPLES;
+static uint8_t held_reported = 0;
+
+/*
+ * Adds one to each counter whose button is in a mask, and clears the rest back to 0.
+ * Each bit carries into the next, like adding by hand.
+ */
+static void vertical_count(uint8_t *planes, size_t bits, uint8_t counting) {
+	uint8_t carry = counting;
+
+	for (size_t i = 0; i < bits; i++) {
+		uint8_t plane = planes[i];
+		planes[i] = (plane ^ carry) & counting;
+		carry    &= plane;
+	}
+}
+
+/*
+ * Gives the mask of buttons whose counter is at a value
+ */
+static uint8_t vertical_equals(const uint8_t *planes, size_t bits, uint8_t value) {
+	uint8_t match = 0xFF;
+
+	for (size_t i = 0; i < bits; i++) {
+		match &= (value >> i) & 1 ? planes[i] : (uint8_t) ~planes[i];
+	}
+
+	return match;
+}
+
+/*
+ * Sets how many samples in a row a button has to read the same before it counts as
+ * having changed (1 to DEBOUNCE_MAX_SAMPLES), and how many it has to be down for to
+ * count as a long press (1 to DEBOUNCE_MAX_HOLD_SAMPLES)
+ */
+void debounce_init(uint8_t settle_for, uint8_t hold_for) {
+	settle_samples = settle_for < 1 ? 1 :
+	                 settle_for > DEBOUNCE_MAX_SAMPLES ? DEBOUNCE_MAX_SAMPLES : settle_for;
+	hold_samples   = hold_for < 1 ? 1 :
+	                 hold_for > DEBOUNCE_MAX_HOLD_SAMPLES ? DEBOUNCE_MAX_HOLD_SAMPLES : hold_for;
+}
+
+/*
+ * Takes a new sample of the buttons (one bit each, 1 for down) and works out which
+ * have been pressed, released or held since the last.
+ */
+void debounce_sample(uint8_t raw, debounce_changes_t *changes) {
+	uint8_t changing = raw ^ state;
+	uint8_t toggled;
+
+	// Anything that reads the same as its state starts settling again from nothing
+	vertical_count(settle, DEBOUNCE_SETTLE_BITS, changing);
+	toggled = changing & vertical_equals(settle, DEBOUNCE_SETTLE_BITS, settle_samples);
+	state  ^= toggled;
+
+	changes->pressed  = toggled & state;
+	changes->released = toggled & ~state;
+
+	// Count how long the buttons have been down for, until they've been reported
+	held_reported &= state;
+	vertical_count(hold, DEBOUNCE_HOLD_BITS, state & ~held_reported);
+	changes->held  = state & ~held_reported & vertical_equals(hold, DEBOUNCE_HOLD_BITS, hold_samples);
+	held_reported |= changes->held;
+}
+
+/*
+ * Whether all the buttons are up and none are settling, i.e. whether there's no need
+ * to keep sampling them
+ */
+bool debounce_idle(void) {
+	uint8_t busy = state;
+
+	for (size_t i = 0; i < DEBOUNCE_SETTLE_BITS; i++) {
+		busy |= settle[i];
+	}
+
+	return busy == 0;
+}
+
+/*
+ * Gives which buttons are down, once they have settled (one bit each)
+ */
+uint8_t debounce_state(void) {
+	return state;
+}
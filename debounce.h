@@ -0,0 +1,24 @@
+#ifndef _DEBOUNCE_H_
+#define _DEBOUNCE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Most samples a button can be made to settle for, and be held down for before it's
+// a long press (the counters are 3 and 7 bits)
+#define DEBOUNCE_MAX_SAMPLES      7
+#define DEBOUNCE_MAX_HOLD_SAMPLES 127
+
+// What happened to the buttons (one bit each) at a sample
+typedef struct {
+	uint8_t pressed;  // Went down
+	uint8_t released; // Came back up
+	uint8_t held;     // Have been down long enough to be a long press
+} debounce_changes_t;
+
+void    debounce_init(uint8_t settle_for, uint8_t hold_for);
+void    debounce_sample(uint8_t raw, debounce_changes_t *changes);
+bool    debounce_idle(void);
+uint8_t debounce_state(void);
+
+#endif /*_DEBOUNCE_H_*/
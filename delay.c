@@ -1,26 +1,42 @@
 #include "delay.h"
 #include "stm32f4xx.h"
 #include <stdint.h>
+#include <stdbool.h>
+#include "timebase.h"
+#include "wheel.h"
 
-static uint_fast8_t _init = 0;
+// Delays are a timer on the wheel (see wheel.c), with the processor asleep until it
+// goes off, rather than spinning on a timer of their own. Only for the main loop
+// (and setting up), as they wait for the TIM2 interrupt, which must already be going.
+static wheel_timer_t     delay_timer;
+static volatile bool     delay_done = false;
 
-static void _delay_init(void) {
-	TIM14->DIER = 0x00000000;		/* Disable TIM14 interrupts */
-	TIM14->PSC = 83;					/* 1us per tick from a 84MHz clock */
-	TIM14->EGR = TIM_EGR_UG;		/* Force register update */
-	RCC->APB1ENR |= RCC_APB1ENR_TIM14EN;	/* Enable TIM14 clock */
+static void delay_expired(void) {
+	delay_done = true;
+}
+
+/*
+ * Sleeps for at least the given number of microseconds. Interrupts stay masked
+ * between checking and sleeping, so the timer can't go off in between and leave it
+ * asleep with nothing to wake it: a pending interrupt still wakes the processor, and
+ * then runs as soon as they're unmasked again.
+ */
+static void delay_for(uint32_t us) {
+	__disable_irq();
+	delay_done = false;
+	wheel_arm(&delay_timer, timebase_now() + us, delay_expired);
+	while (!delay_done) {
+		__WFI();
+		__enable_irq();
+		__disable_irq();
+	}
+	__enable_irq();
 }
 
 void delay_us(uint16_t us) {
-	if (!_init) _delay_init();
-	TIM14->CNT = 0;							/* Reset TIM14 */
-	TIM14->CR1 = TIM_CR1_CEN;		/* Start TIM14, source CLK_INT */
-	while (TIM14->CNT < us);
-	TIM14->CR1 = 0x00000000;		/* Stop TIM14 */
+	delay_for(us);
 }
 
 void delay_ms(uint16_t ms) {
-	uint16_t i;
-	for (i = 0; i < ms; ++i)
-		delay_us(1000);
+	delay_for((uint32_t) ms * 1000);
 }
@@ -0,0 +1,19 @@
+#ifndef _DWT_H_
+#define _DWT_H_
+
+#include <stm32f4xx.h>
+
+// The CMSIS core header in this project is older than its support for the data
+// watchpoint and trace unit, so the parts of it that are used are defined here instead
+#ifndef DWT
+typedef struct {
+	__IO uint32_t CTRL;
+	__IO uint32_t CYCCNT;
+} DWT_Type;
+
+#define DWT_BASE               (0xE0001000UL)
+#define DWT                    ((DWT_Type *) DWT_BASE)
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+#endif
+
+#endif /*_DWT_H_*/
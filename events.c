@@ -0,0 +1,73 @@
+#include <stm32f4xx.h>
+#include "events.h"
+
+// Input events go from the button interrupt to the main loop through a ring. Only
+// the interrupt writes events_head and only the main loop writes events_tail, so
+// neither side ever has to wait for or lock out the other, and nothing is lost
+// between one checking for an event and marking it handled.
+//
+// Both count up forever (wrapping at 2^32, which the power-of-two size divides), so
+// the ring is empty when they're equal and full when they're EVENTS_QUEUE_SIZE apart.
+static input_event_t     events_queue[EVENTS_QUEUE_SIZE];
+static volatile uint32_t events_head = 0; // Where the next event goes
+static volatile uint32_t events_tail = 0; // Where the next event comes from
+
+// Changes waiting for room in the ring, and when the first of them was
+static input_event_t     waiting      = { 0, 0, 0, 0 };
+
+/*
+ * Queues up changes to the buttons for the main loop. Must only be called from the
+ * one interrupt, but should be called every time it samples the buttons, even if
+ * nothing has changed.
+ *
+ * If the ring is full the changes are kept until there's room, so they are never
+ * dropped. Any more that come in the meantime are added to the same event, at the
+ * time of the first; only a button pressed twice while the main loop is that far
+ * behind would count as once.
+ */
+void events_push(uint64_t at_us, uint8_t pressed, uint8_t released, uint8_t held) {
+	uint32_t head = events_head;
+
+	if (pressed | released | held) {
+		if (!(waiting.pressed | waiting.released | waiting.held)) {
+			waiting.at_us = at_us;
+		}
+		waiting.pressed  |= pressed;
+		waiting.released |= released;
+		waiting.held     |= held;
+	}
+	if (!(waiting.pressed | waiting.released | waiting.held) ||
+	    head - events_tail == EVENTS_QUEUE_SIZE) {
+		return;
+	}
+
+	events_queue[head % EVENTS_QUEUE_SIZE] = waiting;
+	waiting.pressed  = 0;
+	waiting.released = 0;
+	waiting.held     = 0;
+
+	// The event has to be all there before the main loop can see it
+	__DMB();
+	events_head = head + 1;
+}
+
+/*
+ * Takes the oldest event off the queue. Returns false if there isn't one. Must
+ * only be called from the main loop.
+ */
+bool events_pop(input_event_t *event) {
+	uint32_t tail = events_tail;
+
+	if (tail == events_head) {
+		return false;
+	}
+
+	// Don't read the event until it's known to be there, and don't give its slot
+	// back until it's been read
+	__DMB();
+	*event = events_queue[tail % EVENTS_QUEUE_SIZE];
+	__DMB();
+	events_tail = tail + 1;
+
+	return true;
+}
@@ -0,0 +1,24 @@
+#ifndef _EVENTS_H_
+#define _EVENTS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of input events that can be waiting for the main loop (a power of two).
+// The buttons are sampled every 5ms, and each sample raises one event at most, so
+// this is at least 320ms of the main loop being busy before events start having to
+// be merged (see events_push()).
+#define EVENTS_QUEUE_SIZE 64
+
+// Something that happened on the buttons, and when
+typedef struct {
+	uint64_t at_us;    // When the buttons were first seen to change
+	uint8_t  pressed;  // Mask of the buttons that went down (GPIOE pins 8-15)
+	uint8_t  released; // Mask of the buttons that came back up
+	uint8_t  held;     // Mask of the buttons held down long enough to be a long press
+} input_event_t;
+
+void events_push(uint64_t at_us, uint8_t pressed, uint8_t released, uint8_t held);
+bool events_pop(input_event_t *event);
+
+#endif /*_EVENTS_H_*/
@@ -0,0 +1,208 @@
+#include "jitter.h"
+
+#if JITTER_RECORDER
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stm32f4xx_tim.h>
+#include <misc.h>
+#include <stm32f4xx.h>
+#include "timebase.h"
+#include "leds.h"
+#include "serial.h"
+#include "dwt.h"
+
+// Records how long after each LED edge is due, by the beat grid, the LED edge
+// interrupt gets to run, in processor cycles (DWT->CYCCNT).
+//
+// The edge itself is a TIM2 compare and a DMA write to the port, all in hardware
+// (see leds.c), so it can't be timestamped directly. What can be is the entry to the
+// interrupt TIM8 raises along with asking for the write: it notes the cycle count,
+// and the cycle count the edge ought to have happened at, worked out from the time
+// of the edge that's been written. The two go into a ring buffer, and the main loop
+// takes them out and keeps the statistics, so the interrupt does as little as possible.
+//
+// So every sample is the trigger getting through TIM8, plus the interrupt entry time
+// (around 12 cycles, plus flash wait states), plus however long the interrupt was held off.
+// The first two are fixed and show up in the minimum; the spread above it is what
+// the processor adds, and none of that reaches the port.
+
+// Size of the ring buffer. Must be a power of two. The main loop empties it every
+// time it wakes, which is at least every button poll, so this is plenty.
+#define JITTER_RING_SIZE 64
+
+// Histogram for working out the 99th percentile. Each bin covers JITTER_BIN_CYCLES
+// cycles, starting from JITTER_HIST_MIN; anything outside is counted in the end bins.
+// The percentile is only as fine as a bin, and needs JITTER_P99_MIN_EDGES edges to
+// mean anything (with fewer, the top 1% is less than one edge, i.e. it's the max).
+#define JITTER_BIN_CYCLES    16
+#define JITTER_HIST_BINS     128
+#define JITTER_HIST_MIN      (-512)
+#define JITTER_P99_MIN_EDGES 100
+
+typedef struct {
+	uint32_t scheduled; // Cycle count the edge was due at
+	uint32_t actual;    // Cycle count the edge interrupt saw
+} jitter_sample_t;
+
+// The ring buffer. Only the LED edge interrupt moves head, and only the main loop moves
+// tail, so neither needs a lock: each index is written by one side and read by the other.
+static jitter_sample_t   ring[JITTER_RING_SIZE];
+static volatile uint32_t ring_head = 0;
+static volatile uint32_t ring_tail = 0;
+// Samples lost because the ring was full
+static volatile uint32_t ring_overruns = 0;
+
+// A time base tick and the cycle count it happened at
+static uint64_t base_us     = 0;
+static uint32_t base_cycles = 0;
+
+// Running statistics (main loop only)
+static uint32_t count = 0;
+static int32_t  min   = INT32_MAX;
+static int32_t  max   = INT32_MIN;
+static int64_t  sum   = 0;
+static uint32_t histogram[JITTER_HIST_BINS];
+
+/*
+ * An LED edge has been written to the port.
+ *
+ * The cycle counter and the time base run from the same clock, so once one tick of
+ * the time base has been matched up to a cycle count (see jitter_init()) the edge's
+ * time can be turned into cycles exactly. Both wrap (the cycle count every 25
+ * seconds or so), but the differences still work.
+ */
+void LEDS_EDGE_IRQHandler(void) {
+	uint32_t actual  = DWT->CYCCNT;
+	uint32_t head    = ring_head;
+	uint32_t edge_us = leds_written_us();
+
+	leds_edge_irq_clear();
+
+	if (head - ring_tail >= JITTER_RING_SIZE) {
+		ring_overruns++;
+		return;
+	}
+
+	ring[head % JITTER_RING_SIZE].scheduled =
+		base_cycles + (edge_us - (uint32_t) base_us) * (SystemCoreClock / TIMEBASE_HZ);
+	ring[head % JITTER_RING_SIZE].actual    = actual;
+
+	// The sample has to be in the ring before the main loop can see it's there
+	__DMB();
+	ring_head = head + 1;
+}
+
+/*
+ * Takes any new samples out of the ring buffer and adds them to the statistics.
+ * Called from the main loop.
+ */
+void jitter_poll(void) {
+	uint32_t tail = ring_tail;
+
+	while (tail != ring_head) {
+		jitter_sample_t sample = ring[tail % JITTER_RING_SIZE];
+		int32_t jitter = (int32_t) (sample.actual - sample.scheduled);
+		int32_t bin    = (jitter - JITTER_HIST_MIN) / JITTER_BIN_CYCLES;
+
+		// Finished with the slot, so the interrupt can have it back
+		__DMB();
+		ring_tail = ++tail;
+
+		if (jitter < min) min = jitter;
+		if (jitter > max) max = jitter;
+		sum += jitter;
+		count++;
+
+		if (jitter < JITTER_HIST_MIN) bin = 0;
+		if (bin >= JITTER_HIST_BINS)  bin = JITTER_HIST_BINS - 1;
+		histogram[bin]++;
+	}
+}
+
+/*
+ * Prints the statistics so far over the serial port, then starts them again
+ */
+void jitter_dump(void) {
+	uint32_t target, seen = 0;
+	int32_t  p99 = 0;
+	size_t   i;
+
+	jitter_poll();
+
+	if (count == 0) {
+		printf("jitter: no edges\r\n");
+		return;
+	}
+
+	printf("jitter: %" PRIu32 " edges, %" PRIu32 " lost, cycles min %" PRId32 " max %" PRId32
+	       " mean %" PRId32,
+	       count, ring_overruns, min, max, (int32_t) (sum / count));
+
+	// The upper edge of the bin the 99th percentile falls in, or a lower bound if
+	// it's in the top bin
+	if (count >= JITTER_P99_MIN_EDGES) {
+		target = count - count / 100;
+		for (i = 0; i < JITTER_HIST_BINS; i++) {
+			seen += histogram[i];
+			if (seen >= target) {
+				p99 = JITTER_HIST_MIN + (int32_t) (i + 1) * JITTER_BIN_CYCLES;
+				break;
+			}
+		}
+		if (i >= JITTER_HIST_BINS - 1) {
+			printf(" p99 >%" PRId32 "\r\n", p99 - JITTER_BIN_CYCLES);
+		} else {
+			printf(" p99 <=%" PRId32 " (%d-cycle bins)\r\n", p99, JITTER_BIN_CYCLES);
+		}
+	} else {
+		printf(" p99 needs %d edges\r\n", JITTER_P99_MIN_EDGES);
+	}
+
+	count = 0;
+	min   = INT32_MAX;
+	max   = INT32_MIN;
+	sum   = 0;
+	ring_overruns = 0;
+	for (i = 0; i < JITTER_HIST_BINS; i++) {
+		histogram[i] = 0;
+	}
+}
+
+/*
+ * Sets up the cycle counter, the serial port and the LED edge interrupt. Must be
+ * called after the LEDs and the time base are set up.
+ */
+void jitter_init(void) {
+	uint32_t start;
+
+	serial_init();
+
+	// Keep the clocks (and so the cycle counter) running while the processor sleeps
+	DBGMCU->CR |= DBGMCU_CR_DBG_SLEEP;
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL  |= DWT_CTRL_CYCCNTENA_Msk;
+
+	// Catch the time base just as it ticks over, so the reference point isn't up to a
+	// whole microsecond out
+	start = TIM2->CNT;
+	while (TIM2->CNT == start);
+	base_cycles = DWT->CYCCNT;
+	base_us     = timebase_now();
+
+	leds_edge_irq_enable();
+
+	// Above everything else (see main()), so its timestamps don't include whatever
+	// another interrupt had left to do
+	NVIC_InitTypeDef nvic_init_data;
+	nvic_init_data.NVIC_IRQChannel    = LEDS_EDGE_IRQn;
+	nvic_init_data.NVIC_IRQChannelCmd = ENABLE;
+	nvic_init_data.NVIC_IRQChannelPreemptionPriority = 0;
+	nvic_init_data.NVIC_IRQChannelSubPriority = 1;
+	NVIC_Init(&nvic_init_data);
+}
+
+#endif
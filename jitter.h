@@ -0,0 +1,27 @@
+#ifndef _JITTER_H_
+#define _JITTER_H_
+
+#include <stdint.h>
+
+// Set to 1 to build in the beat jitter recorder (see jitter.c). It costs an extra
+// interrupt per LED edge and keeps the clocks running while asleep, so it's left out
+// of normal builds.
+#ifndef JITTER_RECORDER
+#define JITTER_RECORDER 0
+#endif
+
+#if JITTER_RECORDER
+
+void jitter_init(void);
+void jitter_poll(void);
+void jitter_dump(void);
+
+#else
+
+#define jitter_init()              ((void) 0)
+#define jitter_poll()              ((void) 0)
+#define jitter_dump()              ((void) 0)
+
+#endif
+
+#endif /*_JITTER_H_*/
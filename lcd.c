@@ -1,25 +1,439 @@
+#include <stm32f4xx.h>
+#include <stdbool.h>
 #include "lcd.h"
 #include "delay.h"
+#include "timebase.h"
+#include "wheel.h"
 
-#define _h(x) (*((volatile uint16_t *)(0x4002<<16|x)))
-#define _w(x) (*((volatile uint32_t *)(0x4002<<16|x)))
-#define _d(x) _w(0xC18)=0xFF<<16|(x&0xFF)
-#define _e(x) {_h(0x418)=4;delay_us(1);_h(0x41A)=4;delay_us(x);}
-#define _c(x,y) {_d(x);_e(y);}
+// The LCD is an HD44780 driven 8 bits at a time: data on PD0-PD7, with RS (register
+// select), RW (read/write) and E (enable) on PB0-PB2. It takes whatever's on the
+// data lines as E falls, then needs some time to act on it before it'll take the
+// next.
+//
+// Each command or character takes tens of microseconds (and clearing the screen a
+// couple of milliseconds), so rather than callers waiting for them, lcd_print() and
+// lcd_move() only write to a copy of what the screen should show. A timer on the
+// wheel (see wheel.c) then steps through sending whatever differs from what the LCD
+// is known to show, one callback to raise E and another to drop it, in the background.
+//
+// Most LCDs act on each byte well within the datasheet's worst-case time, so rather
+// than always waiting that long, the busy flag is read back (RW high, with the data
+// lines turned round to inputs) until it clears. lcd_init() checks that reading
+// back works - that the address just set can be read back - and if not, or if the
+// flag doesn't clear in the worst-case time, it's back to just waiting.
+#define LCD_RS (1 << 0)
+#define LCD_RW (1 << 1)
+#define LCD_E  (1 << 2)
 
+#define LCD_ROWS    2
+#define LCD_COLUMNS 16
+
+// Commands
+#define LCD_FUNCTION_8BIT_2LINE 0x38
+#define LCD_DISPLAY_ON          0x0C
+#define LCD_CLEAR               0x01
+#define LCD_ENTRY_INCREMENT     0x06
+#define LCD_SET_ADDRESS         0x80
+#define LCD_SET_CGRAM_ADDRESS   0x40
+
+// Read back from the LCD when RS is low: the busy flag, and the address counter
+#define LCD_BUSY    0x80
+#define LCD_ADDRESS 0x7F
+
+// How long (in microseconds) E is held high for, and how long the LCD takes to act
+// on a character, on moving the cursor, and on clearing the screen. These are the
+// datasheet's worst cases, with some to spare.
+#define LCD_PULSE_US 2
+#define LCD_WRITE_US 45
+#define LCD_MOVE_US  100
+#define LCD_CLEAR_US 1640
+
+// How long to leave between reading the busy flag, in microseconds
+#define LCD_CHECK_US 4
+
+#if LCD_BIG_DIGITS
+// Big digits are two rows high and LCD_BIG_WIDTH columns wide, drawn with the
+// custom characters below (and the LCD's own full block and space). The custom
+// characters are sent as 8-15 rather than 0-7 (the LCD takes them as the same),
+// so that none of them is a string's terminating 0.
+#define LCD_GLYPH_LT    8  // Top left corner
+#define LCD_GLYPH_UB    9  // Upper bar
+#define LCD_GLYPH_RT    10 // Top right corner
+#define LCD_GLYPH_LL    11 // Lower left corner
+#define LCD_GLYPH_LB    12 // Lower bar
+#define LCD_GLYPH_LR    13 // Lower right corner
+#define LCD_GLYPH_UMB   14 // Upper bar with a middle bar below
+#define LCD_GLYPH_LMB   15 // Lower bar with a middle bar above
+#define LCD_GLYPH_FULL  ((char) 0xFF)
+#define LCD_GLYPH_BLANK ' '
+
+// The custom characters' rows of pixels, loaded into the LCD's character generator
+// RAM once, by lcd_init()
+static const uint8_t lcd_glyphs[8][8] = {
+	{ 0x07, 0x0F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F }, // LT
+	{ 0x1F, 0x1F, 0x1F, 0x00, 0x00, 0x00, 0x00, 0x00 }, // UB
+	{ 0x1C, 0x1E, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F }, // RT
+	{ 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x0F, 0x07 }, // LL
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x1F, 0x1F }, // LB
+	{ 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1E, 0x1C }, // LR
+	{ 0x1F, 0x1F, 0x1F, 0x00, 0x00, 0x00, 0x1F, 0x1F }, // UMB
+	{ 0x1F, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x1F, 0x1F }  // LMB
+};
+
+// Each digit's cells: the top row, then the bottom
+static const char lcd_big_digits[10][2][LCD_BIG_WIDTH] = {
+	{ { LCD_GLYPH_LT,    LCD_GLYPH_UB,    LCD_GLYPH_RT    }, { LCD_GLYPH_LL,    LCD_GLYPH_LB,    LCD_GLYPH_LR    } },
+	{ { LCD_GLYPH_UB,    LCD_GLYPH_RT,    LCD_GLYPH_BLANK }, { LCD_GLYPH_LB,    LCD_GLYPH_FULL,  LCD_GLYPH_LB    } },
+	{ { LCD_GLYPH_UMB,   LCD_GLYPH_UMB,   LCD_GLYPH_RT    }, { LCD_GLYPH_LL,    LCD_GLYPH_LB,    LCD_GLYPH_LB    } },
+	{ { LCD_GLYPH_UMB,   LCD_GLYPH_UMB,   LCD_GLYPH_RT    }, { LCD_GLYPH_LB,    LCD_GLYPH_LB,    LCD_GLYPH_LR    } },
+	{ { LCD_GLYPH_LL,    LCD_GLYPH_LB,    LCD_GLYPH_FULL  }, { LCD_GLYPH_BLANK, LCD_GLYPH_BLANK, LCD_GLYPH_FULL  } },
+	{ { LCD_GLYPH_LL,    LCD_GLYPH_UMB,   LCD_GLYPH_UMB   }, { LCD_GLYPH_LMB,   LCD_GLYPH_LB,    LCD_GLYPH_LR    } },
+	{ { LCD_GLYPH_LT,    LCD_GLYPH_UMB,   LCD_GLYPH_UMB   }, { LCD_GLYPH_LL,    LCD_GLYPH_LB,    LCD_GLYPH_LR    } },
+	{ { LCD_GLYPH_UB,    LCD_GLYPH_UB,    LCD_GLYPH_RT    }, { LCD_GLYPH_BLANK, LCD_GLYPH_BLANK, LCD_GLYPH_FULL  } },
+	{ { LCD_GLYPH_LT,    LCD_GLYPH_UMB,   LCD_GLYPH_RT    }, { LCD_GLYPH_LL,    LCD_GLYPH_LB,    LCD_GLYPH_LR    } },
+	{ { LCD_GLYPH_LT,    LCD_GLYPH_UMB,   LCD_GLYPH_RT    }, { LCD_GLYPH_BLANK, LCD_GLYPH_BLANK, LCD_GLYPH_FULL  } }
+};
+#endif
+
+// Most unchanged cells that are sent again to get to a changed one along the row,
+// rather than moving the cursor past them (which takes longer than a couple)
+#define LCD_RESEND_CELLS 2
+
+// What the screen should show, and what it's known to show. Where they differ, the
+// cell still has to be sent.
+static volatile char lcd_wanted[LCD_ROWS][LCD_COLUMNS];
+static char          lcd_shown[LCD_ROWS][LCD_COLUMNS];
+
+// Where lcd_print() writes to next
+static uint8_t lcd_row    = 0;
+static uint8_t lcd_column = 0;
+
+// Where the LCD will put the next character it's sent (its address counter), if
+// that's one of the cells on the screen, and whether the byte being sent (while E
+// is high) is a character rather than a move
+static bool    lcd_cursor_known = false;
+static uint8_t lcd_cursor_row, lcd_cursor_column;
+static bool    lcd_sending_char = false;
+
+// Whether the background sending is going (i.e. its timer is armed, or it's running),
+// and what it's doing
+static wheel_timer_t lcd_timer;
+static volatile bool lcd_running = false;
+static enum {
+	LCD_READY,   // Nothing on the bus, and the LCD is ready for the next byte
+	LCD_WRITING, // A byte is on the bus with E high
+	LCD_WAITING, // The LCD is acting on the byte
+	LCD_READING  // The busy flag is being read, with E high
+} lcd_state = LCD_READY;
+
+// Whether the busy flag can be read back, and the latest the LCD will be done with
+// the byte it's acting on
+static bool     lcd_readback = false;
+static uint64_t lcd_done_us  = 0;
+
+/*
+ * Puts a byte on the data lines, to a register (RS high for data, low for a
+ * command). Only the LCD's pins are touched: the set/reset register leaves the beat
+ * LEDs on the rest of GPIOD alone.
+ */
+static void lcd_bus(bool rs, uint8_t data) {
+	if (rs) {
+		GPIOB->BSRRL = LCD_RS;
+	} else {
+		GPIOB->BSRRH = LCD_RS;
+	}
+	GPIOD->BSRRH = 0xFF;
+	GPIOD->BSRRL = data;
+}
+
+/*
+ * Turns the data lines round so the LCD can drive them, and starts reading its
+ * busy flag and address. They're pulled down while they're inputs, so if the LCD
+ * doesn't drive them they read 0 rather than floating (and if it doesn't see RW, it
+ * takes a 0 byte as a command, which does nothing).
+ */
+static void lcd_read_start(void) {
+	GPIOD->MODER &= ~0xFFFFUL;
+	GPIOD->PUPDR  = (GPIOD->PUPDR & ~0xFFFFUL) | 0xAAAA;
+	GPIOB->BSRRH  = LCD_RS;
+	GPIOB->BSRRL  = LCD_RW;
+	GPIOB->BSRRL  = LCD_E;
+}
+
+/*
+ * Takes what the LCD is driving onto the data lines, and turns them back round
+ */
+static uint8_t lcd_read_end(void) {
+	uint8_t status = (uint8_t) GPIOD->IDR;
+
+	GPIOB->BSRRH  = LCD_E;
+	GPIOB->BSRRH  = LCD_RW;
+	GPIOD->PUPDR &= ~0xFFFFUL;
+	GPIOD->MODER |= 0x5555;
+
+	return status;
+}
+
+/*
+ * Reads the busy flag and address back straight away. Only for setting it up.
+ */
+static uint8_t lcd_read_now(void) {
+	lcd_read_start();
+	delay_us(1);
+	return lcd_read_end();
+}
+
+/*
+ * Sends a byte and waits for the LCD to act on it: until the busy flag clears, if
+ * it can be read, or for the time given. Only for setting it up, before the
+ * background sending is going.
+ */
+static void lcd_send_now(bool rs, uint8_t data, uint16_t wait_us) {
+	uint16_t waited;
+
+	lcd_bus(rs, data);
+	GPIOB->BSRRL = LCD_E;
+	delay_us(1);
+	GPIOB->BSRRH = LCD_E;
+
+	if (!lcd_readback) {
+		delay_us(wait_us);
+		return;
+	}
+	for (waited = 0; waited < wait_us && (lcd_read_now() & LCD_BUSY); waited += LCD_CHECK_US) {
+		delay_us(LCD_CHECK_US);
+	}
+}
+
+#if LCD_BUSY_FLAG
+/*
+ * Whether the busy flag and address can be read back: moves the address to a couple
+ * of places and checks it can be seen there
+ */
+static bool lcd_readback_works(void) {
+	static const uint8_t addresses[] = { 0x05, 0x4A };
+	uint8_t i;
+
+	for (i = 0; i < sizeof(addresses); i++) {
+		lcd_send_now(false, LCD_SET_ADDRESS | addresses[i], LCD_MOVE_US);
+		if (lcd_read_now() != addresses[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+#endif
+
+static void lcd_step(void);
+
+/*
+ * Takes the next step at a given time, or straight away if that's gone
+ */
+static void lcd_step_at(uint64_t at_us) {
+	wheel_arm(&lcd_timer, at_us, lcd_step);
+}
+
+/*
+ * Finds the first cell that needs sending. Returns false if there isn't one.
+ */
+static bool lcd_changed_cell(uint8_t *row, uint8_t *column) {
+	for (*row = 0; *row < LCD_ROWS; (*row)++) {
+		for (*column = 0; *column < LCD_COLUMNS; (*column)++) {
+			if (lcd_wanted[*row][*column] != lcd_shown[*row][*column]) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/*
+ * Takes the next step in bringing the screen up to date: ends the byte being sent,
+ * checks whether the LCD is done with it, or starts sending the next one. Called back
+ * from the TIM2 interrupt by the LCD's timer.
+ */
+static void lcd_step(void) {
+	uint64_t now_us = timebase_now();
+	uint8_t  row, column;
+
+	switch (lcd_state) {
+		case LCD_WRITING:
+			// The byte's on the data lines, so let the LCD take it and give it time
+			// to act. If the busy flag can be read it's looked at in a moment,
+			// otherwise there's nothing for it but to wait the longest it could take.
+			GPIOB->BSRRH = LCD_E;
+			lcd_done_us  = now_us + (lcd_sending_char ? LCD_WRITE_US : LCD_MOVE_US);
+			lcd_state    = lcd_readback ? LCD_WAITING : LCD_READY;
+			lcd_step_at(lcd_readback ? now_us + LCD_CHECK_US : lcd_done_us);
+			return;
+
+		case LCD_WAITING:
+			lcd_read_start();
+			lcd_state = LCD_READING;
+			lcd_step_at(now_us + LCD_PULSE_US);
+			return;
+
+		case LCD_READING:
+			// Still busy, so look again in a moment, unless it's had as long as it
+			// could need (in which case the flag can't be right, so go on anyway)
+			if ((lcd_read_end() & LCD_BUSY) && now_us < lcd_done_us) {
+				lcd_state = LCD_WAITING;
+				lcd_step_at(now_us + LCD_CHECK_US);
+				return;
+			}
+			lcd_state = LCD_READY;
+			break;
+
+		case LCD_READY:
+			break;
+	}
+
+	if (!lcd_changed_cell(&row, &column)) {
+		// Nothing left to send, so leave the timer off
+		lcd_running = false;
+		return;
+	}
+
+	// A cell just along from the cursor is quicker to get to by sending the ones in
+	// between again
+	if (lcd_cursor_known && lcd_cursor_row == row && lcd_cursor_column <= column &&
+	    column - lcd_cursor_column <= LCD_RESEND_CELLS) {
+		column = lcd_cursor_column;
+	}
+
+	if (!lcd_cursor_known || lcd_cursor_row != row || lcd_cursor_column != column) {
+		// The second row starts at 0x40
+		lcd_bus(false, LCD_SET_ADDRESS | (row ? 0x40 : 0x00) | column);
+		lcd_cursor_known  = true;
+		lcd_cursor_row    = row;
+		lcd_cursor_column = column;
+		lcd_sending_char  = false;
+	} else {
+		char c = lcd_wanted[row][column];
+
+		lcd_bus(true, (uint8_t) c);
+		lcd_shown[row][column] = c;
+		lcd_sending_char = true;
+
+		// Past the end of the row the address counter isn't on the screen any more
+		if (++lcd_cursor_column == LCD_COLUMNS) {
+			lcd_cursor_known = false;
+		}
+	}
+
+	GPIOB->BSRRL = LCD_E;
+	lcd_state    = LCD_WRITING;
+	lcd_step_at(now_us + LCD_PULSE_US);
+}
+
+/*
+ * Starts the background sending, if it isn't already going. If it is, it'll find
+ * whatever has just been written before it stops.
+ */
+static void lcd_start(void) {
+	if (!lcd_running) {
+		// The wheel is shared with the interrupts
+		__disable_irq();
+		lcd_running = true;
+		lcd_step_at(timebase_now());
+		__enable_irq();
+	}
+}
+
+/*
+ * Sets up the LCD, then clears it. This waits for the LCD to be ready, so is only for
+ * when the program starts. The wheel must be going first (see delay.c).
+ */
 void lcd_init(void) {
-	_w(0x3830)|=11;
-	_w(0)&=~0xC0000000UL;_w(0)|=4<<28;_w(4)&=0x7FFF;
-	_w(0x400)&=~0x3F;_w(0x400)|=0x15;_w(0x404)&=~7;
-	_w(0xC00)&=~0xFFFF;_w(0xC00)|=0x5555;_w(0xC04)&=~0xFF;
-	_h(0x18)=8<<12;_h(0x41A)=7;delay_ms(50);
-	_c(56,4100);_e(100);_e(100);_c(12,45);_c(1,1640);_c(6,45);_c(1,1640);
+	uint8_t row, column;
+
+	// Ports A, B and D. PA15 is held high too, as the LCD board expects.
+	RCC->AHB1ENR |= RCC_AHB1ENR_GPIOAEN | RCC_AHB1ENR_GPIOBEN | RCC_AHB1ENR_GPIODEN;
+	GPIOA->MODER  = (GPIOA->MODER & ~0xC0000000UL) | 0x40000000UL;
+	GPIOA->OTYPER &= 0x7FFF;
+	GPIOB->MODER  = (GPIOB->MODER & ~0x3FUL) | 0x15;   // PB0-PB2 outputs
+	GPIOB->OTYPER &= ~0x7UL;
+	GPIOD->MODER  = (GPIOD->MODER & ~0xFFFFUL) | 0x5555; // PD0-PD7 outputs
+	GPIOD->OTYPER &= ~0xFFUL;
+	GPIOA->BSRRL  = 1 << 15;
+	GPIOB->BSRRH  = LCD_RS | LCD_RW | LCD_E;
+	delay_ms(50);
+
+	// The function set is sent three times over, as the datasheet asks after power-up.
+	// The busy flag can't be read until it's done.
+	lcd_send_now(false, LCD_FUNCTION_8BIT_2LINE, 4100);
+	lcd_send_now(false, LCD_FUNCTION_8BIT_2LINE, 100);
+	lcd_send_now(false, LCD_FUNCTION_8BIT_2LINE, 100);
+#if LCD_BUSY_FLAG
+	lcd_readback = lcd_readback_works();
+#endif
+	lcd_send_now(false, LCD_DISPLAY_ON, LCD_WRITE_US);
+	lcd_send_now(false, LCD_ENTRY_INCREMENT, LCD_WRITE_US);
+#if LCD_BIG_DIGITS
+	lcd_send_now(false, LCD_SET_CGRAM_ADDRESS, LCD_MOVE_US);
+	for (row = 0; row < sizeof(lcd_glyphs); row++) {
+		lcd_send_now(true, lcd_glyphs[row / 8][row % 8], LCD_WRITE_US);
+	}
+#endif
+	// Clearing also puts the address back in the display RAM
+	lcd_send_now(false, LCD_CLEAR, LCD_CLEAR_US);
+	lcd_cursor_known  = true;
+	lcd_cursor_row    = 0;
+	lcd_cursor_column = 0;
+
+	for (row = 0; row < LCD_ROWS; row++) {
+		for (column = 0; column < LCD_COLUMNS; column++) {
+			lcd_wanted[row][column] = ' ';
+			lcd_shown[row][column]  = ' ';
+		}
+	}
+}
+
+/*
+ * Writes text from the cursor (see lcd_move()). Anything past the end of the row is
+ * left off. Returns straight away: the LCD is brought up to date in the background.
+ */
+void lcd_print(const char *text) {
+	while (*text && lcd_column < LCD_COLUMNS) {
+		lcd_wanted[lcd_row][lcd_column++] = *text++;
+	}
+
+	lcd_start();
 }
 
-void lcd_print(const char *t) {
-	const char*p=t;_h(0x0418)=1;while(*p)_c(*(p++),45);
+#if LCD_BIG_DIGITS
+/*
+ * Writes a number in big digits across both rows, from the given column: the given
+ * number of digits, right-aligned with blanks in place of leading zeros, each
+ * LCD_BIG_WIDTH columns wide and LCD_BIG_GAP apart. Only the cells whose glyphs
+ * have changed are sent, so a tempo going up by one typically costs a few bytes.
+ */
+void lcd_print_big(uint8_t column, uint16_t number, uint8_t digits) {
+	uint8_t digit, row, i;
+
+	for (digit = digits; digit-- > 0; number /= 10) {
+		uint8_t left = column + digit * (LCD_BIG_WIDTH + LCD_BIG_GAP);
+		bool    blank = number == 0 && digit != digits - 1;
+
+		for (row = 0; row < LCD_ROWS; row++) {
+			for (i = 0; i < LCD_BIG_WIDTH && left + i < LCD_COLUMNS; i++) {
+				lcd_wanted[row][left + i] = blank ? ' ' : lcd_big_digits[number % 10][row][i];
+			}
+			for (i = LCD_BIG_WIDTH; i < LCD_BIG_WIDTH + LCD_BIG_GAP && digit != digits - 1 &&
+			     left + i < LCD_COLUMNS; i++) {
+				lcd_wanted[row][left + i] = ' ';
+			}
+		}
+	}
+
+	lcd_start();
 }
+#endif
 
-void lcd_move(uint8_t c, uint8_t r) {
-	_h(0x041A)=1;_c(r<<5|r<<3|c|0x80,100);
+/*
+ * Moves the cursor (where lcd_print() writes to next)
+ */
+void lcd_move(uint8_t column, uint8_t row) {
+	lcd_row    = row < LCD_ROWS ? row : LCD_ROWS - 1;
+	lcd_column = column;
 }
@@ -3,8 +3,27 @@
 
 #include <stdint.h>
 
+// Set to 0 to always wait the datasheet's worst-case time for the LCD to take each
+// byte, rather than reading its busy flag back to see when it's done (see lcd.c)
+#ifndef LCD_BUSY_FLAG
+#define LCD_BUSY_FLAG 1
+#endif
+
+// Set to 0 to leave out the big digits (see lcd_print_big()), and the custom
+// characters they're drawn with
+#ifndef LCD_BIG_DIGITS
+#define LCD_BIG_DIGITS 1
+#endif
+
+// Columns a big digit takes, and the gap between digits
+#define LCD_BIG_WIDTH 3
+#define LCD_BIG_GAP   1
+
 void lcd_init(void);
 void lcd_print(const char *text);
 void lcd_move(uint8_t column, uint8_t row);
+#if LCD_BIG_DIGITS
+void lcd_print_big(uint8_t column, uint16_t number, uint8_t digits);
+#endif
 
 #endif /*_LCD_H_*/
@@ -0,0 +1,289 @@
+#include <stddef.h>
+#include <stm32f4xx_rcc.h>
+#include <stm32f4xx_gpio.h>
+#include <stm32f4xx_tim.h>
+#include <stm32f4xx_dma.h>
+#include <misc.h>
+#include <stm32f4xx.h>
+#include "leds.h"
+
+// The beat LEDs are a pattern of 8 bits on PD8-PD15. Rather than the processor
+// writing each pattern as it's due, the edges (each beat's pattern coming on, and
+// the LEDs going off half-way through the beat) are laid out ahead of time in a
+// ring, as the time each is due and a word for the GPIOD set/reset register, and the
+// timers and DMA play them from there by themselves. This way the edges land on the
+// timer tick, and the processor never touches the port (so can't upset the LCD lines
+// on PD0-PD7 either).
+//
+// TIM2 (the time base) compares each edge's time on channel 1, and the match does
+// two things. Its DMA request has one stream copy the next edge's time into the
+// compare, ready for that one. And TIM2's TRGO pulses, which is TIM8's trigger input
+// (ITR1): TIM8 is only there to turn each pulse into a DMA request of its own, which
+// has a second stream copy the edge's word to the port. The two streams go round the
+// ring in step, an item each per edge, and are circular, so they carry on round it
+// for as long as they're left.
+//
+// The word stream interrupts half-way round and again at the end, and the half it has
+// just finished is filled with the edges that come after the other half (by the
+// callback given to leds_init()). That's all the processor does for the LEDs, and as
+// a half holds the longest bar, it's at most once a bar.
+//
+// Anything that changes the edges once they're in the ring (the tempo, the time
+// signature, a sync) puts new ones in over those that are still to come, while the
+// ring carries on playing. Only edges far enough off not to be played while they're
+// being changed can be, and if the compare is already waiting for the first of them,
+// leds_changed() points it at the new time.
+//
+// It has to be TIM8 and DMA2 for the port: DMA1 (which TIM2-TIM5 request on) can't
+// reach the GPIO ports. TIM2's channel 1 request is DMA1 stream 5, channel 3, and
+// TIM8's trigger request is DMA2 stream 7, channel 7.
+#define LEDS_TIME_STREAM  DMA1_Stream5
+#define LEDS_TIME_CHANNEL DMA_Channel_3
+#define LEDS_TIME_FLAGS   (DMA_FLAG_FEIF5 | DMA_FLAG_DMEIF5 | DMA_FLAG_TEIF5 | \
+                           DMA_FLAG_HTIF5 | DMA_FLAG_TCIF5)
+#define LEDS_WORD_STREAM  DMA2_Stream7
+#define LEDS_WORD_CHANNEL DMA_Channel_7
+#define LEDS_WORD_FLAGS   (DMA_FLAG_FEIF7 | DMA_FLAG_DMEIF7 | DMA_FLAG_TEIF7 | \
+                           DMA_FLAG_HTIF7 | DMA_FLAG_TCIF7)
+
+// The ring: each edge's word and time (the bottom 32 bits, which is all the compare
+// looks at). Each edge's match loads the time of the one after it, so the time stream
+// goes round its own copy of the times, moved along by one.
+static uint32_t leds_words[LEDS_RING];
+static uint32_t leds_times[LEDS_RING];
+static uint32_t leds_next_times[LEDS_RING];
+
+// Whether the ring is playing, and what fills it again as it goes round
+static bool     leds_playing = false;
+static void   (*leds_refill)(void) = NULL;
+
+/*
+ * Gives the set/reset register word that shows a pattern on the LEDs: the top half
+ * resets the LEDs that are off and the bottom half sets the ones that are on.
+ */
+uint32_t leds_bsrr(uint8_t pattern) {
+	return ((uint32_t) (uint8_t) ~pattern << 24) | ((uint32_t) pattern << 8);
+}
+
+/*
+ * Puts an edge in the ring: the set/reset word to write to the port, and the time on
+ * the time base to write it. The edges are played in the order they're in the ring,
+ * so each has to be at least a microsecond after the one before it.
+ *
+ * While the ring is playing, only the half the stream has just finished can be
+ * filled (see leds_init()), or edges that are still to come changed (see
+ * leds_changed()).
+ */
+void leds_set(size_t edge, uint64_t at_us, uint32_t word) {
+	leds_words[edge] = word;
+	leds_times[edge] = (uint32_t) at_us;
+	leds_next_times[(edge + LEDS_RING - 1) % LEDS_RING] = (uint32_t) at_us;
+}
+
+/*
+ * Starts playing the ring from its first edge. The whole ring has to have been filled
+ * (see leds_set()). If the first edge is already due, it's played straight away.
+ * Once it's started it plays for good.
+ */
+void leds_start(void) {
+	DMA_ClearFlag(LEDS_TIME_STREAM, LEDS_TIME_FLAGS);
+	DMA_ClearFlag(LEDS_WORD_STREAM, LEDS_WORD_FLAGS);
+	DMA_SetCurrDataCounter(LEDS_TIME_STREAM, LEDS_RING);
+	DMA_SetCurrDataCounter(LEDS_WORD_STREAM, LEDS_RING);
+	DMA_Cmd(LEDS_TIME_STREAM, ENABLE);
+	DMA_Cmd(LEDS_WORD_STREAM, ENABLE);
+
+	// The compare was left where it won't match (see leds_init()) until both requests
+	// are on, so the streams can't start out of step
+	TIM_DMACmd(TIM2, TIM_DMA_CC1, ENABLE);
+	TIM_DMACmd(TIM8, TIM_DMA_Trigger, ENABLE);
+	TIM_SetCompare1(TIM2, leds_times[0]);
+	leds_playing = true;
+
+	leds_catch_up();
+}
+
+/*
+ * Gives the edge in the ring that's to be played next. While the ring is playing,
+ * that can move on at any moment.
+ */
+size_t leds_next(void) {
+	// What's reached the port is what the word stream has written
+	return (LEDS_RING - DMA_GetCurrDataCounter(LEDS_WORD_STREAM)) % LEDS_RING;
+}
+
+/*
+ * An edge that's still to come, and far enough off that it can't be played
+ * meanwhile, has been changed (see leds_set()), along with any after it. The time
+ * stream loads each edge's time as the one before is played, so if that's already
+ * happened for this one, the compare is pointed at its new time here instead.
+ */
+void leds_changed(size_t edge) {
+	// Each edge's time is loaded as the one before it is played, so this is the edge
+	// whose time the compare has
+	size_t loaded = (LEDS_RING - DMA_GetCurrDataCounter(LEDS_TIME_STREAM)) % LEDS_RING;
+
+	if (leds_playing && loaded == edge) {
+		TIM_SetCompare1(TIM2, leds_times[edge]);
+		leds_catch_up();
+	}
+}
+
+/*
+ * Makes sure the compare is waiting for an edge that's still to come. One whose time
+ * went by before the compare was pointed at it won't match until the counter has
+ * come all the way round (71 minutes), so the compare is moved on to the tick after
+ * next to play it as soon as it can. Then the edge after it, which the compare moves
+ * on to, is looked at the same way.
+ *
+ * Only needs calling when the time base might have got past an edge without the
+ * compare seeing it: when the ring starts, when the edge it's waiting for is moved
+ * (see leds_changed()), and when the time base is put forward.
+ */
+void leds_catch_up(void) {
+	uint32_t due, now;
+	uint16_t left;
+
+	while (leds_playing) {
+		due = TIM2->CCR1;
+		now = TIM2->CNT;
+		if ((int32_t) (due - now) > 0) {
+			return;
+		}
+
+		// Due on this very tick, so it may be matching right now: look again on the next
+		if (due == now) {
+			continue;
+		}
+
+		left = DMA_GetCurrDataCounter(LEDS_WORD_STREAM);
+		TIM_SetCompare1(TIM2, now + 2);
+		while (DMA_GetCurrDataCounter(LEDS_WORD_STREAM) == left);
+	}
+}
+
+/*
+ * Time (the bottom 32 bits of it) of the edge that was last written to the port. For
+ * the edge interrupt: the stream takes a few cycles to write the word, and getting
+ * into the interrupt a dozen or more, so the word's been written by the time it runs,
+ * and the next won't be for a half-beat (30ms at the least).
+ */
+uint32_t leds_written_us(void) {
+	return leds_times[(leds_next() + LEDS_RING - 1) % LEDS_RING];
+}
+
+/*
+ * Has TIM8 raise its trigger interrupt (LEDS_EDGE_IRQn) each time an edge is written.
+ * The interrupt itself is left to whatever wants it to set up.
+ */
+void leds_edge_irq_enable(void) {
+	TIM_ClearITPendingBit(TIM8, TIM_IT_Trigger);
+	TIM_ITConfig(TIM8, TIM_IT_Trigger, ENABLE);
+}
+
+/*
+ * Acknowledges TIM8's trigger interrupt
+ */
+void leds_edge_irq_clear(void) {
+	TIM_ClearITPendingBit(TIM8, TIM_IT_Trigger);
+}
+
+/*
+ * Shows a pattern on the LEDs straight away, without touching the ring
+ */
+void leds_write(uint8_t pattern) {
+	GPIO_ResetBits(GPIOD, (uint16_t) (uint8_t) ~pattern << 8);
+	GPIO_SetBits(GPIOD, (uint16_t) pattern << 8);
+}
+
+/*
+ * The word stream is half-way round the ring or back at the start of it, so the half
+ * it has just finished is filled with the edges that come after the other half
+ */
+void DMA2_Stream7_IRQHandler(void) {
+	if (DMA_GetITStatus(LEDS_WORD_STREAM, DMA_IT_HTIF7) != RESET) {
+		DMA_ClearITPendingBit(LEDS_WORD_STREAM, DMA_IT_HTIF7);
+		leds_refill();
+	}
+	if (DMA_GetITStatus(LEDS_WORD_STREAM, DMA_IT_TCIF7) != RESET) {
+		DMA_ClearITPendingBit(LEDS_WORD_STREAM, DMA_IT_TCIF7);
+		leds_refill();
+	}
+}
+
+/*
+ * Sets up the LEDs, and the timers and DMA that play them. The callback is given
+ * each time half the ring has been played, to fill it with the next LEDS_HALF edges
+ * (the first one it fills is half-way round the ring from where the last one finished).
+ * The time base has to be set up first, as the edges are compares on it.
+ */
+void leds_init(void (*refill)(void)) {
+	leds_refill = refill;
+
+	// LEDs use GPIO-D and are Outputs
+	RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
+	GPIO_InitTypeDef init_data;
+	init_data.GPIO_Pin   = GPIO_Pin_8  | GPIO_Pin_9  | GPIO_Pin_10 | 
+	                       GPIO_Pin_11 | GPIO_Pin_12 | GPIO_Pin_13 | 
+	                       GPIO_Pin_14 | GPIO_Pin_15;
+	init_data.GPIO_Mode  = GPIO_Mode_OUT;
+	init_data.GPIO_Speed = GPIO_Speed_50MHz;
+	init_data.GPIO_OType = GPIO_OType_PP;
+	init_data.GPIO_PuPd  = GPIO_PuPd_NOPULL;
+	GPIO_Init(GPIOD, &init_data);
+	leds_write(0x00);
+
+	// TIM2's channel 1 doesn't drive a pin: its matches only make the time stream's
+	// DMA requests and pulse TRGO. New compare values take effect straight away.
+	TIM_OCInitTypeDef oc_init_data;
+	TIM_OCStructInit(&oc_init_data);
+	oc_init_data.TIM_OCMode = TIM_OCMode_Timing;
+	TIM_OC1Init(TIM2, &oc_init_data);
+	TIM_OC1PreloadConfig(TIM2, TIM_OCPreload_Disable);
+	TIM_SetCompare1(TIM2, TIM2->CNT - 1);
+	TIM_SelectOutputTrigger(TIM2, TIM_TRGOSource_OC1);
+
+	// Trigger mode starts TIM8 counting on the first pulse as well, and it's left
+	// to, as slowly as it can as nothing looks at its count (TIM2 is ITR1 for TIM8)
+	RCC_APB2PeriphClockCmd(RCC_APB2Periph_TIM8, ENABLE);
+	TIM_PrescalerConfig(TIM8, 0xFFFF, TIM_PSCReloadMode_Immediate);
+	TIM_ClearFlag(TIM8, TIM_FLAG_Update);
+	TIM_SelectInputTrigger(TIM8, TIM_TS_ITR1);
+	TIM_SelectSlaveMode(TIM8, TIM_SlaveMode_Trigger);
+
+	// Each time goes to the whole 32-bit compare register, and each word to the whole
+	// 32-bit set/reset register, round and round the ring
+	RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1, ENABLE);
+	RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA2, ENABLE);
+	DMA_InitTypeDef dma_init_data;
+	DMA_StructInit(&dma_init_data);
+	dma_init_data.DMA_Channel            = LEDS_TIME_CHANNEL;
+	dma_init_data.DMA_PeripheralBaseAddr = (uint32_t) &TIM2->CCR1;
+	dma_init_data.DMA_Memory0BaseAddr    = (uint32_t) leds_next_times;
+	dma_init_data.DMA_DIR                = DMA_DIR_MemoryToPeripheral;
+	dma_init_data.DMA_BufferSize         = LEDS_RING;
+	dma_init_data.DMA_PeripheralInc      = DMA_PeripheralInc_Disable;
+	dma_init_data.DMA_MemoryInc          = DMA_MemoryInc_Enable;
+	dma_init_data.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+	dma_init_data.DMA_MemoryDataSize     = DMA_MemoryDataSize_Word;
+	dma_init_data.DMA_Mode               = DMA_Mode_Circular;
+	dma_init_data.DMA_Priority           = DMA_Priority_High;
+	dma_init_data.DMA_FIFOMode           = DMA_FIFOMode_Disable;
+	DMA_Init(LEDS_TIME_STREAM, &dma_init_data);
+
+	dma_init_data.DMA_Channel            = LEDS_WORD_CHANNEL;
+	dma_init_data.DMA_PeripheralBaseAddr = (uint32_t) &GPIOD->BSRRL;
+	dma_init_data.DMA_Memory0BaseAddr    = (uint32_t) leds_words;
+	dma_init_data.DMA_Priority           = DMA_Priority_VeryHigh;
+	DMA_Init(LEDS_WORD_STREAM, &dma_init_data);
+	DMA_ITConfig(LEDS_WORD_STREAM, DMA_IT_HT | DMA_IT_TC, ENABLE);
+
+	// Same priority as TIM2, whose interrupt plays the clicks that go with the edges
+	// (see main.c)
+	NVIC_InitTypeDef nvic_init_data;
+	nvic_init_data.NVIC_IRQChannel    = DMA2_Stream7_IRQn;
+	nvic_init_data.NVIC_IRQChannelCmd = ENABLE;
+	nvic_init_data.NVIC_IRQChannelPreemptionPriority = 1;
+	nvic_init_data.NVIC_IRQChannelSubPriority = 1;
+	NVIC_Init(&nvic_init_data);
+}
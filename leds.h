@@ -0,0 +1,31 @@
+#ifndef _LEDS_H_
+#define _LEDS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The LEDs play their edges from a ring that's filled ahead of time, half of it at
+// once (see leds.c). Half the ring holds the longest bar, 9 beats with an edge for
+// each beat and each half-beat.
+#define LEDS_HALF 18
+#define LEDS_RING (2 * LEDS_HALF)
+
+// TIM8's trigger interrupt, raised as each edge is written once
+// leds_edge_irq_enable() has been called, and its handler
+#define LEDS_EDGE_IRQn       TIM8_TRG_COM_TIM14_IRQn
+#define LEDS_EDGE_IRQHandler TIM8_TRG_COM_TIM14_IRQHandler
+
+void     leds_init(void (*refill)(void));
+uint32_t leds_bsrr(uint8_t pattern);
+void     leds_set(size_t edge, uint64_t at_us, uint32_t word);
+void     leds_start(void);
+size_t   leds_next(void);
+void     leds_changed(size_t edge);
+void     leds_catch_up(void);
+uint32_t leds_written_us(void);
+void     leds_edge_irq_enable(void);
+void     leds_edge_irq_clear(void);
+void     leds_write(uint8_t pattern);
+
+#endif /*_LEDS_H_*/
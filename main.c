@@ -1,35 +1,87 @@
-#include <stdio.h>
 #include <stdlib.h>
-#include <inttypes.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stm32f4xx_rcc.h>
 #include <stm32f4xx_gpio.h>
+#include <stm32f4xx_exti.h>
+#include <stm32f4xx_syscfg.h>
 #include <stm32f4xx.h>
 #include "delay.h"
 #include "lcd.h"
-
-// Max number of samples to take the tap-tempo average over
-#define MAX_TAP_TEMPO_SAMPLES 6
-
-// Number of milliseconds before a tap is counted as a new sequence rather
-// than part of the previous sequence. 1500 means a lower limit of 40BPM
-// which seems reasonable. If the user wants to go lower, they can still manually
-// lower the BPM with the up/down buttons
-#define TAP_TEMPO_FORGET_THRESHOLD 1500
+#include "beat.h"
+#include "leds.h"
+#include "timebase.h"
+#include "jitter.h"
+#include "tap.h"
+#include "events.h"
+#include "debounce.h"
+#include "wheel.h"
+#include "power.h"
+#include "clock.h"
+#include "audio.h"
+
+// How often the buttons are sampled while any of them is down or settling, in
+// microseconds. The rest of the time they aren't sampled at all: the first edge on
+// any of them raises an interrupt (see buttons_wake()).
+#define BUTTON_POLL_US 5000
+
+// How long a button has to read the same before it counts as having been pressed
+// or released, so switch bounce isn't taken for more presses (see debounce.c), and
+// how long it has to be held down for a long press. Both in microseconds, and
+// whole numbers of samples.
+#define BUTTON_DEBOUNCE_US   10000
+#define BUTTON_LONG_PRESS_US 600000
+#define BUTTON_DEBOUNCE_SAMPLES (BUTTON_DEBOUNCE_US / BUTTON_POLL_US + 1)
+
+// The buttons' edge interrupt lines (the same numbers as their GPIOE pins)
+#define BUTTON_EXTI_LINES 0xFF00
+
+// How far ahead of each LED edge its click is put in the audio buffer, in
+// microseconds. It has to be longer than the buffer is (see audio.c), less than half
+// the shortest beat (30ms at 999BPM) so the clicks go in in order, and comfortably
+// longer than any time interrupts might be held off for. An edge that's closer than
+// this when anything changes is left as it was, as its click may already be in.
+#define CLICK_LEAD_US 2000
 
 // Masks for which button is pressed (GPIOE pins)
 #define MASK_TAP_TEMPO    (1 << 0)
 #define MASK_BPM_UP       (1 << 1)
 #define MASK_BPM_DOWN     (1 << 2)
 #define MASK_SYNCHRONISE  (1 << 3)
+#define MASK_DUMP         (1 << 4) // Only with the jitter recorder, STOP mode or the audio profile built in
+#define MASK_SOUND        (1 << 5)
 #define MASK_TIMESIG_UP   (1 << 6)
 #define MASK_TIMESIG_DOWN (1 << 7)
 
+// The status line on the LCD's second row: the tempo, right-aligned in 3 columns,
+// then "bpm", then the time signature right-aligned in the rest
+#define STATUS_LENGTH      16
+#define STATUS_TEMPO_WIDTH 3
+
+// With big digits the tempo takes up both rows on the left instead, and the rest of
+// the status line is "bpm" above the time signature, from this column on
+#define STATUS_BIG_COLUMN  (STATUS_TEMPO_WIDTH * (LCD_BIG_WIDTH + LCD_BIG_GAP) - LCD_BIG_GAP)
+
+// Two digits of each number 0-99, so the tempo can be written out two digits at a
+// time rather than dividing by ten for each
+static const char digit_pairs[200] = {
+	'0','0', '0','1', '0','2', '0','3', '0','4', '0','5', '0','6', '0','7', '0','8', '0','9',
+	'1','0', '1','1', '1','2', '1','3', '1','4', '1','5', '1','6', '1','7', '1','8', '1','9',
+	'2','0', '2','1', '2','2', '2','3', '2','4', '2','5', '2','6', '2','7', '2','8', '2','9',
+	'3','0', '3','1', '3','2', '3','3', '3','4', '3','5', '3','6', '3','7', '3','8', '3','9',
+	'4','0', '4','1', '4','2', '4','3', '4','4', '4','5', '4','6', '4','7', '4','8', '4','9',
+	'5','0', '5','1', '5','2', '5','3', '5','4', '5','5', '5','6', '5','7', '5','8', '5','9',
+	'6','0', '6','1', '6','2', '6','3', '6','4', '6','5', '6','6', '6','7', '6','8', '6','9',
+	'7','0', '7','1', '7','2', '7','3', '7','4', '7','5', '7','6', '7','7', '7','8', '7','9',
+	'8','0', '8','1', '8','2', '8','3', '8','4', '8','5', '8','6', '8','7', '8','8', '8','9',
+	'9','0', '9','1', '9','2', '9','3', '9','4', '9','5', '9','6', '9','7', '9','8', '9','9'
+};
+
 // Constants for displaying time-signature information
 const char timesig_labels[9][4] = {"2/2", "2/4", "3/4", "4/4", "5/4", "6/8", "7/4", "7/8", "9/8"};
 // Null-terminated sequence of LED patterns a time signature
+// These are expanded into timesig_bar_words[] when the program starts (see patterns_init())
 const uint16_t timesig_flash_patterns[9][10] = {
 	{0xFF, 0xF0, 0}, // 2/2
 	{0xFF, 0xF0, 0}, // 2/4
@@ -45,60 +97,116 @@ const uint16_t timesig_flash_patterns[9][10] = {
 // Function prototypes (using these so I can define the initialisation/boilerplate
 // funcs at the bottom of the program to make the main logic clearer)
 void timer_init(void);
-void led_init(void);
 void buttons_init(void);
 void TIM2_IRQHandler(void);
-void timesig_increase(void);
-void timesig_decrease(void);
-void tap_tempo_recalculate(void);
-void handle_event(uint8_t event_mask, void (*handler)(void));
-void synchronise(void);
-void tempo_increase(void);
-void tempo_decrease(void);
+void EXTI9_5_IRQHandler(void);
+void EXTI15_10_IRQHandler(void);
+void buttons_wake(void);
+void buttons_sleep(void);
+void buttons_sample(void);
+void buttons_poll(void);
+void led_edge_fill(void);
+void led_ring_refill(void);
+void led_ring_rewind(void);
+void led_ring_restart(void);
+void led_click(void);
+void led_click_arm(void);
+void timer_compare_at(uint64_t at_us);
+uint64_t led_edge_us(void);
+void patterns_init(void);
+void set_timesig(size_t signature);
+static void status_format(char *line);
+static inline void timesig_increase(void);
+static inline void timesig_decrease(void);
+static inline void tap_tempo_recalculate(uint64_t pressed_us);
+static inline bool tap_lock(uint16_t bpm);
+static inline void handle_event(uint8_t events, uint8_t event_mask, void (*handler)(void));
+static inline void dump(void);
+static inline void synchronise(void);
+static inline void tempo_increase(void);
+static inline void tempo_decrease(void);
+static inline void tempo_jump_up(void);
+static inline void tempo_jump_down(void);
 void set_tempo(uint16_t bpm);
 
 // Program state
 // Tempo (BPM) as set by the user
 uint16_t tempo          = 0;
-// Time between beats in milliseconds
-uint32_t beat_period_ms = 0;
 
 // Time signature is an index offset into the timesig_ arrays
 size_t   time_signature = 0;
-// Index for timesig_flash_patterns[] array
+// Index for timesig_flash_patterns[] array (the next beat in the bar to be worked out)
 size_t   this_beat      = 0;
 
-// Mask of any button events pending (corresponding to GPIOE pins)
-uint8_t  pending_button_events = 0;
-
-// Global system time since startup in milliseconds
-// Note: using 64-bit unsigned int provides nominally 500,000 millenia of run-time.
-// 32-bit would provide 49 days. Does a metronome need to run for more than 49 days
-// with defined behaviour? Probably not, but I thought of a few exceptions: e.g. if it's
-// part of an exhibition that lasts a few months. Given there's no particular space and
-// resource constraints, and the rest of the implementation being fairly efficient, I chose
-// 500,000 millenia. Practically the threshold would be sooner than this, as floating-point
-// arithmetic is used for the tap-tempo implementation; IEEE 754 double-precision defines
-// 52-bits of mantissa, so the limit is roughly 2^53. A mere 285 millenia. So the user
-// should aim to reset the metronome at least every 284 millenia! ;)
-uint64_t ms_passed = 0;
-
-// We need to know when the last beat was so we know when it's time for the next
-uint64_t timestamp_last_beat = 0;
+// Each time signature's bar, as words for the LED ring (see leds.c). There are two
+// set/reset words per beat: the pattern, then all off for the second half of the
+// beat. Also the number of beats in each bar.
+uint32_t timesig_bar_words[9][18];
+size_t   timesig_beats[9];
+// Time signature of the bar the LEDs are playing
+size_t   bar_signature  = 0;
+// When this is high, the LEDs will switch to the bar for the current time signature
+// at the start of the next beat
+bool     bar_reload_pending = true;
+// Which beat of the bar to start from when it's reloaded
+size_t   bar_start_beat = 0;
+
+// Whether the last LED edge worked out was a beat (so the LEDs are on for the first
+// half of it) rather than a half-beat, i.e. whether the next edge is the half-beat or
+// the next beat
+bool     leds_on        = false;
+// Time of the last LED edge worked out, which the next has to come after
+uint64_t last_edge_us   = 0;
+
+// The edges in the LED ring (see led_edge_fill()): when each is and its click, and
+// where everything was just before it was worked out, so that a change can go back
+// to one that hasn't been played yet and work them out again from there
+typedef struct {
+	uint64_t      at_us;
+	bool          clicks;     // Whether it has a click, and which
+	audio_click_t click;
+	beat_mark_t   grid;       // The beat grid
+	size_t        signature;  // bar_signature
+	size_t        beat;       // this_beat
+	size_t        start_beat; // bar_start_beat
+	bool          reload;     // bar_reload_pending
+	bool          on;         // leds_on
+	uint64_t      after_us;   // last_edge_us
+} led_edge_t;
+led_edge_t led_edges[LEDS_RING];
+// The slot the next edge worked out goes in, and how many there are to work out
+// after a change (see led_ring_rewind()). Also the slot with the next click to be put
+// in, and whether the ring has been started.
+size_t   led_edges_next   = 0;
+size_t   led_edges_redo   = 0;
+size_t   led_clicks_next  = 0;
+bool     led_ring_started = false;
+
+// When the sample of the buttons being taken is from, and the timer for the next
+// (while they're being sampled, see buttons_wake())
+uint64_t buttons_sample_us = 0;
+wheel_timer_t buttons_timer;
 
 // When this is high, the LCD will be updated and then lowered again. Prevents unnecessary rewrites.
 bool     lcd_update_pending = true; // Needs to start high for first draw
 
-// These are used so the tap tempo implementation can track previous taps to take averages
-uint64_t tap_samples[MAX_TAP_TEMPO_SAMPLES] = { 0 }; // Initialise to zeros
-uint8_t  tap_samples_num = 0;
-
 int main(void) {
+	// Two bits of pre-emption priority and two of sub-priority. Everything that
+	// interrupts does so at pre-emption priority 1, so none of them can cut in on
+	// another (see buttons_wake() and audio_click()). Only the jitter recorder's edge
+	// interrupt goes above that (see jitter.c).
+	NVIC_PriorityGroupConfig(NVIC_PriorityGroup_2);
+
 	// Set-up peripherals/interrupts/etc
+	clock_init();   // Everything else works its timings out from the clocks
+	patterns_init();
+	timer_init();   // Delays (see delay.c) need the timer going
+	leds_init(led_ring_refill); // The LED edges are compares on the timer
 	lcd_init();
-	buttons_init();
-	led_init();
-	timer_init();
+	audio_init();
+	buttons_init(); // Uses the timer to sample the buttons
+	jitter_init();
+	power_init();   // After the timer, which it measures the RTC against
 
 	// And let everything sort itself out before using them ;)
 	delay_ms(10);
@@ -107,98 +215,114 @@ int main(void) {
 	lcd_move(0, 0);
 	lcd_print("## METRONOME  ##");
 	set_tempo(120);
-	time_signature = 3; // 4/4
+	set_timesig(3); // 4/4
 
 	// Never stop repeating
 	while (1) {
-		// Dispatch to the relevant handler function if there are pending events
-		// for the following masks (corresponding to buttons on the board)
-		handle_event(MASK_TAP_TEMPO,    tap_tempo_recalculate);
-		handle_event(MASK_BPM_UP,       tempo_increase);
-		handle_event(MASK_BPM_DOWN,     tempo_decrease);
-		handle_event(MASK_SYNCHRONISE,  synchronise);
-		handle_event(MASK_TIMESIG_UP,   timesig_increase);
-		handle_event(MASK_TIMESIG_DOWN, timesig_decrease);
-
-		// If at least half the period has passed (lights flash for half a period)
-		if (ms_passed - timestamp_last_beat > beat_period_ms/2) {
-			if (ms_passed - timestamp_last_beat > beat_period_ms) {
-				if (timesig_flash_patterns[time_signature][this_beat] == 0) {
-					this_beat = 0;
-				}
-
-				// Look-up what pattern to write to the LEDs using pre-defined patterns (see
-				// const defs at top of file). This is used so that certain beats
-				// can be accented more than others.
-				GPIO_Write(GPIOD, ((uint32_t) timesig_flash_patterns[time_signature][this_beat]) << 8);
-				timestamp_last_beat = ms_passed;
-
-				// Move on to the next beat
-				this_beat++;
-			}
-			else {
-				// Turn off the LEDs for the second half of each beat
-				GPIO_Write(GPIOD, 0x0000);
+		// Handle everything that has happened on the buttons since the last wake-up,
+		// in the order it happened (see events.c), dispatching to the relevant handler
+		// function for the following masks (corresponding to buttons on the board)
+		input_event_t event;
+		while (events_pop(&event)) {
+			clock_set_profile(CLOCK_PERFORMANCE);
+
+			// Tap tempo needs to know when the tap was, not just that there was one
+			if (event.pressed & MASK_TAP_TEMPO) {
+				tap_tempo_recalculate(event.at_us);
 			}
+			handle_event(event.pressed, MASK_BPM_UP,       tempo_increase);
+			handle_event(event.pressed, MASK_BPM_DOWN,     tempo_decrease);
+			handle_event(event.held,    MASK_BPM_UP,       tempo_jump_up);
+			handle_event(event.held,    MASK_BPM_DOWN,     tempo_jump_down);
+			handle_event(event.pressed, MASK_SYNCHRONISE,  synchronise);
+			handle_event(event.pressed, MASK_TIMESIG_UP,   timesig_increase);
+			handle_event(event.pressed, MASK_TIMESIG_DOWN, timesig_decrease);
+			handle_event(event.pressed, MASK_SOUND,        audio_next_sound);
+			handle_event(event.pressed, MASK_DUMP,         dump);
+
+			// There has been user input so the system state may have changed,
+			// so redraw the LCD.
+			lcd_update_pending = true;
 		}
+#if JITTER_RECORDER
+		jitter_poll();
+#endif
 
 		// Only write changes to the LCD when something has marked that it needs updating
 		// this prevents wasteful updates when nothing has changed.
 		if (lcd_update_pending) {
-			static char label_line1[20];
+			static char label_line1[STATUS_LENGTH + 1];
+
+			clock_set_profile(CLOCK_PERFORMANCE);
 
 			// Prepare text for display
-			sprintf(label_line1, "%3" PRIu16 "bpm %9s" PRIu16, tempo, timesig_labels[time_signature]);
+			status_format(label_line1);
 
 			// Display the system state
+#if LCD_BIG_DIGITS
+			lcd_print_big(0, tempo, STATUS_TEMPO_WIDTH);
+			lcd_move(STATUS_BIG_COLUMN, 0);
+			lcd_print("  bpm");
+			lcd_move(STATUS_BIG_COLUMN, 1);
+			lcd_print(label_line1 + STATUS_BIG_COLUMN);
+#else
 			lcd_move(0, 1); // Ensure it's printing to the right position
-			lcd_print(label_line1); 
+			lcd_print(label_line1);
+#endif
 
 			// Unset pending flag
 			lcd_update_pending = false;
 		}
 
 		// No need to loop indefinitely - nothing will have changed until the next
-		// timer interrupt, so might as well put the processor to sleep until then
-		__WFI();
+		// timer interrupt, so might as well put the processor to sleep until then.
+		// Beats are played by the LED timer and DMA, so sleeping doesn't delay them.
+		// With STOP mode built in it may stop the clocks instead (see power.c).
+		// The core only needs to be quick while it's working something out, and slowing
+		// it down for the interrupts in between doesn't move the beats either (see
+		// clock.c)
+		clock_set_profile(CLOCK_LOW_POWER);
+		power_idle();
 	}
 
 }
 
 /**
- * Checks if there's a button event waiting to be handled (specified with a mask
- * to select which button), invokes a given handler function if it is, then
- * marks the event as handled
+ * Checks if a button event includes a given button (specified with a mask to
+ * select which button), and invokes a given handler function if it does
  */
-static inline void handle_event(uint8_t event_mask, void (*handler)(void)) {
-	if (pending_button_events & event_mask) {
+static inline void handle_event(uint8_t events, uint8_t event_mask, void (*handler)(void)) {
+	if (events & event_mask) {
 		handler();
-
-		// Unset bit for this event (so the event is 'handled' and won't be triggered
-		// again
-		// Note that part of this architecture means that any event that is
-		// received between the mask being checked and the mask being cleared
-		// will effectively be ignored (overwritten).
-		// This isn't a problem in practice as a user wouldn't press the user
-		// multiple times per 2ms (and if they did it would probably be
-		// erroneous switch bouncing)
-		pending_button_events &= ~event_mask;
-
-		// There has been user input so the system state may have changed,
-		// so redraw the LCD.
-		lcd_update_pending = true;
 	}
 }
 
 /*
- * Sets a new tempo. This has its own function because the period in milliseconds
- * must be updated so the main loop can work out when the next beat is
+ * Prints whatever statistics are built in over the serial port (see jitter.c,
+ * power.c and audio.c), and starts them again. Those that aren't built in are left
+ * out by their headers.
+ */
+static inline void dump(void) {
+	jitter_dump();
+	power_dump();
+	audio_dump();
+}
+
+/*
+ * Sets a new tempo. This has its own function because the beat grid must be
+ * updated so the main loop can work out when the next beat is
  */ 
 void set_tempo(uint16_t bpm) {
 	tempo = bpm;
 
-	// Convert the tempo into the time in ms between each beat (i.e. the period)
-	beat_period_ms = (uint32_t) (1000.0/(tempo/60.0));
+	// Re-space the beat grid from the last beat at the new period. The LED ring has
+	// been filled ahead from the grid, so it's stopped, and what hadn't been played
+	// is worked out again from the new one
+	__disable_irq();
+	led_ring_rewind();
+	beat_set_tempo(tempo);
+	led_ring_restart();
+	__enable_irq();
 }
 
 /*
@@ -206,10 +330,16 @@ void set_tempo(uint16_t bpm) {
  * in the bar - all beats will follow from this point, remaining at the same BPM
  */
 static inline void synchronise() {
-	// This is the easiest way to do this - just makes the system believe that the last beat
-	// happened exactly one beat period ago (so a new beat is due now).
-	timestamp_last_beat = ms_passed - beat_period_ms;
+	// Restart the beat grid from now (so a new beat is due immediately)
+	__disable_irq();
+	led_ring_rewind();
+	beat_synchronise(timebase_now());
 	this_beat = 0;
+	leds_on   = false;
+	bar_start_beat     = 0;
+	bar_reload_pending = true;
+	led_ring_restart();
+	__enable_irq();
 }
 
 /*
@@ -218,101 +348,405 @@ static inline void synchronise() {
  */
 static inline void tempo_increase()   { if (tempo < 999) set_tempo(++tempo); }
 static inline void tempo_decrease()   { if (tempo > 1)   set_tempo(--tempo); }
-static inline void timesig_increase() { if (time_signature < 8) time_signature++; }
-static inline void timesig_decrease() { if (time_signature > 0) time_signature--; }
 
 /*
- * Works out a new tempo by taking the average period between each of the recent taps,
- * up to a maximum number of samples specified at the top of the file.
- *
- * Taps must happen within a certain time threshold, defined at the top of the file,
- * in order to be considered part of the same sequence.
+ * Holding the up/down buttons jumps to the next ten BPM up or down (on top of the
+ * one BPM the press itself changed it by)
  */
-static inline void tap_tempo_recalculate() {
-	// Work out new tempo if the previous one was less than 1000
-	if (tap_samples_num > 0 && ms_passed - tap_samples[tap_samples_num-1] < TAP_TEMPO_FORGET_THRESHOLD) {
-		double tempo = 0.0;
-
-		// Don't look at previous samples if there aren't any
-		if (tap_samples_num > 1) {
-			for (size_t i = 0; i < tap_samples_num-1; i++) {
-				// Time since last tap as a double
-				tempo += (double) tap_samples[i+1] - tap_samples[i];
-			}
-		}
+static inline void tempo_jump_up()    { set_tempo(tempo < 990 ? (tempo / 10 + 1) * 10 : 999); }
+static inline void tempo_jump_down()  { set_tempo(tempo > 10  ? (tempo + 9) / 10 * 10 - 10 : 1); }
+static inline void timesig_increase() { if (time_signature < 8) set_timesig(time_signature + 1); }
+static inline void timesig_decrease() { if (time_signature > 0) set_timesig(time_signature - 1); }
 
-		// Add the final sample
-		// This is done separately so that it is still added if there's only one
-		tempo += ms_passed - tap_samples[tap_samples_num-1];
+/*
+ * Changes the time signature. The LEDs will start the new bar from the next beat.
+ */
+void set_timesig(size_t signature) {
+	__disable_irq();
+	led_ring_rewind();
+	time_signature     = signature;
+	bar_start_beat     = 0;
+	bar_reload_pending = true;
+	led_ring_restart();
+	__enable_irq();
+}
 
-		tempo /= tap_samples_num;   // Take average
-		tempo /= 1000.0;            // Convert into seconds
-		tempo = 60.0/tempo;         // Convert into BPM 
-		set_tempo((int) tempo);     // Change the current state
+/*
+ * Writes out the status line (see STATUS_LENGTH) for the tempo and time signature,
+ * e.g. " 90bpm       4/4". It's the same every time bar the digits, so each field is
+ * written straight into its place, with no format string to parse.
+ */
+static void status_format(char *line) {
+	const char *label = timesig_labels[time_signature];
+	size_t      label_length = strlen(label);
+	uint16_t    rest = tempo % 100;
+	uint16_t    hundreds = tempo / 100;
+
+	memset(line, ' ', STATUS_LENGTH);
+	line[STATUS_LENGTH] = '\0';
+
+	// The tempo's 1-999, and leading zeros are left as spaces
+	line[STATUS_TEMPO_WIDTH - 1] = digit_pairs[2 * rest + 1];
+	if (tempo >= 10) {
+		line[STATUS_TEMPO_WIDTH - 2] = digit_pairs[2 * rest];
 	}
-	else {
-		// Reset tap samples
-		tap_samples_num = 0;
+	if (hundreds > 0) {
+		line[STATUS_TEMPO_WIDTH - 3] = digit_pairs[2 * hundreds + 1];
+	}
+	memcpy(line + STATUS_TEMPO_WIDTH, "bpm", 3);
+
+	memcpy(line + STATUS_LENGTH - label_length, label, label_length);
+}
+
+/*
+ * Works out a new tempo from the recent taps (see tap.c). The first tap of a
+ * sequence doesn't give a tempo, so leaves it as it is.
+ */
+static inline void tap_tempo_recalculate(uint64_t pressed_us) {
+	uint16_t bpm = tap_record(pressed_us);
+
+	if (bpm > 0) {
+#if TAP_PHASE_LOCK
+		if (tap_lock(bpm)) {
+			return;
+		}
+#endif
+		set_tempo(bpm); // Change the current state
 	}
+}
 
-	// If the samples have filled the sample array, we need to shift all elements
-	// of the array along one so that there's still space for a new sample at the end.
-	// So long as MAX_TAP_TEMPO_SAMPLES is a relatively low number, this isn't too
-	// expensive
-	if (tap_samples_num == MAX_TAP_TEMPO_SAMPLES) {
-		// Don't use memcpy as behaviour is undefined for overlapping memory
-		memmove(tap_samples, &tap_samples[1], sizeof(tap_samples) - sizeof(*tap_samples));
-		// There's now one less element
-		tap_samples_num--;
+/*
+ * Puts the beat grid on the taps (see tap_line()), so the beats carry on from the
+ * newest tap at the period they were tapped at, and turns the bar round so the
+ * first tap was a downbeat. Returns false if the taps can't be trusted to do that
+ * yet, or too many of them were off the beat (see tap_confidence()), in which case
+ * only the tempo should change.
+ */
+static inline bool tap_lock(uint16_t bpm) {
+	uint64_t beat_us, period_q;
+	uint32_t beat_num;
+
+	if (tap_confidence() < TAP_TEMPO_LOCK_CONFIDENCE ||
+	    !tap_line(&beat_us, &period_q, &beat_num)) {
+		return false;
 	}
+	tempo = bpm;
 
-	// Add the current time to the samples for the next button press
-	tap_samples[tap_samples_num++] = ms_passed;
+	__disable_irq();
+	led_ring_rewind();
+	// The tapped beat has gone by the time the tap's been seen, so the grid carries on
+	// from the one after it. If a beat's already showing (or about to be) it will do
+	// for the tapped one; if not, the tapped one goes unplayed rather than being
+	// played late. Either way the bar starts again from the beat after.
+	beat_lock(beat_us, period_q);
+	bar_start_beat     = (beat_num + 1) % timesig_beats[time_signature];
+	bar_reload_pending = true;
+	led_ring_restart();
+	__enable_irq();
+
+	return true;
 }
 
 /**
- * Interrupt fires every 2ms and updates the system current-time in ms, then
- * checks for button state and raises a button event if a button that was not
- * down in the previous tick is now down.
+ * TIM2 runs freely and only interrupts when there is something to do: when the
+ * counter wraps (to keep track of the time), shortly before each click to put it in
+ * the audio buffer (compare channel 3), and when a timer on the wheel is due
+ * (channel 2, see wheel.c) - the LCD being ready for the next byte while it's
+ * being updated, or the buttons needing sampling while they're being pressed.
+ * Channel 1 plays the LED edges, and doesn't interrupt (see leds.c).
  */
 void TIM2_IRQHandler(void) {
-	// Need to remember the previous button state so we can do edge detection
-	static uint8_t button_state;
+	// Handle the wrap first so the time is right for anything else due at the same time
+	timebase_irq();
 
-	if (TIM_GetITStatus(TIM2, TIM_IT_Update) != RESET) {
-		// Make sure the interrupt doesn't call again
-		TIM_ClearITPendingBit(TIM2, TIM_IT_Update);
+	if (TIM_GetITStatus(TIM2, TIM_IT_CC3) != RESET) {
+		TIM_ClearITPendingBit(TIM2, TIM_IT_CC3);
+		led_click();
+	}
+
+	if (TIM_GetITStatus(TIM2, TIM_IT_CC2) != RESET) {
+		TIM_ClearITPendingBit(TIM2, TIM_IT_CC2);
+		wheel_irq();
+	}
+}
+
+/*
+ * The first edge on any of the buttons, once they've all been up and settled, raises
+ * one of these (lines 8-9 and 10-15 share an interrupt each)
+ */
+void EXTI9_5_IRQHandler(void)   { buttons_wake(); }
+void EXTI15_10_IRQHandler(void) { buttons_wake(); }
+
+/*
+ * Starts sampling the buttons, straight away and then every BUTTON_POLL_US until
+ * they have settled and been let go again. The edge interrupts are off in the
+ * meantime, so the contacts bouncing don't raise any more.
+ *
+ * The first sample is at the edge, so a press that doesn't bounce is timed exactly.
+ * Must be called from an interrupt at the same priority as TIM2's, so that only one
+ * of them is sampling the buttons (and queueing events) at once.
+ */
+void buttons_wake(void) {
+	EXTI->IMR &= ~BUTTON_EXTI_LINES;
+	EXTI_ClearITPendingBit(BUTTON_EXTI_LINES);
 
-		// Track the global time
-		ms_passed += 2;
+	buttons_sample_us = timebase_now();
+	buttons_sample();
 
-		// Don't need the lower 8 bits
-		uint8_t new_button_state = (uint8_t)(GPIO_ReadInputData(GPIOE) >> 8);
+	wheel_arm(&buttons_timer, buttons_sample_us + BUTTON_POLL_US, buttons_poll);
+}
 
-		// Raise a button event where the button was not previously pressed but is now
-		// This makes sure the event only triggers on the 'edge' of the button state change
-		pending_button_events |= ~button_state & new_button_state;
+/*
+ * Samples the buttons again, and comes back to sample them the next time round
+ * unless they've all been let go and settled. Called back by the buttons' timer.
+ */
+void buttons_poll(void) {
+	buttons_sample_us += BUTTON_POLL_US;
+	wheel_arm(&buttons_timer, buttons_sample_us + BUTTON_POLL_US, buttons_poll);
+	buttons_sample();
 
-		// Update the memory of last button state
-		button_state = new_button_state;
+	if (debounce_idle()) {
+		buttons_sleep();
 	}
 }
 
 /*
- * Sets up the LEDs
+ * Stops sampling the buttons and waits for the next edge instead, so nothing wakes
+ * the processor for the buttons while nobody's touching them
  */
-void led_init(void) {
-	// LEDs use GPIO-D and are Outputs
-	RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
-	GPIO_InitTypeDef init_data;
-	init_data.GPIO_Pin   = GPIO_Pin_8  | GPIO_Pin_9  | GPIO_Pin_10 | 
-	                       GPIO_Pin_11 | GPIO_Pin_12 | GPIO_Pin_13 | 
-	                       GPIO_Pin_14 | GPIO_Pin_15;
-	init_data.GPIO_Mode  = GPIO_Mode_OUT;
-	init_data.GPIO_Speed = GPIO_Speed_50MHz;
-	init_data.GPIO_OType = GPIO_OType_PP;
-	init_data.GPIO_PuPd  = GPIO_PuPd_NOPULL;
-	GPIO_Init(GPIOD , &init_data);
+void buttons_sleep(void) {
+	wheel_cancel(&buttons_timer);
+
+	EXTI_ClearITPendingBit(BUTTON_EXTI_LINES);
+	EXTI->IMR |= BUTTON_EXTI_LINES;
+
+	// A press since the last sample wouldn't have raised an edge interrupt, as they
+	// were off, so look for one now
+	if ((uint8_t) (GPIO_ReadInputData(GPIOE) >> 8) != 0) {
+		buttons_wake();
+	}
+}
+
+/*
+ * Samples the buttons, and raises a button event for anything that has settled into
+ * being pressed, released or held
+ */
+void buttons_sample(void) {
+	debounce_changes_t changes;
+
+	// Don't need the lower 8 bits
+	debounce_sample((uint8_t)(GPIO_ReadInputData(GPIOE) >> 8), &changes);
+
+	// It's only counted once it has read the same for a few samples, so it was
+	// first seen that long ago
+	events_push(buttons_sample_us - BUTTON_DEBOUNCE_US,
+	            changes.pressed, changes.released, changes.held);
+}
+
+/*
+ * Time of the next LED edge: half-way through the beat if the LEDs are on,
+ * otherwise the next beat
+ */
+uint64_t led_edge_us(void) {
+	return leds_on ? beat_half_us() : beat_next_us();
+}
+
+/*
+ * Works out the next LED edge from the beat grid and puts it in its slot in the LED
+ * ring (see leds.c), then moves along to the edge after. Where everything was before
+ * it is kept with it, for led_ring_rewind().
+ */
+void led_edge_fill(void) {
+	size_t      slot  = led_edges_next;
+	led_edge_t *edge  = &led_edges[slot];
+	uint64_t    at_us = led_edge_us();
+
+	beat_save(&edge->grid);
+	edge->signature  = bar_signature;
+	edge->beat       = this_beat;
+	edge->start_beat = bar_start_beat;
+	edge->reload     = bar_reload_pending;
+	edge->on         = leds_on;
+	edge->after_us   = last_edge_us;
+
+	// The ring plays the edges in order, so one that's fallen behind the last (e.g. just
+	// after a sync) goes straight after it. If it's already due it's played straight away.
+	if (at_us <= last_edge_us) {
+		at_us = last_edge_us + 1;
+	}
+
+	// Changing the bar only makes sense at the start of a beat, so that it starts on
+	// the downbeat (or whichever beat it's been asked to)
+	if (!leds_on && bar_reload_pending) {
+		bar_signature      = time_signature;
+		this_beat          = bar_start_beat;
+		bar_start_beat     = 0;
+		bar_reload_pending = false;
+	}
+
+	edge->at_us = at_us;
+	if (leds_on) {
+		// A quieter click goes with the LEDs going off, half-way through the beat
+		edge->clicks = AUDIO_SUBDIVISIONS;
+		edge->click  = AUDIO_SUBDIVISION;
+	} else {
+		// The click goes with the LEDs coming on, and is the accented one on the downbeat
+		edge->clicks = true;
+		edge->click  = this_beat == 0 ? AUDIO_ACCENT : AUDIO_BEAT;
+	}
+	leds_set(slot, at_us, timesig_bar_words[bar_signature][2 * this_beat + leds_on]);
+	last_edge_us   = at_us;
+	led_edges_next = (slot + 1) % LEDS_RING;
+
+	if (!leds_on) {
+		beat_advance(timebase_now());
+
+		// Move on to the next beat
+		if (++this_beat == timesig_beats[bar_signature]) {
+			this_beat = 0;
+		}
+	}
+	leds_on = !leds_on;
+}
+
+/*
+ * Fills the half of the LED ring that has just been played with the edges that come
+ * after the other half. Called back by the LEDs (see leds_init()).
+ */
+void led_ring_refill(void) {
+	for (size_t n = 0; n < LEDS_HALF; n++) {
+		led_edge_fill();
+	}
+}
+
+/*
+ * Puts everything back to how it was before the first edge in the LED ring that's
+ * more than CLICK_LEAD_US off, so that a change made now takes effect from there.
+ * Anything sooner is left to play as it is, as its click may already be in the
+ * audio buffer. The ring carries on playing, and the edges from there on are worked
+ * out again by led_ring_restart(), well before it gets to them.
+ * Must be called with interrupts masked.
+ */
+void led_ring_rewind(void) {
+	uint64_t    keep_us = timebase_now() + CLICK_LEAD_US;
+	size_t      slot = leds_next();
+	led_edge_t *edge;
+
+	// Nothing to go back to before the ring has been started
+	if (!led_ring_started) {
+		return;
+	}
+
+	// The ring's always full, so everything from where it's got to up to the last edge
+	// filled is still to be played (all of it, if it's got right round to that)
+	led_edges_redo = (led_edges_next + LEDS_RING - slot) % LEDS_RING;
+	if (led_edges_redo == 0) {
+		led_edges_redo = LEDS_RING;
+	}
+	while (led_edges_redo > 0 && led_edges[slot].at_us <= keep_us) {
+		slot = (slot + 1) % LEDS_RING;
+		led_edges_redo--;
+	}
+	if (led_edges_redo == 0) {
+		return;
+	}
+
+	edge = &led_edges[slot];
+	beat_restore(&edge->grid);
+	bar_signature      = edge->signature;
+	this_beat          = edge->beat;
+	bar_start_beat     = edge->start_beat;
+	bar_reload_pending = edge->reload;
+	leds_on            = edge->on;
+	last_edge_us       = edge->after_us;
+	led_edges_next     = slot;
+}
+
+/*
+ * Works the LED ring's edges out again from where led_ring_rewind() put everything
+ * back to, or the first time, fills it and starts it playing, then sets the next click
+ * up to match. Must be called with interrupts masked.
+ */
+void led_ring_restart(void) {
+	size_t first = led_edges_next;
+
+	if (!led_ring_started) {
+		for (size_t n = 0; n < LEDS_RING; n++) {
+			led_edge_fill();
+		}
+		leds_start();
+		led_ring_started = true;
+	} else if (led_edges_redo > 0) {
+		for (; led_edges_redo > 0; led_edges_redo--) {
+			led_edge_fill();
+		}
+		leds_changed(first);
+	}
+	led_click_arm();
+}
+
+/*
+ * Puts the next edge's click in the audio buffer (see audio_click()), then sets the
+ * compare for the one after
+ */
+void led_click(void) {
+	led_edge_t *edge = &led_edges[led_clicks_next];
+
+	led_clicks_next = (led_clicks_next + 1) % LEDS_RING;
+	audio_click(edge->at_us, edge->click);
+	led_click_arm();
+}
+
+/*
+ * Points compare channel 3 CLICK_LEAD_US before the next edge in the ring that has a
+ * click. Every beat has one, and it's always filled well ahead of being played, so
+ * it's at most the edge after the next. Its own channel rather than a timer on the
+ * wheel, which would come round to it a level at a time.
+ * Must be called with the timer interrupt masked (or from the interrupt itself).
+ */
+void led_click_arm(void) {
+	uint64_t edge_us;
+
+	if (!led_edges[led_clicks_next].clicks) {
+		led_clicks_next = (led_clicks_next + 1) % LEDS_RING;
+	}
+
+	edge_us = led_edges[led_clicks_next].at_us;
+	timer_compare_at(edge_us > CLICK_LEAD_US ? edge_us - CLICK_LEAD_US : 0);
+}
+
+/*
+ * Sets compare channel 3 to interrupt at a given time. If that time has already gone
+ * by then the compare won't match until the counter comes all the way back around,
+ * so the event is raised straight away instead.
+ */
+void timer_compare_at(uint64_t at_us) {
+	TIM_SetCompare3(TIM2, (uint32_t) at_us);
+
+	if (timebase_now() >= at_us) {
+		TIM_GenerateEvent(TIM2, TIM_EventSource_CC3);
+	}
+}
+
+/*
+ * Lays out each time signature's flash patterns as LED set/reset words, ready to be
+ * put in the LED ring an edge at a time
+ */
+void patterns_init(void) {
+	for (size_t signature = 0; signature < 9; signature++) {
+		size_t beat = 0;
+
+		while (timesig_flash_patterns[signature][beat] != 0) {
+			uint8_t pattern = (uint8_t) timesig_flash_patterns[signature][beat];
+
+			// Turn off the LEDs for the second half of each beat
+			timesig_bar_words[signature][2*beat]     = leds_bsrr(pattern);
+			timesig_bar_words[signature][2*beat + 1] = leds_bsrr(0x00);
+			beat++;
+		}
+
+		timesig_beats[signature] = beat;
+	}
 }
 
 /*
@@ -329,32 +763,65 @@ void buttons_init(void) {
 	init_data.GPIO_Speed = GPIO_Speed_50MHz;
 	init_data.GPIO_OType = GPIO_OType_PP;
 	init_data.GPIO_PuPd  = GPIO_PuPd_NOPULL;
-	GPIO_Init(GPIOD , &init_data);
+	GPIO_Init(GPIOE, &init_data);
+
+	debounce_init(BUTTON_DEBOUNCE_SAMPLES, BUTTON_LONG_PRESS_US / BUTTON_POLL_US);
+
+	// A button going down raises an interrupt on its EXTI line
+	RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
+	for (uint8_t pin = EXTI_PinSource8; pin <= EXTI_PinSource15; pin++) {
+		SYSCFG_EXTILineConfig(EXTI_PortSourceGPIOE, pin);
+	}
+	EXTI_InitTypeDef exti_init_data;
+	exti_init_data.EXTI_Line    = BUTTON_EXTI_LINES;
+	exti_init_data.EXTI_Mode    = EXTI_Mode_Interrupt;
+	exti_init_data.EXTI_Trigger = EXTI_Trigger_Rising;
+	exti_init_data.EXTI_LineCmd = ENABLE;
+	EXTI_Init(&exti_init_data);
+
+	// Same priority as TIM2, so neither can interrupt the other (see buttons_wake())
+	NVIC_InitTypeDef nvic_init_data;
+	nvic_init_data.NVIC_IRQChannelCmd = ENABLE;
+	nvic_init_data.NVIC_IRQChannelPreemptionPriority = 1;
+	nvic_init_data.NVIC_IRQChannelSubPriority = 1;
+	nvic_init_data.NVIC_IRQChannel = EXTI9_5_IRQn;
+	NVIC_Init(&nvic_init_data);
+	nvic_init_data.NVIC_IRQChannel = EXTI15_10_IRQn;
+	NVIC_Init(&nvic_init_data);
+
+	// Wait for the first press (or take it now if there's one already)
+	buttons_sleep();
 }
 
 /*
  * Sets up the timer and interrupts for the timer.
  */
 void timer_init(void) {
-	RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM2, ENABLE);
-
-	// Set-up the timer
-	TIM_TimeBaseInitTypeDef init_data; 
-	init_data.TIM_Prescaler     = 41999; // 0.5ms
-	init_data.TIM_CounterMode   = TIM_CounterMode_Up;
-	init_data.TIM_Period        = 1;
-	init_data.TIM_ClockDivision = TIM_CKD_DIV1;
-	init_data.TIM_RepetitionCounter = 0;
-	TIM_TimeBaseInit(TIM2, &init_data);
-	TIM_Cmd(TIM2, ENABLE);
-	TIM_ITConfig(TIM2, TIM_IT_Update, ENABLE);
-
-	// Then set-up interrupts for the timer (fires every timer period)
+	// TIM2 is also the system time (see timebase.c), so it's already counting. The
+	// wheel has compare channel 2, the LEDs channel 1 (see leds.c), and the clicks
+	// channel 3.
+	timebase_init();
+	wheel_init();
+
+	// The clicks' compare channel doesn't drive a pin, it just raises an interrupt at
+	// the time it's set to. New compare values should take effect straight away.
+	TIM_OCInitTypeDef oc_init_data;
+	TIM_OCStructInit(&oc_init_data);
+	oc_init_data.TIM_OCMode = TIM_OCMode_Timing;
+	TIM_OC3Init(TIM2, &oc_init_data);
+	TIM_OC3PreloadConfig(TIM2, TIM_OCPreload_Disable);
+
+	// Nothing is due until a tempo is set. The wheel turns channel 2's interrupt on
+	// when it has a timer to run.
+	TIM_SetCompare3(TIM2, 0xFFFFFFFF);
+
+	TIM_ITConfig(TIM2, TIM_IT_CC3, ENABLE);
+
+	// Then set-up interrupts for the timer (fires on wrap and on each compare)
 	NVIC_InitTypeDef nvic_init_data;
 	nvic_init_data.NVIC_IRQChannel    = TIM2_IRQn;
 	nvic_init_data.NVIC_IRQChannelCmd = ENABLE;
-	nvic_init_data.NVIC_IRQChannelPreemptionPriority = 0;
+	nvic_init_data.NVIC_IRQChannelPreemptionPriority = 1;
 	nvic_init_data.NVIC_IRQChannelSubPriority = 1;
 	NVIC_Init(&nvic_init_data);
 }
-
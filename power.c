@@ -0,0 +1,413 @@
+#include "power.h"
+
+#if POWER_STOP
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stm32f4xx_exti.h>
+#include <stm32f4xx_pwr.h>
+#include <stm32f4xx_rtc.h>
+#include <stm32f4xx_tim.h>
+#include <stm32f4xx_usart.h>
+#include <misc.h>
+#include <stm32f4xx.h>
+#include "timebase.h"
+#include "leds.h"
+#include "serial.h"
+#include "audio.h"
+
+// Stops the clocks between beats. Even asleep, the PLL and everything running from
+// it draw tens of milliamps, and most of the time there's nothing to do for hundreds
+// of milliseconds until the next LED edge or click. So when the next thing TIM2 has
+// to do (any of its compare channels) is far enough off, the processor goes
+// into STOP mode instead of sleeping, and the RTC's wakeup timer starts it again a
+// little before then. A button still wakes it straight away, through its EXTI line.
+//
+// Nothing on the high-speed clocks runs while they're stopped, TIM2 included, so the
+// RTC keeps the time meanwhile. It runs from the LSI, as the Discovery board has no
+// 32kHz crystal for the LSE, and the LSI is only good to a few percent; so it's
+// measured against TIM2 when the firmware starts and every few minutes after, over a
+// few seconds without stopping. Going into STOP mode waits for one of the RTC's ticks
+// and notes the time base then, and after waking it waits for another and puts TIM2
+// forward by the time between the two. Each stop costs up to a microsecond or so
+// against the crystal, plus whatever error there is in the LSI's measurement over
+// the length of the stop.
+//
+// On waking, the processor runs from the HSI at 16MHz until the HSE and then the PLL
+// are going again, which takes a millisecond or two, so it wakes POWER_WAKE_MARGIN_US
+// early to have that done before TIM2 is due to do anything. How long it actually
+// takes is measured every time with the RTC, to the nearest tick (about 30us), and
+// can be printed over the serial port (see power_dump()).
+
+// Only stop if the next deadline is at least this far off, in microseconds
+#define POWER_STOP_MIN_US    10000
+
+// How long before the deadline to wake up, in microseconds. The HSE takes up to 2ms
+// to start, and the PLL a little while to lock after that.
+#define POWER_WAKE_MARGIN_US 3000
+
+// The longest stop, in microseconds. The wakeup timer can count to about 4s.
+#define POWER_STOP_MAX_US    2000000
+
+// How long the LSI is measured over, and how often, in microseconds. The measurement
+// is given up and started again if it isn't finished in time for the RTC's time
+// within the minute to tell how many ticks there have been.
+#define POWER_CALIBRATE_US     4000000
+#define POWER_CALIBRATE_MAX_US 30000000
+#define POWER_RECALIBRATE_US   300000000ULL
+
+// The RTC's prescalers: the subsecond counter counts every LSI tick, through a
+// nominal second. Times are kept in LSI ticks within the minute.
+#define POWER_RTC_SYNCH_PREDIV     0x7FFF
+#define POWER_RTC_TICKS_PER_SECOND (POWER_RTC_SYNCH_PREDIV + 1)
+#define POWER_RTC_TICKS_PER_MINUTE (60 * POWER_RTC_TICKS_PER_SECOND)
+
+// Microseconds per LSI tick, as a 32.32 fixed-point number, and the measurement of it
+// under way: the tick it started at, and the time base then
+static uint64_t power_tick_us = 0;
+static bool     power_calibrating = false;
+static uint32_t power_calibrate_tick;
+static uint64_t power_calibrate_us;
+static uint64_t power_recalibrate_us;
+
+// Statistics since they were last printed: stops, those a button woke rather than
+// the RTC, those where the clocks were back after the deadline, and how long they
+// took to come back
+static uint32_t power_stops = 0;
+static uint32_t power_early = 0;
+static uint32_t power_late  = 0;
+static uint32_t power_wake_min_us = UINT32_MAX;
+static uint32_t power_wake_max_us = 0;
+static uint64_t power_wake_sum_us = 0;
+
+/*
+ * Reads the RTC's time within the minute, in LSI ticks. The shadow registers are
+ * bypassed so it can be read straight after waking, so the subseconds are read
+ * either side of the seconds, until they agree, in case the RTC ticked in between.
+ */
+static uint32_t power_rtc_ticks(void) {
+	uint32_t ss, tr;
+
+	do {
+		ss = RTC->SSR;
+		tr = RTC->TR;
+	} while (RTC->SSR != ss);
+
+	tr &= RTC_TR_ST | RTC_TR_SU;
+	return ((tr >> 4) * 10 + (tr & 0xF)) * POWER_RTC_TICKS_PER_SECOND + (POWER_RTC_SYNCH_PREDIV - ss);
+}
+
+/*
+ * Waits for the RTC to tick, and gives the time it ticked to
+ */
+static uint32_t power_rtc_edge(void) {
+	uint32_t was = power_rtc_ticks();
+	uint32_t ticks;
+
+	while ((ticks = power_rtc_ticks()) == was);
+	return ticks;
+}
+
+static uint32_t power_ticks_between(uint32_t from, uint32_t to) {
+	return (to + POWER_RTC_TICKS_PER_MINUTE - from) % POWER_RTC_TICKS_PER_MINUTE;
+}
+
+static uint64_t power_ticks_to_us(uint32_t ticks) {
+	return ((uint64_t) ticks * power_tick_us + (1ULL << 31)) >> 32;
+}
+
+static uint32_t power_us_to_ticks(uint64_t us) {
+	return (uint32_t) ((us << 32) / power_tick_us);
+}
+
+/*
+ * Starts measuring the LSI against the time base. Until it's done, the processor only
+ * sleeps, so TIM2 keeps counting.
+ */
+static void power_calibrate_start(void) {
+	power_calibrate_tick = power_rtc_edge();
+	power_calibrate_us   = timebase_now();
+	power_calibrating    = true;
+}
+
+static void power_calibrate_end(void) {
+	uint32_t tick   = power_rtc_edge();
+	uint64_t now_us = timebase_now();
+
+	if (now_us - power_calibrate_us > POWER_CALIBRATE_MAX_US) {
+		power_calibrate_start();
+		return;
+	}
+
+	power_tick_us = ((now_us - power_calibrate_us) << 32) / power_ticks_between(power_calibrate_tick, tick);
+	power_recalibrate_us = now_us + POWER_RECALIBRATE_US;
+	power_calibrating    = false;
+}
+
+/*
+ * The next time TIM2 has something to do: the earliest of its compare channels that
+ * has its interrupt or its DMA request on (the LED edges, see leds.c), or now if one
+ * that interrupts has already matched. A DMA request doesn't clear the flag, so that
+ * says nothing for the others. Anything further off than the longest stop is as good
+ * as never.
+ */
+static uint64_t power_deadline(uint64_t now_us) {
+	uint32_t ccr[4] = { TIM2->CCR1, TIM2->CCR2, TIM2->CCR3, TIM2->CCR4 };
+	uint16_t dier = TIM2->DIER;
+	uint16_t sr   = TIM2->SR;
+	uint64_t deadline_us = now_us + POWER_STOP_MAX_US + POWER_WAKE_MARGIN_US;
+	uint8_t  channel;
+
+	for (channel = 0; channel < 4; channel++) {
+		uint64_t at_us;
+
+		if (!(dier & ((TIM_DIER_CC1IE | TIM_DIER_CC1DE) << channel))) {
+			continue;
+		}
+		if ((dier & (TIM_DIER_CC1IE << channel)) && (sr & (TIM_SR_CC1IF << channel))) {
+			return now_us;
+		}
+		at_us = now_us + (uint32_t) (ccr[channel] - (uint32_t) now_us);
+		if (at_us < deadline_us) {
+			deadline_us = at_us;
+		}
+	}
+
+	return deadline_us;
+}
+
+/*
+ * Raises TIM2's compare interrupts that its counter has just been put forward past,
+ * as they'd otherwise not match until it came all the way round again. The LEDs see
+ * to their own (see leds_catch_up()).
+ */
+static void power_catch_up(uint32_t from, uint32_t skipped) {
+	uint32_t ccr[4] = { TIM2->CCR1, TIM2->CCR2, TIM2->CCR3, TIM2->CCR4 };
+	uint16_t dier = TIM2->DIER;
+	uint8_t  channel;
+
+	for (channel = 0; channel < 4; channel++) {
+		if ((dier & (TIM_DIER_CC1IE << channel)) && ccr[channel] - from - 1 < skipped) {
+			TIM_GenerateEvent(TIM2, TIM_EventSource_CC1 << channel);
+		}
+	}
+}
+
+/*
+ * Starts the HSE and the PLL again and switches back to it, as SystemInit() left
+ * them. Everything else about the clocks (the PLL's settings, the bus prescalers, the
+ * flash wait states) is kept through STOP mode.
+ */
+static void power_clocks_restore(void) {
+	RCC->CR |= RCC_CR_HSEON;
+	while (!(RCC->CR & RCC_CR_HSERDY));
+
+	RCC->CR |= RCC_CR_PLLON;
+	while (!(RCC->CR & RCC_CR_PLLRDY));
+
+	RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | RCC_CFGR_SW_PLL;
+	while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL);
+}
+
+static void power_wakeup_off(void) {
+	RTC_WakeUpCmd(DISABLE);
+	RTC_ClearITPendingBit(RTC_IT_WUT);
+	EXTI_ClearITPendingBit(EXTI_Line22);
+}
+
+/*
+ * Stops the clocks until the margin before the deadline, or until a button wakes it
+ * first, then gets them going again and puts the time base forward by however long
+ * they were stopped for. Called with interrupts masked.
+ */
+static void power_stop(uint64_t deadline_us) {
+	uint32_t before, woke, after, wakeup, wake_us;
+	uint64_t start_us, stale_us, resumed_us;
+	bool     early;
+
+	// Time the stop from one of the RTC's ticks. The wakeup timer counts in pairs of
+	// them.
+	before   = power_rtc_edge();
+	start_us = timebase_now();
+	wakeup   = power_us_to_ticks(deadline_us - POWER_WAKE_MARGIN_US - start_us) / 2;
+	if (wakeup < 1) {
+		wakeup = 1;
+	} else if (wakeup > 0x10000) {
+		wakeup = 0x10000;
+	}
+	RTC_SetWakeUpCounter(wakeup - 1);
+	RTC_WakeUpCmd(ENABLE);
+
+	PWR_EnterSTOPMode(PWR_Regulator_LowPower, PWR_STOPEntry_WFI);
+
+	// If an interrupt was already waiting, it didn't stop at all and the clocks are
+	// still going
+	if ((RCC->CFGR & RCC_CFGR_SWS) == RCC_CFGR_SWS_PLL) {
+		power_wakeup_off();
+		return;
+	}
+
+	// Running from the HSI. Note when it woke, and what woke it, before anything else.
+	woke  = power_rtc_ticks();
+	early = RTC_GetFlagStatus(RTC_FLAG_WUTF) == RESET;
+	power_clocks_restore();
+	power_wakeup_off();
+
+	// TIM2 stopped along with the clocks, and has been going again for a little while
+	after      = power_rtc_edge();
+	stale_us   = timebase_now();
+	resumed_us = start_us + power_ticks_to_us(power_ticks_between(before, after));
+	if (resumed_us > stale_us) {
+		timebase_advance(resumed_us - stale_us);
+		power_catch_up((uint32_t) stale_us, (uint32_t) (resumed_us - stale_us));
+		leds_catch_up();
+	}
+
+	wake_us = (uint32_t) power_ticks_to_us(power_ticks_between(woke, after));
+	power_stops++;
+	power_early += early;
+	power_late  += resumed_us > deadline_us;
+	power_wake_sum_us += wake_us;
+	if (wake_us < power_wake_min_us) {
+		power_wake_min_us = wake_us;
+	}
+	if (wake_us > power_wake_max_us) {
+		power_wake_max_us = wake_us;
+	}
+}
+
+/*
+ * Waits for something to happen, in STOP mode if nothing is due for a while and
+ * nothing is going on that needs the clocks, otherwise just asleep. Called from the
+ * main loop in place of __WFI().
+ */
+void power_idle(void) {
+	uint64_t now_us, deadline_us;
+
+	__disable_irq();
+	now_us = timebase_now();
+
+	if (power_calibrating && now_us - power_calibrate_us >= POWER_CALIBRATE_US) {
+		power_calibrate_end();
+	} else if (!power_calibrating && now_us >= power_recalibrate_us) {
+		power_calibrate_start();
+	}
+
+	// The DAC and the serial port run from the clocks too, so mustn't be stopped half
+	// way through a click or a character. The DAC's DMA interrupts after every block;
+	// the serial port is only used to print the statistics, so that's just left to the
+	// next thing that wakes it. The LED edges are in the deadline, and are written in
+	// a few cycles.
+	deadline_us = power_deadline(now_us);
+	if (power_calibrating || audio_busy() ||
+	    USART_GetFlagStatus(USART2, USART_FLAG_TC) == RESET ||
+	    deadline_us - now_us < POWER_STOP_MIN_US) {
+		__WFI();
+	} else {
+		power_stop(deadline_us);
+	}
+
+	__enable_irq();
+}
+
+/*
+ * Prints the statistics so far over the serial port, then starts them again
+ */
+void power_dump(void) {
+	if (power_stops == 0) {
+		printf("power: no stops\r\n");
+		return;
+	}
+
+	printf("power: %" PRIu32 " stops, %" PRIu32 " woken early, %" PRIu32 " late, LSI %" PRIu32
+	       "Hz, wake-up us min %" PRIu32 " max %" PRIu32 " mean %" PRIu32 "\r\n",
+	       power_stops, power_early, power_late, (uint32_t) ((1000000ULL << 32) / power_tick_us),
+	       power_wake_min_us, power_wake_max_us, (uint32_t) (power_wake_sum_us / power_stops));
+
+	power_stops = 0;
+	power_early = 0;
+	power_late  = 0;
+	power_wake_min_us = UINT32_MAX;
+	power_wake_max_us = 0;
+	power_wake_sum_us = 0;
+}
+
+/*
+ * LED edge has been written. While one is too close to stop for, the processor only
+ * sleeps, and this is what wakes it to see whether it can stop until the next one.
+ */
+void LEDS_EDGE_IRQHandler(void) {
+	leds_edge_irq_clear();
+}
+
+/*
+ * The RTC's wakeup timer has gone off. Stopping and waking up are all done with
+ * interrupts masked (see power_stop()), so by the time this runs there's nothing
+ * left to do but make sure the flags are down.
+ */
+void RTC_WKUP_IRQHandler(void) {
+	RTC_ClearITPendingBit(RTC_IT_WUT);
+	EXTI_ClearITPendingBit(EXTI_Line22);
+}
+
+/*
+ * Sets up the RTC and its wakeup interrupt, and starts measuring the LSI. Must be
+ * called after the time base and the LEDs are set up.
+ */
+void power_init(void) {
+	RTC_InitTypeDef  rtc_init_data;
+	EXTI_InitTypeDef exti_init_data;
+	NVIC_InitTypeDef nvic_init_data;
+
+	serial_init();
+
+	// The RTC is in the backup domain, which is write-protected
+	RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+	PWR->CR      |= PWR_CR_DBP;
+
+	RCC->CSR |= RCC_CSR_LSION;
+	while (!(RCC->CSR & RCC_CSR_LSIRDY));
+
+	// The backup domain isn't reset along with everything else, and the RTC's clock
+	// can only be chosen once after it has been
+	if ((RCC->BDCR & RCC_BDCR_RTCSEL) != RCC_BDCR_RTCSEL_1) {
+		RCC->BDCR |= RCC_BDCR_BDRST;
+		RCC->BDCR &= ~RCC_BDCR_BDRST;
+		RCC->BDCR |= RCC_BDCR_RTCSEL_1;
+	}
+	RCC->BDCR |= RCC_BDCR_RTCEN;
+
+	RTC_StructInit(&rtc_init_data);
+	rtc_init_data.RTC_AsynchPrediv = 0;
+	rtc_init_data.RTC_SynchPrediv  = POWER_RTC_SYNCH_PREDIV;
+	RTC_Init(&rtc_init_data);
+	RTC_BypassShadowCmd(ENABLE);
+
+	RTC_WakeUpCmd(DISABLE);
+	RTC_WakeUpClockConfig(RTC_WakeUpClock_RTCCLK_Div2);
+	RTC_ITConfig(RTC_IT_WUT, ENABLE);
+	RTC_ClearITPendingBit(RTC_IT_WUT);
+
+	// The wakeup timer is on EXTI line 22
+	EXTI_ClearITPendingBit(EXTI_Line22);
+	exti_init_data.EXTI_Line    = EXTI_Line22;
+	exti_init_data.EXTI_Mode    = EXTI_Mode_Interrupt;
+	exti_init_data.EXTI_Trigger = EXTI_Trigger_Rising;
+	exti_init_data.EXTI_LineCmd = ENABLE;
+	EXTI_Init(&exti_init_data);
+
+	nvic_init_data.NVIC_IRQChannel = RTC_WKUP_IRQn;
+	nvic_init_data.NVIC_IRQChannelPreemptionPriority = 1;
+	nvic_init_data.NVIC_IRQChannelSubPriority = 1;
+	nvic_init_data.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&nvic_init_data);
+
+	leds_edge_irq_enable();
+	nvic_init_data.NVIC_IRQChannel = LEDS_EDGE_IRQn;
+	NVIC_Init(&nvic_init_data);
+
+	power_calibrate_start();
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef _POWER_H_
+#define _POWER_H_
+
+#include "jitter.h"
+
+// Set to 1 to stop the clocks altogether between beats, rather than just sleeping
+// (see power.c), for running from batteries. While they're stopped the time is kept
+// by the LSI, which isn't nearly as good as the crystal, so it's left out of normal
+// builds. The jitter recorder's cycle counter would stop along with everything else,
+// so it can't be built in as well.
+#ifndef POWER_STOP
+#define POWER_STOP 0
+#endif
+
+#if POWER_STOP && JITTER_RECORDER
+#error "The jitter recorder can't be built in along with STOP mode"
+#endif
+
+#if POWER_STOP
+
+void power_init(void);
+void power_idle(void);
+void power_dump(void);
+
+#else
+
+#define power_init() ((void) 0)
+#define power_idle() __WFI()
+#define power_dump() ((void) 0)
+
+#endif
+
+#endif /*_POWER_H_*/
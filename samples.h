@@ -0,0 +1,9 @@
+#ifndef _SAMPLES_H_
+#define _SAMPLES_H_
+
+#include "adpcm.h"
+
+extern const adpcm_sound_t samples_woodblock;
+extern const adpcm_sound_t samples_cowbell;
+
+#endif /*_SAMPLES_H_*/
@@ -1,13 +1,31 @@
 #include "serial.h"
 #include "stm32f4xx.h"
+#include "stm32f4xx_rcc.h"
 
-static void _configUSART2(uint32_t BAUD, uint32_t fosc)
+#define SERIAL_BAUD 38400
+
+/* Baud rate divider from whatever APB1 is running at now (see clock.c) */
+static void _baudUSART2(uint32_t BAUD)
 {
+  RCC_ClocksTypeDef clocks;
   uint32_t tmpreg = 0x00, apbclock = 0x00;
   uint32_t integerdivider = 0x00;
   uint32_t fractionaldivider = 0x00;
 
-  apbclock = fosc/16;
+  RCC_GetClocksFreq(&clocks);
+  apbclock = clocks.PCLK1_Frequency;
+
+  integerdivider = ((25 * apbclock) / (4 * (BAUD)));
+  tmpreg = (integerdivider / 100) << 4;
+  fractionaldivider = integerdivider - (100 * (tmpreg >> 4));
+
+  tmpreg |= ((((fractionaldivider * 16) + 50) / 100)) & ((uint8_t)0x0F);
+
+  USART2->BRR = (uint16_t)tmpreg;
+}
+
+static void _configUSART2(uint32_t BAUD)
+{
 	RCC->AHB1ENR |= RCC_AHB1ENR_GPIOAEN;
   RCC->APB1ENR |= RCC_APB1ENR_USART2EN;	/* Enable USART2 Clock */
 
@@ -18,16 +36,26 @@ static void _configUSART2(uint32_t BAUD, uint32_t fosc)
 
   USART2->CR1 |= USART_CR1_UE;	/* Enable USART */
 
-  integerdivider = ((25 * apbclock) / (2 * (BAUD)));  
-  tmpreg = (integerdivider / 100) << 4;
-  fractionaldivider = integerdivider - (100 * (tmpreg >> 4));
-
-  tmpreg |= ((((fractionaldivider * 8) + 50) / 100)) & ((uint8_t)0x07);
-
-  USART2->BRR = (uint16_t)tmpreg;
+  _baudUSART2(BAUD);
   USART2->CR1 |= USART_CR1_TE;	/* Enable Tx */
 }
 
 void serial_init(void) {
-	_configUSART2(38400, 168000000);
+	_configUSART2(SERIAL_BAUD);
+}
+
+/*
+ * Whether a character is still going out
+ */
+bool serial_busy(void) {
+	return (USART2->CR1 & USART_CR1_UE) && !(USART2->SR & USART_SR_TC);
+}
+
+/*
+ * Keeps the baud rate the same after the clocks have changed
+ */
+void serial_clock_changed(void) {
+	if (USART2->CR1 & USART_CR1_UE) {
+		_baudUSART2(SERIAL_BAUD);
+	}
 }
@@ -1,6 +1,10 @@
 #ifndef _SERIAL_H_
 #define _SERIAL_H_
 
+#include <stdbool.h>
+
 void serial_init(void);
+bool serial_busy(void);
+void serial_clock_changed(void);
 
 #endif /*_SERIAL_H_*/
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "adpcm.h"
+
+// Encodes a sound for the firmware's sampled clicks (see synth.c) from a WAV file of
+// 16-bit mono samples at 48kHz, and prints it as C for samples.c:
+//
+//   adpcm-encode woodblock woodblock.wav >> ../samples.c
+//
+// Each code is the one the firmware's own decoder (adpcm.c) gets nearest the sample
+// with, so what's encoded can't drift away from what's played. The first step size
+// is whichever makes the least error over the whole sound, so a sharp attack isn't
+// smeared while the step size catches up with it. The error goes to stderr.
+
+#define WAV_RATE_HZ 48000
+#define STEP_SIZES  89
+#define PER_LINE    16
+
+static const char *program;
+
+static void fail(const char *path, const char *message) {
+	fprintf(stderr, "%s: %s: %s\n", program, path, message);
+	exit(1);
+}
+
+static uint32_t get_le(const uint8_t *bytes, size_t size) {
+	uint32_t value = 0;
+
+	while (size-- > 0) {
+		value = value << 8 | bytes[size];
+	}
+	return value;
+}
+
+/*
+ * Reads the samples out of a WAV file, which has to be as the firmware plays them
+ */
+static int16_t *wav_read(const char *path, uint32_t *length) {
+	FILE    *file = fopen(path, "rb");
+	uint8_t  header[12], chunk[8], format[16];
+	bool     formatted = false;
+
+	if (!file) {
+		perror(path);
+		exit(1);
+	}
+	if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+	    memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+		fail(path, "not a WAV file");
+	}
+
+	while (fread(chunk, 1, sizeof(chunk), file) == sizeof(chunk)) {
+		uint32_t size = get_le(chunk + 4, 4);
+
+		if (memcmp(chunk, "fmt ", 4) == 0 && size >= sizeof(format)) {
+			if (fread(format, 1, sizeof(format), file) != sizeof(format)) {
+				break;
+			}
+			if (get_le(format, 2) != 1 || get_le(format + 2, 2) != 1 ||
+			    get_le(format + 4, 4) != WAV_RATE_HZ || get_le(format + 14, 2) != 16) {
+				fail(path, "has to be 16-bit mono PCM at 48kHz");
+			}
+			formatted = true;
+			size -= sizeof(format);
+		} else if (memcmp(chunk, "data", 4) == 0 && formatted) {
+			int16_t *samples = malloc(size);
+			uint8_t *bytes   = (uint8_t *) samples;
+
+			*length = size / 2;
+			if (!samples || fread(samples, 2, *length, file) != *length) {
+				fail(path, "can't read the samples");
+			}
+			for (uint32_t n = 0; n < *length; n++) {
+				samples[n] = (int16_t) get_le(bytes + 2 * n, 2);
+			}
+			fclose(file);
+			return samples;
+		}
+
+		// Chunks are padded to an even size
+		fseek(file, size + (size & 1), SEEK_CUR);
+	}
+
+	fail(path, "no samples");
+	return NULL;
+}
+
+/*
+ * The code that decodes nearest a sample from where the decoder's got to
+ */
+static uint8_t nearest_code(const adpcm_state_t *state, int16_t sample) {
+	uint8_t  best = 0;
+	uint32_t best_error = UINT32_MAX;
+
+	for (uint8_t code = 0; code < 16; code++) {
+		adpcm_state_t trial = *state;
+		uint32_t error = abs(adpcm_next(&trial, code) - sample);
+
+		if (error < best_error) {
+			best = code;
+			best_error = error;
+		}
+	}
+	return best;
+}
+
+/*
+ * Encodes the samples from a first step size, returning the squared error and
+ * filling in the codes (two to a byte) if they're wanted
+ */
+static uint64_t encode(const int16_t *samples, uint32_t length, uint8_t index, uint8_t *codes) {
+	adpcm_sound_t sound = { NULL, length, index };
+	adpcm_state_t state;
+	uint64_t      error = 0;
+
+	adpcm_start(&state, &sound);
+	for (uint32_t n = 0; n < length; n++) {
+		uint8_t code = nearest_code(&state, samples[n]);
+		int64_t diff = adpcm_next(&state, code) - samples[n];
+
+		error += diff * diff;
+		if (codes) {
+			codes[n / 2] |= n & 1 ? code << 4 : code;
+		}
+	}
+	return error;
+}
+
+int main(int argc, char *argv[]) {
+	const char *name;
+	int16_t    *samples;
+	uint8_t    *codes;
+	uint32_t    length, size;
+	uint8_t     index = 0;
+	uint64_t    error = UINT64_MAX;
+
+	program = argv[0];
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s name file.wav\n", program);
+		return 2;
+	}
+	name    = argv[1];
+	samples = wav_read(argv[2], &length);
+	size    = (length + 1) / 2;
+	codes   = calloc(size ? size : 1, 1);
+
+	for (uint8_t i = 0; i < STEP_SIZES; i++) {
+		uint64_t trial = encode(samples, length, i, NULL);
+
+		if (trial < error) {
+			index = i;
+			error = trial;
+		}
+	}
+	encode(samples, length, index, codes);
+
+	printf("\n// %s, %u samples in %u bytes\n", argv[2], length, size);
+	printf("static const uint8_t samples_%s_data[] = {", name);
+	for (uint32_t n = 0; n < size; n++) {
+		printf(n % PER_LINE ? " 0x%02x," : "\n\t0x%02x,", codes[n]);
+	}
+	printf("\n};\n\n");
+	printf("const adpcm_sound_t samples_%s = { samples_%s_data, %u, %u };\n",
+	       name, name, length, index);
+
+	fprintf(stderr, "%s: %u samples, rms error %.1f\n", argv[2], length,
+	        length ? sqrt((double) error / length) : 0.0);
+	return 0;
+}
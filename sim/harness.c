@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include "sim.h"
+
+// Runs the firmware on the simulated board and prints what it does, one line per
+// change, each starting with the virtual time in seconds:
+//
+//   0.250000012 leds 0f
+//   0.250001245 click
+//   0.001234567 lcd " 120bpm 4/4     " "                "
+//   1.000000000 serial jitter: ...
+//
+// A click is the DAC's output leaving mid-scale after it has been quiet for a while.
+//
+// Usage: metronome-sim [-t seconds] [-q] [-w file] [-b time:button[+button...][:ms]]...
+//
+//   -t  how long to run for (default 10s)
+//   -q  don't print the LED and click lines, only the summary at the end
+//   -w  write what the DAC plays to a WAV file, as 16-bit mono at 48kHz
+//   -b  press buttons at a time (in seconds) and hold them for a while (default
+//       100ms). Buttons are tap, up, down, sync, dump, sound, sig+ and sig-. Can be
+//       given as many times as needed, in time order.
+
+// The firmware's main(), renamed when it's built for the simulation, and the clock
+// set-up the startup code runs before it (see system_stm32f4xx.c)
+int  firmware_main(void);
+void SystemInit(void);
+
+#define DEFAULT_SECONDS 10.0
+#define DEFAULT_HOLD_MS 100
+
+// The DAC's mid-scale, which is silence, and how long it has to stay there before
+// the output leaving it counts as a new click (the click itself passes through it)
+#define DAC_SILENCE     2048
+#define DAC_QUIET_CYCLES (SIM_CORE_HZ / 1000)
+
+// The WAV file's sample rate, which is the firmware's (see audio.h): each sample is
+// a whole number of cycles
+#define WAV_RATE_HZ     48000
+#define WAV_CYCLES      (SIM_CORE_HZ / WAV_RATE_HZ)
+#define WAV_HEADER_SIZE 44
+
+static const struct {
+	const char *name;
+	uint8_t     mask;
+} button_names[] = {
+	{ "tap",   1 << 0 },
+	{ "up",    1 << 1 },
+	{ "down",  1 << 2 },
+	{ "sync",  1 << 3 },
+	{ "dump",  1 << 4 },
+	{ "sound", 1 << 5 },
+	{ "sig+",  1 << 6 },
+	{ "sig-",  1 << 7 },
+};
+
+static bool     quiet = false;
+static uint32_t edges = 0;
+static uint32_t beats = 0;
+// When the last beat came, and how long after the one before
+static uint64_t beat_at = 0;
+static uint64_t beat_cycles = 0;
+static uint8_t  last_pattern = 0;
+static char     line[256];
+static size_t   line_len = 0;
+
+// What the DAC's putting out and since when, and the clicks heard in it
+static uint16_t dac_value = DAC_SILENCE;
+static uint64_t dac_since = 0;
+static uint32_t clicks = 0;
+
+// The WAV file being written, and how many samples have gone into it
+static FILE    *wav = NULL;
+static uint64_t wav_samples = 0;
+
+static double seconds(uint64_t cycles) {
+	return (double) cycles / SIM_CORE_HZ;
+}
+
+static void on_leds(uint64_t cycles, uint8_t pattern) {
+	edges++;
+	if (pattern && !last_pattern) {
+		beats++;
+		beat_cycles = beats > 1 ? cycles - beat_at : 0;
+		beat_at     = cycles;
+	}
+	last_pattern = pattern;
+
+	if (!quiet) {
+		printf("%.9f leds %02x\n", seconds(cycles), pattern);
+	}
+}
+
+static void on_lcd(uint64_t cycles, const char *row0, const char *row1) {
+	printf("%.9f lcd \"%s\" \"%s\"\n", seconds(cycles), row0, row1);
+}
+
+static void on_serial(uint64_t cycles, char c) {
+	if (c == '\r') {
+		return;
+	}
+	if (c != '\n' && line_len < sizeof(line) - 1) {
+		line[line_len++] = c;
+		return;
+	}
+	line[line_len] = '\0';
+	line_len = 0;
+	printf("%.9f serial %s\n", seconds(cycles), line);
+}
+
+static void put_le(uint8_t *at, uint32_t value, int bytes) {
+	int i;
+
+	for (i = 0; i < bytes; i++) {
+		at[i] = (uint8_t) (value >> (8 * i));
+	}
+}
+
+/*
+ * Fills the WAV file up to the sample that's playing at a given time with what the
+ * DAC has been putting out. The DAC changes on a 48kHz grid of its own, which is a
+ * whole number of cycles a sample too, so every one of its samples goes in once.
+ */
+static void wav_fill(uint64_t cycles) {
+	uint8_t sample[2];
+
+	put_le(sample, (uint16_t) ((dac_value - DAC_SILENCE) * 16), 2);
+	for (; wav_samples < cycles / WAV_CYCLES; wav_samples++) {
+		fwrite(sample, sizeof(sample), 1, wav);
+	}
+}
+
+/*
+ * Writes the WAV header, for the number of samples written so far
+ */
+static void wav_header(void) {
+	uint8_t  header[WAV_HEADER_SIZE];
+	uint32_t data = (uint32_t) (wav_samples * 2);
+
+	memcpy(header, "RIFF\0\0\0\0WAVEfmt ", 16);
+	put_le(header + 4,  WAV_HEADER_SIZE - 8 + data, 4);
+	put_le(header + 16, 16, 4);              // Format chunk size
+	put_le(header + 20, 1, 2);               // PCM
+	put_le(header + 22, 1, 2);               // Mono
+	put_le(header + 24, WAV_RATE_HZ, 4);
+	put_le(header + 28, WAV_RATE_HZ * 2, 4); // Bytes a second
+	put_le(header + 32, 2, 2);               // Bytes a sample
+	put_le(header + 34, 16, 2);              // Bits a sample
+	memcpy(header + 36, "data", 4);
+	put_le(header + 40, data, 4);
+
+	fseek(wav, 0, SEEK_SET);
+	fwrite(header, sizeof(header), 1, wav);
+}
+
+static void wav_open(const char *program, const char *path) {
+	wav = fopen(path, "wb");
+	if (!wav) {
+		perror(program);
+		exit(2);
+	}
+	wav_header();
+}
+
+static void on_dac(uint64_t cycles, uint16_t value) {
+	if (wav) {
+		wav_fill(cycles);
+	}
+
+	if (dac_value == DAC_SILENCE && value != DAC_SILENCE && cycles - dac_since >= DAC_QUIET_CYCLES) {
+		clicks++;
+		if (!quiet) {
+			printf("%.9f click\n", seconds(cycles));
+		}
+	}
+	dac_value = value;
+	dac_since = cycles;
+}
+
+static void on_end(uint64_t cycles) {
+	const sim_faults_t *faults = sim_faults();
+
+	if (wav) {
+		wav_fill(cycles);
+		wav_header();
+		fclose(wav);
+	}
+
+	printf("# %.3fs: %u LED edges, %u beats", seconds(cycles), edges, beats);
+	if (beat_cycles) {
+		printf(" (the last at %.0fbpm)", 60.0 / seconds(beat_cycles));
+	}
+	printf(", %u clicks, %u LCD busy writes, %u DMA errors, %.1f%% at full speed",
+	       clicks, faults->lcd_busy_writes, faults->dma_errors, 100.0 * sim_full_speed() / cycles);
+	if (sim_stopped()) {
+		printf(", %.1f%% in STOP mode", 100.0 * sim_stopped() / cycles);
+	}
+	printf("\n");
+}
+
+static void usage(const char *program) {
+	fprintf(stderr, "usage: %s [-t seconds] [-q] [-w file] [-b time:button[+button...][:ms]]...\n", program);
+	exit(2);
+}
+
+/*
+ * The mask for a button name, or 0 if it isn't one
+ */
+static uint8_t button_mask(const char *name) {
+	size_t i;
+
+	for (i = 0; i < sizeof(button_names) / sizeof(button_names[0]); i++) {
+		if (strcmp(name, button_names[i].name) == 0) {
+			return button_names[i].mask;
+		}
+	}
+	return 0;
+}
+
+/*
+ * "sig+" has a '+' in it, so the names are split on '+' only where it's followed by
+ * a letter
+ */
+static void split_names(char *names) {
+	char *c;
+
+	for (c = names; *c; c++) {
+		if (*c == '+' && c[1] >= 'a' && c[1] <= 'z') {
+			*c = ' ';
+		}
+	}
+}
+
+static void press(const char *program, char *arg) {
+	static uint64_t last = 0;
+	char    *at_end, *names, *hold;
+	double   at = strtod(arg, &at_end);
+	long     hold_ms = DEFAULT_HOLD_MS;
+	uint64_t down, up;
+	uint8_t  mask = 0;
+	char    *name;
+
+	if (at_end == arg || *at_end != ':' || at < 0) {
+		usage(program);
+	}
+	names = at_end + 1;
+	hold  = strrchr(names, ':');
+	if (hold) {
+		*hold++ = '\0';
+		hold_ms = strtol(hold, NULL, 10);
+	}
+
+	split_names(names);
+	for (name = strtok(names, " "); name; name = strtok(NULL, " ")) {
+		uint8_t one = button_mask(name);
+		if (!one) {
+			fprintf(stderr, "%s: unknown button '%s'\n", program, name);
+			exit(2);
+		}
+		mask |= one;
+	}
+
+	down = (uint64_t) (at * SIM_CORE_HZ);
+	up   = down + (uint64_t) hold_ms * (SIM_CORE_HZ / 1000);
+	if (down < last) {
+		fprintf(stderr, "%s: button presses must be in time order and not overlap\n", program);
+		exit(2);
+	}
+	last = up;
+
+	sim_buttons_at(down, mask);
+	sim_buttons_at(up, 0);
+}
+
+int main(int argc, char **argv) {
+	static const sim_observer_t observer = { on_leds, on_lcd, on_serial, on_dac, on_end };
+	double run = DEFAULT_SECONDS;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:qw:b:")) != -1) {
+		switch (opt) {
+			case 't': run = strtod(optarg, NULL); break;
+			case 'q': quiet = true; break;
+			case 'w': wav_open(argv[0], optarg); break;
+			case 'b': press(argv[0], optarg); break;
+			default:  usage(argv[0]);
+		}
+	}
+
+	sim_init(&observer);
+	sim_run_for((uint64_t) (run * SIM_CORE_HZ));
+
+	// The clocks are set up before main(), as the startup code does on the board
+	SystemInit();
+
+	// Doesn't come back: the simulation exits when the time's up
+	firmware_main();
+	return 1;
+}
@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include "stm32f4xx.h"
+
+// Stands in for ../retarget.c, which sends the firmware's printf() output to USART2
+// through the Keil library's fputc(). The C library here can't be hooked that way, so
+// the firmware is built with printf renamed to this instead.
+
+static int sendchar(int c) {
+	while (!(USART2->SR & USART_SR_TXE));
+	return (USART2->DR = c);
+}
+
+int sim_printf(const char *format, ...) {
+	char text[256];
+	va_list args;
+	int length, i;
+
+	va_start(args, format);
+	length = vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+
+	for (i = 0; text[i]; i++) {
+		sendchar(text[i]);
+	}
+	return length;
+}
@@ -0,0 +1,2000 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "stm32f4xx.h"
+#include "sim.h"
+
+// A stand-in for the Discovery board, so the firmware can run on a PC.
+//
+// The peripheral registers are ordinary memory mapped at the same addresses as on
+// the real device, so the firmware and the peripheral library can use them just as
+// they would on the board. The device header sends every peripheral pointer through
+// sim_access() first, which is where the simulation catches up with whatever the
+// firmware wrote since the last access (reconcile), moves virtual time along,
+// updates whatever the hardware would have changed (publish), and runs any
+// interrupts that are due.
+//
+// Virtual time only moves when the firmware touches a peripheral (a few cycles each
+// time) or sleeps (straight to the next thing that would wake it), so a busy-wait
+// still finishes, and an hour of the metronome sitting at a tempo takes well under
+// a second to run.
+//
+// The parts of the board modelled are the ones the firmware uses: GPIO (with an
+// HD44780 on the LCD pins and the buttons on GPIOE), TIM2, TIM8 and TIM14, the DMA
+// streams, the DAC's channel 2 with TIM6 triggering it, USART2's transmitter, the
+// NVIC, and the DWT cycle counter.
+//
+// lcd.c writes to the GPIO registers by address rather than through the device
+// header, several times between hooks, so GPIO writes are caught individually as
+// well: the firmware's view of the GPIO ports is read-only, and each write to it
+// faults, is single-stepped with the page writable, and is then applied straight
+// away. The simulation itself writes the GPIO registers through a second, writable
+// mapping of the same memory.
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0
+#endif
+
+// How long each access to a peripheral takes, in core cycles at 168MHz. The code
+// between accesses is taken to be free. Running from the HSI or with HCLK divided
+// down, everything takes as many more cycles as it's slower.
+#define SIM_ACCESS_CYCLES 8
+
+// Accesses in a row to the same peripheral, without writing anything, before the
+// firmware's taken to be polling it (see sim_access())
+#define SIM_POLL_ACCESSES 2
+
+#define NEVER UINT64_MAX
+
+#define REG(type, base) ((type *) (uintptr_t) (base))
+
+// GPIOA-GPIOH, which are caught on every write
+#define GPIO_BASE GPIOA_BASE
+#define GPIO_SIZE 0x2000
+
+// Trap flag in EFLAGS, for single-stepping
+#define EFLAGS_TF 0x100
+
+// Cycle counter registers (the CMSIS header in Libraries/ doesn't have them)
+#define DWT_CTRL   (*(volatile uint32_t *) 0xE0001000)
+#define DWT_CYCCNT (*(volatile uint32_t *) 0xE0001004)
+
+// Written to the USART data register after each character has been taken, so
+// the next write can be seen even if it's the same character
+#define USART_DR_TAKEN 0xFFFF
+
+// Set in an unused bit of the EXTI pending register, so the firmware writing it to
+// clear lines can be seen even if it writes back just what it read
+#define EXTI_PR_SHOWN 0x80000000
+
+// LCD pins: RS, R/W and E on PB0-PB2, data on PD0-PD7
+#define LCD_RS (1 << 0)
+#define LCD_RW (1 << 1)
+#define LCD_E  (1 << 2)
+
+// HD44780 instruction times, in cycles
+#define LCD_SHORT_CYCLES (37   * SIM_CORE_HZ / 1000000)
+#define LCD_LONG_CYCLES  (1520 * SIM_CORE_HZ / 1000000)
+
+// Clock start-up times. The LSI is only specified to be somewhere between 17 and
+// 47kHz, and this one is a little slow, so anything that takes it to be 32kHz without
+// measuring it is noticeably wrong.
+#define SIM_LSI_HZ      31713ULL
+#define SIM_LSI_CYCLES  (15   * SIM_CORE_HZ / 1000000)
+#define SIM_HSE_CYCLES  (1500 * SIM_CORE_HZ / 1000000)
+#define SIM_PLL_CYCLES  (100  * SIM_CORE_HZ / 1000000)
+// Waking from STOP mode, with the main and the low-power regulator
+#define SIM_STOP_WAKE_CYCLES    (13 * SIM_CORE_HZ / 1000000)
+#define SIM_STOP_WAKE_LP_CYCLES (17 * SIM_CORE_HZ / 1000000)
+
+// The RTC's wakeup timer is on EXTI line 22
+#define EXTI_LINE_RTC_WAKEUP 22
+
+// The bus prescalers in RCC_CFGR, and the AHB prescaler as a shift for each value
+// of HPRE
+#define RCC_CFGR_BUSES (RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2)
+static const uint8_t ahb_shifts[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 3, 4, 6, 7, 8, 9 };
+
+// The RCC's PLL configuration register as it comes out of reset
+#define RCC_PLLCFGR_RESET 0x24003010
+
+// The interrupt handlers the firmware might define
+typedef void (*sim_handler_t)(void);
+#define SIM_HANDLER(name) void name(void) __attribute__((weak));
+SIM_HANDLER(RTC_WKUP_IRQHandler)
+SIM_HANDLER(EXTI0_IRQHandler)
+SIM_HANDLER(EXTI1_IRQHandler)
+SIM_HANDLER(EXTI2_IRQHandler)
+SIM_HANDLER(EXTI3_IRQHandler)
+SIM_HANDLER(EXTI4_IRQHandler)
+SIM_HANDLER(EXTI9_5_IRQHandler)
+SIM_HANDLER(EXTI15_10_IRQHandler)
+SIM_HANDLER(TIM2_IRQHandler)
+SIM_HANDLER(TIM8_UP_TIM13_IRQHandler)
+SIM_HANDLER(TIM8_CC_IRQHandler)
+SIM_HANDLER(TIM8_TRG_COM_TIM14_IRQHandler)
+SIM_HANDLER(USART2_IRQHandler)
+SIM_HANDLER(DMA1_Stream0_IRQHandler)
+SIM_HANDLER(DMA1_Stream1_IRQHandler)
+SIM_HANDLER(DMA1_Stream2_IRQHandler)
+SIM_HANDLER(DMA1_Stream3_IRQHandler)
+SIM_HANDLER(DMA1_Stream4_IRQHandler)
+SIM_HANDLER(DMA1_Stream5_IRQHandler)
+SIM_HANDLER(DMA1_Stream6_IRQHandler)
+SIM_HANDLER(DMA1_Stream7_IRQHandler)
+SIM_HANDLER(DMA2_Stream0_IRQHandler)
+SIM_HANDLER(DMA2_Stream1_IRQHandler)
+SIM_HANDLER(DMA2_Stream2_IRQHandler)
+SIM_HANDLER(DMA2_Stream3_IRQHandler)
+SIM_HANDLER(DMA2_Stream4_IRQHandler)
+SIM_HANDLER(DMA2_Stream5_IRQHandler)
+SIM_HANDLER(DMA2_Stream6_IRQHandler)
+SIM_HANDLER(DMA2_Stream7_IRQHandler)
+
+static sim_handler_t sim_vector(int irq) {
+	switch (irq) {
+		case RTC_WKUP_IRQn:           return RTC_WKUP_IRQHandler;
+		case EXTI0_IRQn:              return EXTI0_IRQHandler;
+		case EXTI1_IRQn:              return EXTI1_IRQHandler;
+		case EXTI2_IRQn:              return EXTI2_IRQHandler;
+		case EXTI3_IRQn:              return EXTI3_IRQHandler;
+		case EXTI4_IRQn:              return EXTI4_IRQHandler;
+		case EXTI9_5_IRQn:            return EXTI9_5_IRQHandler;
+		case EXTI15_10_IRQn:          return EXTI15_10_IRQHandler;
+		case TIM2_IRQn:               return TIM2_IRQHandler;
+		case TIM8_UP_TIM13_IRQn:      return TIM8_UP_TIM13_IRQHandler;
+		case TIM8_CC_IRQn:            return TIM8_CC_IRQHandler;
+		case TIM8_TRG_COM_TIM14_IRQn: return TIM8_TRG_COM_TIM14_IRQHandler;
+		case USART2_IRQn:             return USART2_IRQHandler;
+		case DMA1_Stream0_IRQn:       return DMA1_Stream0_IRQHandler;
+		case DMA1_Stream1_IRQn:       return DMA1_Stream1_IRQHandler;
+		case DMA1_Stream2_IRQn:       return DMA1_Stream2_IRQHandler;
+		case DMA1_Stream3_IRQn:       return DMA1_Stream3_IRQHandler;
+		case DMA1_Stream4_IRQn:       return DMA1_Stream4_IRQHandler;
+		case DMA1_Stream5_IRQn:       return DMA1_Stream5_IRQHandler;
+		case DMA1_Stream6_IRQn:       return DMA1_Stream6_IRQHandler;
+		case DMA1_Stream7_IRQn:       return DMA1_Stream7_IRQHandler;
+		case DMA2_Stream0_IRQn:       return DMA2_Stream0_IRQHandler;
+		case DMA2_Stream1_IRQn:       return DMA2_Stream1_IRQHandler;
+		case DMA2_Stream2_IRQn:       return DMA2_Stream2_IRQHandler;
+		case DMA2_Stream3_IRQn:       return DMA2_Stream3_IRQHandler;
+		case DMA2_Stream4_IRQn:       return DMA2_Stream4_IRQHandler;
+		case DMA2_Stream5_IRQn:       return DMA2_Stream5_IRQHandler;
+		case DMA2_Stream6_IRQn:       return DMA2_Stream6_IRQHandler;
+		case DMA2_Stream7_IRQn:       return DMA2_Stream7_IRQHandler;
+		default:                      return NULL;
+	}
+}
+
+// A general-purpose/advanced timer, counting up
+typedef struct {
+	uint32_t   base;
+	uint32_t   max;        // Largest value the counter can hold
+	IRQn_Type  irq_up;     // Interrupt for updates
+	IRQn_Type  irq_cc;     // Interrupt for the compare channels
+	IRQn_Type  irq_trg;    // Interrupt for the trigger
+	uint32_t   up_stream;  // DMA stream and channel the update request goes to
+	uint32_t   up_channel;
+	uint32_t   cc1_stream; // And channel 1's compare request
+	uint32_t   cc1_channel;
+	uint32_t   trg_stream; // And the trigger's
+	uint32_t   trg_channel;
+
+	bool       running;
+	uint64_t   since;      // Time the counter last moved on (while running)
+	uint32_t   cnt;        // Counter at that time (or now, while stopped)
+	uint64_t   phase;      // How far into the current count it was stopped
+	uint64_t   tick;       // Cycles per count
+	uint16_t   sr;         // Status flags
+	uint32_t   cnt_pub;    // Counter as last shown to the firmware
+} sim_timer_t;
+
+// A DMA stream
+typedef struct {
+	bool       on;
+	uint32_t   count;      // Items per pass (what NDTR was when it was enabled)
+	uint32_t   left;       // Items left in this pass
+	uint32_t   item;       // Item the next transfer is
+} sim_stream_t;
+
+// Something the test is going to do: change the buttons, or call into the firmware
+typedef struct {
+	uint64_t   at;
+	uint8_t    buttons;
+	void     (*call)(void);
+} sim_input_t;
+
+static sim_observer_t observer;
+static sim_faults_t   faults;
+
+// Virtual time, and when to stop
+static uint64_t now = 0;
+static uint64_t end = NEVER;
+// Time spent asleep with the core clock stopped (which the cycle counter misses), and
+// how much of that was in STOP mode
+static uint64_t asleep = 0;
+static uint64_t stopped = 0;
+
+// Whether the firmware has written to anything since the last access, and how many
+// accesses in a row it has made to the same peripheral from the same place without
+// writing anything
+static bool     written = false;
+static uint32_t poll_base = 0;
+static void    *poll_from = NULL;
+static uint32_t poll_count = 0;
+
+// Interrupts masked (PRIMASK), and the preemption level of what's running now
+static bool     masked = false;
+static int      active_level = INT_MAX;
+static uint32_t nvic_enabled[3];
+
+static sim_timer_t timers[] = {
+	{ TIM2_BASE,  0xFFFFFFFF, TIM2_IRQn,               TIM2_IRQn,               TIM2_IRQn,
+	  DMA1_Stream1_BASE, 3, DMA1_Stream5_BASE, 3, 0,                 0 },
+	{ TIM8_BASE,  0xFFFF,     TIM8_UP_TIM13_IRQn,      TIM8_CC_IRQn,            TIM8_TRG_COM_TIM14_IRQn,
+	  DMA2_Stream1_BASE, 7, DMA2_Stream2_BASE, 7, DMA2_Stream7_BASE, 7 },
+	{ TIM14_BASE, 0xFFFF,     TIM8_TRG_COM_TIM14_IRQn, TIM8_TRG_COM_TIM14_IRQn, TIM8_TRG_COM_TIM14_IRQn,
+	  0,                 0, 0,                 0, 0,                 0 },
+};
+#define SIM_TIMERS (sizeof(timers) / sizeof(timers[0]))
+
+static sim_stream_t streams[2][8];
+
+// GPIO output latches as last seen, and what's on the button pins
+static uint16_t odr_seen[5];
+static uint16_t buttons = 0;
+
+// EXTI lines waiting to be handled
+static uint32_t exti_pending = 0;
+static const IRQn_Type exti_irqs[16] = {
+	EXTI0_IRQn, EXTI1_IRQn, EXTI2_IRQn, EXTI3_IRQn, EXTI4_IRQn,
+	EXTI9_5_IRQn, EXTI9_5_IRQn, EXTI9_5_IRQn, EXTI9_5_IRQn, EXTI9_5_IRQn,
+	EXTI15_10_IRQn, EXTI15_10_IRQn, EXTI15_10_IRQn, EXTI15_10_IRQn, EXTI15_10_IRQn, EXTI15_10_IRQn
+};
+
+static sim_input_t inputs[256];
+static size_t      inputs_num = 0;
+static size_t      inputs_next = 0;
+// Call that's due, which runs like an interrupt above all the others
+static void      (*call_pending)(void) = NULL;
+
+// When the HSE, the PLL and the LSI are ready (NEVER while they're off), and whether
+// the system clock is the PLL. Everything starts as it comes out of reset, running
+// from the HSI, until SystemInit() sets the clocks up.
+static uint64_t hse_ready = NEVER;
+static uint64_t pll_ready = NEVER;
+static uint64_t lsi_ready = NEVER;
+static bool     on_pll = false;
+
+// The bus prescalers in effect, and the time spent with HCLK at the full 168MHz
+// (up to when it last changed)
+static uint32_t bus_cfgr;
+static uint64_t full_speed = 0;
+static uint64_t full_speed_since = 0;
+
+// RTC, counting LSI ticks from when it last started, and its wakeup timer
+static bool     rtc_running = false;
+static uint64_t rtc_since = 0;
+static bool     rtc_wakeup_on = false;
+static uint64_t rtc_wakeup_at = NEVER;
+static bool     rtc_wakeup_flag = false;
+static uint32_t rtc_isr_pub = 0;
+
+// TIM6, counting out the DAC's triggers: when the last one was (or, while it's
+// stopped, how far it had got towards the next), and how far apart they are. And
+// the DAC's channel 2 output.
+static bool     dac_timing = false;
+static uint64_t dac_since = 0;
+static uint64_t dac_phase = 0;
+static uint64_t dac_period = 1;
+static uint32_t dac_cnt_pub = 0;
+static uint16_t dac_output = 0;
+
+// Cycle counter
+static bool     dwt_on = false;
+static uint32_t dwt_value = 0;
+static uint64_t dwt_since = 0;
+static uint32_t dwt_pub = 0;
+
+// HD44780. The display RAM is kept as the controller has it in two-line mode: the
+// first row from 0x00 and the second from 0x40.
+static uint8_t  lcd_ddram[0x80];
+static uint8_t  lcd_cgram[0x40];
+static uint8_t  lcd_ac = 0;
+static bool     lcd_cg = false;
+static uint64_t lcd_busy_until = 0;
+static bool     lcd_changed = false;
+static char     lcd_shown[2][17];
+
+// Writable mapping of the GPIO registers
+static uint8_t *gpio_alias;
+
+static void sim_reconcile(void);
+static void sim_publish(void);
+static void sim_dispatch(void);
+static void gpio_reconcile(void);
+static void *sim_writable(uint32_t address);
+
+static void sim_fatal(const char *message, int value) {
+	fprintf(stderr, "sim: %.9fs: ", (double) now / SIM_CORE_HZ);
+	fprintf(stderr, message, value);
+	fprintf(stderr, "\n");
+	exit(2);
+}
+
+static void sim_finish(void) {
+	if (observer.end) {
+		observer.end(now);
+	}
+	// Unless it's been given more time
+	if (end > now) {
+		return;
+	}
+	fflush(stdout);
+	exit(0);
+}
+
+/* Timers */
+
+static TIM_TypeDef *timer_regs(const sim_timer_t *t) {
+	return REG(TIM_TypeDef, t->base);
+}
+
+/*
+ * Cycles per timer clock with the given bus prescalers. The timers run at twice
+ * their bus clock whenever the bus is divided down from HCLK.
+ */
+static uint32_t timer_div_for(uint32_t base, uint32_t cfgr) {
+	uint32_t ppre = base >= APB2PERIPH_BASE ? (cfgr >> 13) & 7 : (cfgr >> 10) & 7;
+
+	return (ppre < 4 ? 1 : 1 << (ppre - 4)) << ahb_shifts[(cfgr & RCC_CFGR_HPRE) >> 4];
+}
+
+static uint32_t timer_div(const sim_timer_t *t) {
+	return timer_div_for(t->base, bus_cfgr);
+}
+
+static uint32_t timer_count(const sim_timer_t *t) {
+	if (!t->running) {
+		return t->cnt;
+	}
+	return t->cnt + (uint32_t) ((now - t->since) / t->tick);
+}
+
+static uint32_t timer_ccr(const sim_timer_t *t, int channel) {
+	const volatile uint32_t *ccr = &timer_regs(t)->CCR1;
+	return ccr[channel] & t->max;
+}
+
+/*
+ * Largest value the counter reaches before it goes back to zero: the reload value,
+ * unless the counter has been put past it, in which case it runs to the top first.
+ */
+static uint32_t timer_top(const sim_timer_t *t, uint32_t count) {
+	uint32_t arr = timer_regs(t)->ARR & t->max;
+	return count <= arr ? arr : t->max;
+}
+
+/*
+ * Time the counter next does something: goes back to zero or matches a compare channel
+ */
+static uint64_t timer_next(const sim_timer_t *t) {
+	uint32_t count, top;
+	uint64_t counts;
+	int channel;
+
+	if (!t->running) {
+		return NEVER;
+	}
+
+	count  = timer_count(t);
+	top    = timer_top(t, count);
+	counts = (uint64_t) top - count + 1;
+	for (channel = 0; channel < 4; channel++) {
+		uint32_t ccr = timer_ccr(t, channel);
+		if (ccr > count && ccr <= top && ccr - count < counts) {
+			counts = ccr - count;
+		}
+	}
+
+	return t->since + ((uint64_t) (count - t->cnt) + counts) * t->tick;
+}
+
+static void dma_request(uint32_t stream_base, uint32_t channel);
+static void timer_trigger(sim_timer_t *t);
+static bool timer_triggered(const sim_timer_t *t);
+
+/*
+ * An update event: the status flag, the prescaler taking its new value, the DMA
+ * request, and in one-pulse mode, stopping
+ */
+static void timer_update(sim_timer_t *t) {
+	TIM_TypeDef *regs = timer_regs(t);
+
+	t->sr  |= TIM_SR_UIF;
+	t->tick = (uint64_t) (regs->PSC + 1) * timer_div(t);
+
+	if (regs->CR1 & TIM_CR1_OPM) {
+		regs->CR1 &= ~TIM_CR1_CEN;
+		t->running = false;
+		t->phase   = 0;
+	}
+
+	if (regs->DIER & TIM_DIER_UDE) {
+		dma_request(t->up_stream, t->up_channel);
+	}
+}
+
+/*
+ * A compare channel has matched (or been made to by software): the status flag, and
+ * channel 1's DMA request. TIM2's TRGO can also pulse on channel 1, which triggers
+ * whatever has it as its trigger input.
+ */
+static void timer_compare(sim_timer_t *t, int channel) {
+	TIM_TypeDef *regs = timer_regs(t);
+	size_t i;
+
+	t->sr |= TIM_SR_CC1IF << channel;
+
+	if (channel == 0 && (regs->DIER & TIM_DIER_CC1DE)) {
+		dma_request(t->cc1_stream, t->cc1_channel);
+	}
+
+	if (channel == 0 && t->base == TIM2_BASE && (regs->CR2 & TIM_CR2_MMS) == (TIM_CR2_MMS_1 | TIM_CR2_MMS_0)) {
+		for (i = 0; i < SIM_TIMERS; i++) {
+			if (timer_triggered(&timers[i])) {
+				timer_trigger(&timers[i]);
+			}
+		}
+	}
+}
+
+/*
+ * A timer's trigger input has had a rising edge: the status flag, the DMA request,
+ * and (in trigger mode, the only one modelled) the counter being started
+ */
+static void timer_trigger(sim_timer_t *t) {
+	TIM_TypeDef *regs = timer_regs(t);
+
+	t->sr     |= TIM_SR_TIF;
+	regs->CR1 |= TIM_CR1_CEN;
+
+	if (regs->DIER & TIM_DIER_TDE) {
+		dma_request(t->trg_stream, t->trg_channel);
+	}
+}
+
+/*
+ * Whatever the counter does next is happening now
+ */
+static void timer_event(sim_timer_t *t) {
+	uint32_t top   = timer_top(t, t->cnt);
+	uint64_t count = (uint64_t) t->cnt + (now - t->since) / t->tick;
+	bool     wrap  = count > top;
+	bool     update = wrap && top == (timer_regs(t)->ARR & t->max);
+	int channel;
+
+	t->since = now;
+	t->cnt   = wrap ? 0 : (uint32_t) count;
+
+	for (channel = 0; channel < 4; channel++) {
+		if (timer_ccr(t, channel) == t->cnt) {
+			timer_compare(t, channel);
+		}
+	}
+
+	if (update) {
+		timer_update(t);
+	}
+}
+
+/*
+ * The bus prescalers are about to change: the timer carries on from the same point
+ * in its count, and its prescaler from the same point in its own, just on a
+ * different clock
+ */
+static void timer_rescale(sim_timer_t *t, uint32_t cfgr) {
+	uint32_t was = timer_div(t);
+	uint32_t div = timer_div_for(t->base, cfgr);
+
+	if (t->running) {
+		t->cnt   = timer_count(t);
+		t->phase = (now - t->since) % t->tick;
+	}
+	t->tick  = t->tick / was * div;
+	t->phase = t->phase / was * div;
+	if (t->running) {
+		t->since = now - t->phase;
+	}
+}
+
+/*
+ * Whether a timer is triggered by TIM2. The only slave mode modelled is TIM8 in
+ * trigger mode on ITR1 (which is TIM2's TRGO), with TIM2's TRGO pulsing on channel
+ * 1's compares.
+ */
+static bool timer_triggered(const sim_timer_t *t) {
+	TIM_TypeDef *regs = timer_regs(t);
+	TIM_TypeDef *tim2 = REG(TIM_TypeDef, TIM2_BASE);
+
+	if ((regs->SMCR & TIM_SMCR_SMS) == 0) {
+		return false;
+	}
+	if (t->base != TIM8_BASE || (regs->SMCR & TIM_SMCR_SMS) != (TIM_SMCR_SMS_2 | TIM_SMCR_SMS_1) ||
+	    (regs->SMCR & TIM_SMCR_TS) != TIM_SMCR_TS_0) {
+		sim_fatal("that slave mode isn't modelled (SMCR %#x)", regs->SMCR);
+	}
+	if ((tim2->CR2 & TIM_CR2_MMS) != (TIM_CR2_MMS_1 | TIM_CR2_MMS_0)) {
+		sim_fatal("TIM8 is triggered by TIM2's TRGO, which isn't channel 1's compare pulse (CR2 %#x)", tim2->CR2);
+	}
+	return true;
+}
+
+static void timer_reconcile(sim_timer_t *t) {
+	TIM_TypeDef *regs = timer_regs(t);
+	bool enabled = (regs->CR1 & TIM_CR1_CEN) != 0 && on_pll;
+
+	// Status flags are cleared by writing zero to them, and writing one does nothing
+	if (regs->SR != t->sr) {
+		t->sr  &= regs->SR;
+		written = true;
+	}
+
+	// Writing the counter doesn't upset the prescaler
+	if (regs->CNT != t->cnt_pub) {
+		written = true;
+		if (t->running) {
+			t->phase = (now - t->since) % t->tick;
+			t->since = now - t->phase;
+		}
+		t->cnt = regs->CNT & t->max;
+	}
+
+	if (enabled != t->running) {
+		written = true;
+	}
+	if (enabled && !t->running) {
+		t->running = true;
+		t->since   = now - t->phase;
+	} else if (!enabled && t->running) {
+		t->cnt     = timer_count(t);
+		t->phase   = (now - t->since) % t->tick;
+		t->running = false;
+	}
+
+	// Events generated by software (the compare and trigger flags are in the same
+	// places as the event bits)
+	if (regs->EGR) {
+		uint16_t egr = regs->EGR;
+		int channel;
+
+		regs->EGR = 0;
+		written   = true;
+
+		if (egr & TIM_EGR_UG) {
+			t->cnt   = 0;
+			t->phase = 0;
+			t->since = now;
+			if (regs->CR1 & TIM_CR1_URS) {
+				t->tick = (uint64_t) (regs->PSC + 1) * timer_div(t);
+			} else {
+				timer_update(t);
+			}
+		}
+		for (channel = 0; channel < 4; channel++) {
+			if (egr & (TIM_EGR_CC1G << channel)) {
+				timer_compare(t, channel);
+			}
+		}
+		t->sr |= egr & TIM_EGR_TG;
+	}
+}
+
+static void timer_publish(sim_timer_t *t) {
+	TIM_TypeDef *regs = timer_regs(t);
+
+	regs->SR  = t->sr;
+	regs->CNT = t->cnt_pub = timer_count(t);
+}
+
+static bool timer_irq(const sim_timer_t *t, int irq) {
+	uint16_t pending = t->sr & timer_regs(t)->DIER;
+
+	if (irq == t->irq_up && (pending & TIM_SR_UIF)) {
+		return true;
+	}
+	if (irq == t->irq_trg && (pending & TIM_SR_TIF)) {
+		return true;
+	}
+	return irq == t->irq_cc &&
+	       (pending & (TIM_SR_CC1IF | TIM_SR_CC2IF | TIM_SR_CC3IF | TIM_SR_CC4IF)) != 0;
+}
+
+/* DMA */
+
+static const uint8_t dma_flag_shift[4] = { 0, 6, 16, 22 };
+static const IRQn_Type dma_irqs[2][8] = {
+	{ DMA1_Stream0_IRQn, DMA1_Stream1_IRQn, DMA1_Stream2_IRQn, DMA1_Stream3_IRQn,
+	  DMA1_Stream4_IRQn, DMA1_Stream5_IRQn, DMA1_Stream6_IRQn, DMA1_Stream7_IRQn },
+	{ DMA2_Stream0_IRQn, DMA2_Stream1_IRQn, DMA2_Stream2_IRQn, DMA2_Stream3_IRQn,
+	  DMA2_Stream4_IRQn, DMA2_Stream5_IRQn, DMA2_Stream6_IRQn, DMA2_Stream7_IRQn },
+};
+
+static DMA_TypeDef *dma_regs(int dma) {
+	return REG(DMA_TypeDef, dma ? DMA2_BASE : DMA1_BASE);
+}
+
+static DMA_Stream_TypeDef *stream_regs(int dma, int stream) {
+	return REG(DMA_Stream_TypeDef, (dma ? DMA2_BASE : DMA1_BASE) + 0x10 + 0x18 * stream);
+}
+
+/*
+ * Flags for a stream, in the positions stream 0's are in
+ */
+static uint32_t dma_flags(int dma, int stream) {
+	DMA_TypeDef *regs = dma_regs(dma);
+	uint32_t isr = stream < 4 ? regs->LISR : regs->HISR;
+	return (isr >> dma_flag_shift[stream % 4]) & 0x3D;
+}
+
+static void dma_flag(int dma, int stream, uint32_t flag) {
+	DMA_TypeDef *regs = dma_regs(dma);
+
+	if (stream < 4) {
+		regs->LISR |= flag << dma_flag_shift[stream];
+	} else {
+		regs->HISR |= flag << dma_flag_shift[stream - 4];
+	}
+}
+
+static void dma_reconcile(void) {
+	int dma, stream;
+
+	for (dma = 0; dma < 2; dma++) {
+		DMA_TypeDef *regs = dma_regs(dma);
+
+		if (regs->LIFCR || regs->HIFCR) {
+			written = true;
+		}
+		regs->LISR &= ~regs->LIFCR;
+		regs->HISR &= ~regs->HIFCR;
+		regs->LIFCR = 0;
+		regs->HIFCR = 0;
+
+		for (stream = 0; stream < 8; stream++) {
+			sim_stream_t       *s = &streams[dma][stream];
+			DMA_Stream_TypeDef *sregs = stream_regs(dma, stream);
+			bool enabled = (sregs->CR & DMA_SxCR_EN) != 0;
+
+			if (enabled != s->on) {
+				written = true;
+			}
+			if (enabled && !s->on) {
+				if (sregs->NDTR == 0) {
+					sregs->CR &= ~DMA_SxCR_EN;
+					continue;
+				}
+				s->on    = true;
+				s->count = s->left = sregs->NDTR & 0xFFFF;
+				s->item  = 0;
+			} else if (!enabled && s->on) {
+				// Stopping a stream part-way counts as the transfer completing
+				s->on = false;
+				dma_flag(dma, stream, DMA_LISR_TCIF0);
+			}
+		}
+	}
+}
+
+static void dma_publish(void) {
+	int dma, stream;
+
+	for (dma = 0; dma < 2; dma++) {
+		for (stream = 0; stream < 8; stream++) {
+			if (streams[dma][stream].on) {
+				stream_regs(dma, stream)->NDTR = streams[dma][stream].left;
+			}
+		}
+	}
+}
+
+/*
+ * A peripheral has asked a stream for a transfer. It only goes ahead if the stream
+ * is enabled and listening to that peripheral's channel.
+ */
+static void dma_request(uint32_t stream_base, uint32_t channel) {
+	int dma, stream;
+	sim_stream_t *s;
+	DMA_Stream_TypeDef *regs;
+	uint32_t cr, psize, msize, mem, periph, src, dst;
+
+	if (stream_base == 0) {
+		return;
+	}
+
+	dma    = stream_base >= DMA2_BASE;
+	stream = (stream_base - (dma ? DMA2_BASE : DMA1_BASE) - 0x10) / 0x18;
+	s      = &streams[dma][stream];
+	regs   = stream_regs(dma, stream);
+	cr     = regs->CR;
+
+	if (!s->on || ((cr & DMA_SxCR_CHSEL) >> 25) != channel) {
+		return;
+	}
+
+	psize  = 1 << ((cr & DMA_SxCR_PSIZE) >> 11);
+	msize  = 1 << ((cr & DMA_SxCR_MSIZE) >> 13);
+	mem    = ((cr & DMA_SxCR_CT) ? regs->M1AR : regs->M0AR) + ((cr & DMA_SxCR_MINC) ? s->item * msize : 0);
+	periph = regs->PAR + ((cr & DMA_SxCR_PINC) ? s->item * psize : 0);
+
+	// DMA1's peripheral port isn't connected to AHB1, where the GPIO ports are
+	if (dma == 0 && periph >= AHB1PERIPH_BASE && periph < AHB2PERIPH_BASE) {
+		faults.dma_errors++;
+		dma_flag(dma, stream, DMA_LISR_TEIF0);
+		regs->CR &= ~DMA_SxCR_EN;
+		s->on = false;
+		return;
+	}
+
+	if ((cr & DMA_SxCR_DIR) == DMA_SxCR_DIR_0) {
+		src = mem;
+		dst = periph;
+	} else {
+		src = periph;
+		dst = mem;
+	}
+	memcpy(sim_writable(dst), (const void *) (uintptr_t) src, psize);
+	gpio_reconcile();
+
+	s->item++;
+	if (--s->left == s->count / 2) {
+		dma_flag(dma, stream, DMA_LISR_HTIF0);
+	}
+	if (s->left == 0) {
+		dma_flag(dma, stream, DMA_LISR_TCIF0);
+		if (cr & (DMA_SxCR_CIRC | DMA_SxCR_DBM)) {
+			s->left = s->count;
+			s->item = 0;
+			if (cr & DMA_SxCR_DBM) {
+				regs->CR ^= DMA_SxCR_CT;
+			}
+		} else {
+			s->on = false;
+			regs->CR &= ~DMA_SxCR_EN;
+		}
+	}
+}
+
+static bool dma_irq(int dma, int stream) {
+	uint32_t cr    = stream_regs(dma, stream)->CR;
+	uint32_t flags = dma_flags(dma, stream);
+
+	return ((flags & DMA_LISR_TCIF0) && (cr & DMA_SxCR_TCIE)) ||
+	       ((flags & DMA_LISR_HTIF0) && (cr & DMA_SxCR_HTIE)) ||
+	       ((flags & DMA_LISR_TEIF0) && (cr & DMA_SxCR_TEIE));
+}
+
+/* DAC */
+
+// TIM6 is only modelled as far as it triggers the DAC, which is all the firmware
+// uses it for. The triggers aren't events of their own, as there would be tens of
+// thousands a second of them while the DAC's playing: they're caught up with each
+// time virtual time moves along (see dac_catch_up()), and only the ones that bring
+// the DAC's DMA stream half-way or all the way through its buffer, and so can raise
+// an interrupt, are events (see dac_next()).
+//
+// Only channel 2 and its right-aligned 12-bit holding register are modelled.
+
+// TSEL2 for TIM6's TRGO, and for the software trigger
+#define DAC_TSEL_TIM6     0
+#define DAC_TSEL_SOFTWARE 7
+
+static DAC_TypeDef *dac_regs(void) {
+	return REG(DAC_TypeDef, DAC_BASE);
+}
+
+static TIM_TypeDef *dac_timer_regs(void) {
+	return REG(TIM_TypeDef, TIM6_BASE);
+}
+
+/*
+ * Whether channel 2 is on and takes its data when a given trigger says
+ */
+static bool dac_triggered_by(uint32_t tsel) {
+	uint32_t cr = dac_regs()->CR;
+
+	return (cr & DAC_CR_EN2) && (cr & DAC_CR_TEN2) && ((cr & DAC_CR_TSEL2) >> 19) == tsel;
+}
+
+/*
+ * Whether TIM6's updates go out as triggers, to a channel that's listening for them
+ */
+static bool dac_timer_triggers(void) {
+	return (dac_timer_regs()->CR2 & TIM_CR2_MMS) == TIM_CR2_MMS_1 && dac_triggered_by(DAC_TSEL_TIM6);
+}
+
+static void dac_set(uint64_t at, uint32_t value) {
+	value &= 0xFFF;
+	dac_regs()->DOR2 = value;
+
+	if (value != dac_output) {
+		dac_output = value;
+		if (observer.dac) {
+			observer.dac(at, value);
+		}
+	}
+}
+
+/*
+ * A trigger from TIM6: the holding register goes to the output, and with DMA on,
+ * the DMA is asked for the next value
+ */
+static void dac_trigger(uint64_t at) {
+	dac_set(at, dac_regs()->DHR12R2);
+	if (dac_regs()->CR & DAC_CR_DMAEN2) {
+		dma_request(DMA1_Stream6_BASE, 7);
+	}
+}
+
+/*
+ * Plays the triggers TIM6 has made since it was last looked at
+ */
+static void dac_catch_up(void) {
+	if (!dac_timing) {
+		return;
+	}
+	while (dac_since + dac_period <= now) {
+		dac_since += dac_period;
+		if (dac_timer_triggers()) {
+			dac_trigger(dac_since);
+		}
+	}
+}
+
+/*
+ * Time of the next trigger that brings the DMA stream half-way or all the way through
+ * its buffer
+ */
+static uint64_t dac_next(void) {
+	const sim_stream_t *s = &streams[0][6];
+	uint32_t requests;
+
+	if (!dac_timing || !s->on || !dac_timer_triggers() || !(dac_regs()->CR & DAC_CR_DMAEN2)) {
+		return NEVER;
+	}
+	requests = s->left > s->count / 2 ? s->left - s->count / 2 : s->left;
+	return dac_since + (uint64_t) requests * dac_period;
+}
+
+/*
+ * The bus prescalers are about to change, as for timer_rescale()
+ */
+static void dac_rescale(uint32_t cfgr) {
+	uint32_t was = timer_div_for(TIM6_BASE, bus_cfgr);
+	uint32_t div = timer_div_for(TIM6_BASE, cfgr);
+
+	if (dac_timing) {
+		dac_phase = now - dac_since;
+	}
+	dac_phase  = dac_phase / was * div;
+	dac_period = dac_period / was * div;
+	if (dac_timing) {
+		dac_since = now - dac_phase;
+	}
+}
+
+/*
+ * Cycles per count of TIM6
+ */
+static uint64_t dac_tick(void) {
+	return (uint64_t) (dac_timer_regs()->PSC + 1) * timer_div_for(TIM6_BASE, bus_cfgr);
+}
+
+static void dac_reconcile(void) {
+	DAC_TypeDef *regs = dac_regs();
+	TIM_TypeDef *timer = dac_timer_regs();
+	bool enabled = (timer->CR1 & TIM_CR1_CEN) != 0 && on_pll;
+
+	dac_period = dac_tick() * ((timer->ARR & 0xFFFF) + 1);
+
+	if (timer->CNT != dac_cnt_pub) {
+		uint64_t counted = (uint64_t) (timer->CNT & 0xFFFF) * dac_tick();
+
+		written = true;
+		if (dac_timing) {
+			dac_since = now - counted;
+		} else {
+			dac_phase = counted;
+		}
+	}
+
+	if (enabled != dac_timing) {
+		written = true;
+		if (enabled) {
+			dac_since = now - dac_phase;
+		} else {
+			dac_phase = now - dac_since;
+		}
+		dac_timing = enabled;
+	}
+
+	// Generating an update starts the count again, and is a trigger itself
+	if (timer->EGR) {
+		uint16_t egr = timer->EGR;
+		timer->EGR = 0;
+		written    = true;
+
+		if (egr & TIM_EGR_UG) {
+			dac_since = now;
+			dac_phase = 0;
+			if (dac_timer_triggers()) {
+				dac_trigger(now);
+			}
+		}
+	}
+
+	if (regs->SWTRIGR & DAC_SWTRIGR_SWTRIG2) {
+		regs->SWTRIGR &= ~DAC_SWTRIGR_SWTRIG2;
+		written = true;
+		if (dac_triggered_by(DAC_TSEL_SOFTWARE)) {
+			dac_set(now, regs->DHR12R2);
+		}
+	}
+
+	// Without a trigger the holding register goes straight to the output
+	if ((regs->CR & (DAC_CR_EN2 | DAC_CR_TEN2)) == DAC_CR_EN2 && (regs->DHR12R2 & 0xFFF) != dac_output) {
+		written = true;
+		dac_set(now, regs->DHR12R2);
+	}
+}
+
+static void dac_publish(void) {
+	TIM_TypeDef *timer = dac_timer_regs();
+
+	timer->CNT = dac_cnt_pub = (dac_timing ? now - dac_since : dac_phase) / dac_tick();
+}
+
+/* LCD */
+
+/*
+ * The address counter moves on through the first row's 40 characters into the second
+ * row's, and back around
+ */
+static uint8_t lcd_next(uint8_t ac) {
+	if (ac == 0x27) return 0x40;
+	if (ac == 0x67) return 0x00;
+	return (ac + 1) & 0x7F;
+}
+
+/*
+ * The LCD has seen a falling edge on E, so takes whatever's on the data lines
+ */
+static void lcd_latch(bool rs, uint8_t data) {
+	if (now < lcd_busy_until) {
+		faults.lcd_busy_writes++;
+	}
+	lcd_busy_until = now + LCD_SHORT_CYCLES;
+
+	if (rs) {
+		if (lcd_cg) {
+			lcd_cgram[lcd_ac & 0x3F] = data;
+			lcd_ac = (lcd_ac + 1) & 0x3F;
+		} else {
+			lcd_ddram[lcd_ac] = data;
+			lcd_ac = lcd_next(lcd_ac);
+		}
+		lcd_changed = true;
+	} else if (data & 0x80) {
+		// lcd_move() puts the second row at 0x28, which the LCDs on the lab boards
+		// take as the start of the second row along with 0x40
+		lcd_ac = data & 0x7F;
+		if (lcd_ac >= 0x28 && lcd_ac < 0x40) {
+			lcd_ac += 0x18;
+		}
+		lcd_cg = false;
+	} else if (data & 0x40) {
+		lcd_ac = data & 0x3F;
+		lcd_cg = true;
+	} else if (data == 0x01) {
+		memset(lcd_ddram, ' ', sizeof(lcd_ddram));
+		lcd_ac = 0;
+		lcd_cg = false;
+		lcd_changed = true;
+		lcd_busy_until = now + LCD_LONG_CYCLES;
+	} else if ((data & 0xFE) == 0x02) {
+		lcd_ac = 0;
+		lcd_cg = false;
+		lcd_busy_until = now + LCD_LONG_CYCLES;
+	}
+}
+
+/*
+ * What the LCD puts on the data lines when it's read: the busy flag and the address
+ */
+static uint8_t lcd_status(void) {
+	return (now < lcd_busy_until ? 0x80 : 0x00) | (lcd_ac & 0x7F);
+}
+
+static void lcd_row(int row, char *text) {
+	int column;
+
+	for (column = 0; column < 16; column++) {
+		uint8_t c = lcd_ddram[(row ? 0x40 : 0x00) + column];
+		// Custom characters (0-7, or the same again at 8-15) show as their numbers
+		if (c >= 0x20 && c < 0x7F) {
+			text[column] = c;
+		} else if (c < 16) {
+			text[column] = '0' + (c & 7);
+		} else {
+			text[column] = c == 0xFF ? '#' : '?';
+		}
+	}
+	text[16] = '\0';
+}
+
+/*
+ * Tells the observer what's on the LCD, if that's changed since last time
+ */
+static void lcd_report(void) {
+	char rows[2][17];
+
+	if (!lcd_changed) {
+		return;
+	}
+	lcd_changed = false;
+
+	lcd_row(0, rows[0]);
+	lcd_row(1, rows[1]);
+	if (memcmp(rows, lcd_shown, sizeof(rows)) == 0) {
+		return;
+	}
+	memcpy(lcd_shown, rows, sizeof(rows));
+
+	if (observer.lcd) {
+		observer.lcd(now, rows[0], rows[1]);
+	}
+}
+
+/* GPIO */
+
+static GPIO_TypeDef *gpio_regs(int port) {
+	return (GPIO_TypeDef *) (gpio_alias + 0x400 * port);
+}
+
+/*
+ * Where the simulation should write a register, which for GPIO is the alias
+ */
+static void *sim_writable(uint32_t address) {
+	if (address >= GPIO_BASE && address < GPIO_BASE + GPIO_SIZE) {
+		return gpio_alias + (address - GPIO_BASE);
+	}
+	return (void *) (uintptr_t) address;
+}
+
+/*
+ * The firmware has tried to write to GPIO: let the write through, just for one
+ * instruction
+ */
+static void gpio_fault(int signal, siginfo_t *info, void *context) {
+	ucontext_t *uc = context;
+	uintptr_t address = (uintptr_t) info->si_addr;
+
+	if (address < GPIO_BASE || address >= GPIO_BASE + GPIO_SIZE) {
+		// Not one of ours, so let it crash as it would have
+		struct sigaction action = { .sa_handler = SIG_DFL };
+		sigaction(SIGSEGV, &action, NULL);
+		return;
+	}
+
+	mprotect((void *) GPIO_BASE, GPIO_SIZE, PROT_READ | PROT_WRITE);
+	uc->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF;
+}
+
+/*
+ * The write has been made, so apply it and put the protection back
+ */
+static void gpio_stepped(int signal, siginfo_t *info, void *context) {
+	ucontext_t *uc = context;
+
+	uc->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF;
+	mprotect((void *) GPIO_BASE, GPIO_SIZE, PROT_READ);
+	written = true;
+	gpio_reconcile();
+}
+
+/*
+ * Applies anything written to the set/reset registers, then looks for the beat LEDs
+ * changing and the LCD being clocked
+ */
+static void gpio_reconcile(void) {
+	uint16_t leds, lcd_control;
+	int port;
+
+	for (port = 0; port < 5; port++) {
+		GPIO_TypeDef *regs = gpio_regs(port);
+
+		// Setting wins over resetting the same pin
+		if (regs->BSRRH) {
+			regs->ODR &= ~regs->BSRRH;
+			regs->BSRRH = 0;
+		}
+		if (regs->BSRRL) {
+			regs->ODR |= regs->BSRRL;
+			regs->BSRRL = 0;
+		}
+	}
+
+	leds = gpio_regs(3)->ODR & 0xFF00;
+	if (leds != (odr_seen[3] & 0xFF00) && observer.leds) {
+		observer.leds(now, leds >> 8);
+	}
+
+	lcd_control = gpio_regs(1)->ODR;
+	if ((odr_seen[1] & LCD_E) && !(lcd_control & LCD_E) && !(lcd_control & LCD_RW)) {
+		lcd_latch(lcd_control & LCD_RS, gpio_regs(3)->ODR & 0xFF);
+	}
+
+	for (port = 0; port < 5; port++) {
+		odr_seen[port] = gpio_regs(port)->ODR;
+	}
+}
+
+static void gpio_publish(void) {
+	uint16_t lcd_control = gpio_regs(1)->ODR;
+	int port;
+
+	for (port = 0; port < 5; port++) {
+		gpio_regs(port)->IDR = gpio_regs(port)->ODR;
+	}
+
+	// The buttons are on PE8-PE15
+	gpio_regs(4)->IDR = (gpio_regs(4)->ODR & 0x00FF) | ((uint16_t) buttons << 8);
+
+	// While the LCD is being read it drives the data lines
+	if ((lcd_control & LCD_RW) && (lcd_control & LCD_E)) {
+		gpio_regs(3)->IDR = (gpio_regs(3)->ODR & 0xFF00) | lcd_status();
+	}
+}
+
+/* Clocks */
+
+/*
+ * When an oscillator will be ready: a while after it's switched on, or never while
+ * it's off
+ */
+static uint64_t clock_ready(bool on, uint64_t ready, uint64_t from, uint64_t cycles) {
+	if (!on) {
+		return NEVER;
+	}
+	return ready == NEVER ? from + cycles : ready;
+}
+
+/*
+ * Only the PLL running the core at 168MHz from the 8MHz crystal is modelled, so
+ * anything else it's set up for is an error
+ */
+static void rcc_check_pll(uint32_t pllcfgr) {
+	uint32_t m = pllcfgr & RCC_PLLCFGR_PLLM;
+	uint32_t n = (pllcfgr & RCC_PLLCFGR_PLLN) >> 6;
+	uint32_t p = (((pllcfgr & RCC_PLLCFGR_PLLP) >> 16) + 1) * 2;
+
+	if (!(pllcfgr & RCC_PLLCFGR_PLLSRC_HSE) || m == 0 || HSE_VALUE / m * n / p != SIM_CORE_HZ) {
+		sim_fatal("the PLL is set up for something other than 168MHz from the HSE (PLLCFGR %#x)",
+		          (int) pllcfgr);
+	}
+}
+
+/*
+ * The timers all run from the buses, so they're held while the system clock isn't
+ * the PLL: rather than running slowly from the HSI, which nothing in the firmware
+ * relies on, they're stopped and carry on where they were once it's back.
+ */
+static bool rcc_full_speed(void) {
+	return on_pll && (bus_cfgr & RCC_CFGR_HPRE) == RCC_CFGR_HPRE_DIV1;
+}
+
+static void rcc_reconcile(void) {
+	RCC_TypeDef *regs = REG(RCC_TypeDef, RCC_BASE);
+	uint64_t was_hse = hse_ready, was_pll = pll_ready, was_lsi = lsi_ready;
+	bool     was_full = rcc_full_speed();
+	bool     want_pll = (regs->CFGR & RCC_CFGR_SW) == RCC_CFGR_SW_PLL;
+	size_t   i;
+
+	hse_ready = clock_ready(regs->CR & RCC_CR_HSEON, hse_ready, now, SIM_HSE_CYCLES);
+	// The PLL only starts to lock once the HSE it runs from is going
+	pll_ready = clock_ready((regs->CR & RCC_CR_PLLON) && hse_ready != NEVER, pll_ready,
+	                        hse_ready > now ? hse_ready : now, SIM_PLL_CYCLES);
+	lsi_ready = clock_ready(regs->CSR & RCC_CSR_LSION, lsi_ready, now, SIM_LSI_CYCLES);
+	if (hse_ready != was_hse || pll_ready != was_pll || lsi_ready != was_lsi) {
+		written = true;
+	}
+
+	// Switching to the PLL before it's ready isn't modelled: it's taken to happen
+	// once it's ready and the firmware next looks
+	if (want_pll != on_pll && (!want_pll || now >= pll_ready)) {
+		if (want_pll) {
+			rcc_check_pll(regs->PLLCFGR);
+		}
+		on_pll  = want_pll;
+		written = true;
+		for (i = 0; i < SIM_TIMERS; i++) {
+			timer_reconcile(&timers[i]);
+		}
+		dac_reconcile();
+	}
+
+	// New bus prescalers take effect straight away
+	if ((regs->CFGR & RCC_CFGR_BUSES) != bus_cfgr) {
+		written = true;
+		for (i = 0; i < SIM_TIMERS; i++) {
+			timer_rescale(&timers[i], regs->CFGR & RCC_CFGR_BUSES);
+		}
+		dac_rescale(regs->CFGR & RCC_CFGR_BUSES);
+		bus_cfgr = regs->CFGR & RCC_CFGR_BUSES;
+	}
+
+	if (was_full && !rcc_full_speed()) {
+		full_speed += now - full_speed_since;
+	} else if (!was_full && rcc_full_speed()) {
+		full_speed_since = now;
+	}
+}
+
+static void rcc_publish(void) {
+	RCC_TypeDef *regs = REG(RCC_TypeDef, RCC_BASE);
+
+	regs->CR   = (regs->CR & ~(RCC_CR_HSERDY | RCC_CR_PLLRDY)) |
+	             (now >= hse_ready ? RCC_CR_HSERDY : 0) | (now >= pll_ready ? RCC_CR_PLLRDY : 0);
+	regs->CFGR = (regs->CFGR & ~RCC_CFGR_SWS) | (on_pll ? RCC_CFGR_SWS_PLL : RCC_CFGR_SWS_HSI);
+	regs->CSR  = (regs->CSR & ~RCC_CSR_LSIRDY) | (now >= lsi_ready ? RCC_CSR_LSIRDY : 0);
+}
+
+/*
+ * Next time one of the clocks becomes ready
+ */
+static uint64_t rcc_poll_until(void) {
+	uint64_t until = NEVER;
+
+	if (hse_ready > now && hse_ready < until) {
+		until = hse_ready;
+	}
+	if (pll_ready > now && pll_ready < until) {
+		until = pll_ready;
+	}
+	if (lsi_ready > now && lsi_ready < until) {
+		until = lsi_ready;
+	}
+	return until;
+}
+
+/*
+ * STOP mode: the HSE and the PLL are switched off, so the system clock is the HSI
+ * when it wakes up
+ */
+static void rcc_stop(void) {
+	RCC_TypeDef *regs = REG(RCC_TypeDef, RCC_BASE);
+
+	regs->CR   &= ~(RCC_CR_HSEON | RCC_CR_PLLON);
+	regs->CFGR &= ~RCC_CFGR_SW;
+	rcc_reconcile();
+	rcc_publish();
+}
+
+/* RTC */
+
+/*
+ * LSI ticks since the RTC started, at a given time, and the time of a tick
+ */
+static uint64_t rtc_ticks(uint64_t at) {
+	return (uint64_t) ((unsigned __int128) (at - rtc_since) * SIM_LSI_HZ / SIM_CORE_HZ);
+}
+
+static uint64_t rtc_tick_at(uint64_t tick) {
+	return rtc_since + (uint64_t) (((unsigned __int128) tick * SIM_CORE_HZ + SIM_LSI_HZ - 1) / SIM_LSI_HZ);
+}
+
+/*
+ * LSI ticks per tick of the wakeup timer's clock
+ */
+static uint64_t rtc_wakeup_div(void) {
+	RTC_TypeDef *regs = REG(RTC_TypeDef, RTC_BASE);
+	uint32_t prer = regs->PRER;
+
+	switch (regs->CR & RTC_CR_WUCKSEL) {
+		case 0:  return 16;
+		case 1:  return 8;
+		case 2:  return 4;
+		case 3:  return 2;
+		default: return (uint64_t) (((prer & RTC_PRER_PREDIV_A) >> 16) + 1) * ((prer & RTC_PRER_PREDIV_S) + 1);
+	}
+}
+
+/*
+ * Sets the wakeup timer going from now, if it's on and the RTC is running
+ */
+static void rtc_wakeup_start(void) {
+	uint64_t period = (uint64_t) ((REG(RTC_TypeDef, RTC_BASE)->WUTR & RTC_WUTR_WUT) + 1) * rtc_wakeup_div();
+
+	rtc_wakeup_at = rtc_wakeup_on && rtc_running ? rtc_tick_at(rtc_ticks(now) + period) : NEVER;
+}
+
+/*
+ * The wakeup timer has run down: it raises its flag and, with its interrupt on, EXTI
+ * line 22, then starts again
+ */
+static void rtc_event(void) {
+	EXTI_TypeDef *exti = REG(EXTI_TypeDef, EXTI_BASE);
+
+	rtc_wakeup_flag = true;
+	if ((REG(RTC_TypeDef, RTC_BASE)->CR & RTC_CR_WUTIE) &&
+	    (exti->IMR & exti->RTSR & (1UL << EXTI_LINE_RTC_WAKEUP))) {
+		exti_pending |= 1UL << EXTI_LINE_RTC_WAKEUP;
+	}
+	rtc_wakeup_start();
+}
+
+/*
+ * The RTC runs from the LSI when it's selected, enabled and out of initialisation
+ * mode. It starts from midnight each time, whatever the calendar was set to, and the
+ * write protection and the backup domain's are ignored.
+ */
+static void rtc_reconcile(void) {
+	RTC_TypeDef *regs = REG(RTC_TypeDef, RTC_BASE);
+	RCC_TypeDef *rcc  = REG(RCC_TypeDef, RCC_BASE);
+	bool running = now >= lsi_ready && (rcc->BDCR & RCC_BDCR_RTCEN) &&
+	               (rcc->BDCR & RCC_BDCR_RTCSEL) == RCC_BDCR_RTCSEL_1 && !(regs->ISR & RTC_ISR_INIT);
+	bool wakeup_on = (regs->CR & RTC_CR_WUTE) != 0;
+
+	// The flag is cleared by writing zero to it, and writing one does nothing
+	if (regs->ISR != rtc_isr_pub) {
+		written = true;
+		if (!(regs->ISR & RTC_ISR_WUTF)) {
+			rtc_wakeup_flag = false;
+		}
+	}
+
+	if (running != rtc_running || wakeup_on != rtc_wakeup_on) {
+		written = true;
+		if (running && !rtc_running) {
+			rtc_since = now;
+		}
+		rtc_running   = running;
+		rtc_wakeup_on = wakeup_on;
+		rtc_wakeup_start();
+	}
+}
+
+/*
+ * The subsecond counter counts down through the synchronous prescaler, and the
+ * calendar counts the seconds. Both stay as they were while the RTC isn't running.
+ */
+static void rtc_publish(void) {
+	RTC_TypeDef *regs = REG(RTC_TypeDef, RTC_BASE);
+	uint32_t isr = (regs->ISR & RTC_ISR_INIT) | RTC_ISR_RSF;
+
+	if (rtc_running) {
+		uint32_t prediv_a = ((regs->PRER & RTC_PRER_PREDIV_A) >> 16) + 1;
+		uint32_t prediv_s = (regs->PRER & RTC_PRER_PREDIV_S) + 1;
+		uint64_t counts   = rtc_ticks(now) / prediv_a;
+		uint32_t seconds  = (uint32_t) (counts / prediv_s % 86400);
+		uint32_t h = seconds / 3600, m = seconds / 60 % 60, sec = seconds % 60;
+
+		regs->SSR = prediv_s - 1 - (uint32_t) (counts % prediv_s);
+		regs->TR  = (h / 10) << 20 | (h % 10) << 16 | (m / 10) << 12 | (m % 10) << 8 | (sec / 10) << 4 | sec % 10;
+	}
+
+	if (isr & RTC_ISR_INIT) {
+		isr |= RTC_ISR_INITF;
+	}
+	if (!rtc_wakeup_on) {
+		isr |= RTC_ISR_WUTWF;
+	}
+	if (rtc_wakeup_flag) {
+		isr |= RTC_ISR_WUTF;
+	}
+	regs->ISR = rtc_isr_pub = isr;
+}
+
+/*
+ * Next time the subsecond counter changes
+ */
+static uint64_t rtc_poll_until(void) {
+	return rtc_running ? rtc_tick_at(rtc_ticks(now) + 1) : NEVER;
+}
+
+/* EXTI */
+
+/*
+ * Raises the EXTI lines for a GPIO port's pins that have changed, where the line is
+ * connected to that port and set to trigger on that edge. Lines that are masked
+ * aren't raised at all, and software interrupts aren't modelled.
+ */
+static void exti_edges(int port, uint16_t was, uint16_t is) {
+	EXTI_TypeDef   *regs   = REG(EXTI_TypeDef, EXTI_BASE);
+	SYSCFG_TypeDef *syscfg = REG(SYSCFG_TypeDef, SYSCFG_BASE);
+	uint16_t changed = (~was & is & regs->RTSR) | (was & ~is & regs->FTSR);
+	int line;
+
+	for (line = 0; line < 16; line++) {
+		if ((changed & regs->IMR & (1 << line)) &&
+		    ((syscfg->EXTICR[line / 4] >> (line % 4 * 4)) & 0xF) == (uint32_t) port) {
+			exti_pending |= 1 << line;
+		}
+	}
+}
+
+static void exti_reconcile(void) {
+	EXTI_TypeDef *regs = REG(EXTI_TypeDef, EXTI_BASE);
+
+	// Writing a 1 clears the line
+	if (!(regs->PR & EXTI_PR_SHOWN)) {
+		written = true;
+		exti_pending &= ~regs->PR;
+	}
+}
+
+static void exti_publish(void) {
+	REG(EXTI_TypeDef, EXTI_BASE)->PR = exti_pending | EXTI_PR_SHOWN;
+}
+
+/* USART */
+
+static void usart_reconcile(void) {
+	USART_TypeDef *regs = REG(USART_TypeDef, USART2_BASE);
+
+	if (regs->DR != USART_DR_TAKEN) {
+		written = true;
+		if ((regs->CR1 & (USART_CR1_UE | USART_CR1_TE)) == (USART_CR1_UE | USART_CR1_TE) && observer.serial) {
+			observer.serial(now, (char) regs->DR);
+		}
+		regs->DR = USART_DR_TAKEN;
+	}
+
+	// Characters go instantly, so it's always ready for the next
+	regs->SR = USART_SR_TXE | USART_SR_TC;
+}
+
+/* Cycle counter */
+
+static uint32_t dwt_count(void) {
+	if (!dwt_on) {
+		return dwt_value;
+	}
+	return dwt_value + (uint32_t) ((now - asleep) - dwt_since);
+}
+
+static void dwt_reconcile(void) {
+	bool enabled = (DWT_CTRL & 1) && (CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk);
+
+	if (DWT_CYCCNT != dwt_pub) {
+		written = true;
+		dwt_value = DWT_CYCCNT;
+		dwt_since = now - asleep;
+	}
+	if (enabled != dwt_on) {
+		written = true;
+		dwt_value = dwt_count();
+		dwt_since = now - asleep;
+		dwt_on    = enabled;
+	}
+}
+
+static void dwt_publish(void) {
+	DWT_CYCCNT = dwt_pub = dwt_count();
+}
+
+/* NVIC */
+
+static void nvic_reconcile(void) {
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		if (NVIC->ISER[i] != nvic_enabled[i] || NVIC->ICER[i]) {
+			written = true;
+		}
+		nvic_enabled[i] |= NVIC->ISER[i];
+		nvic_enabled[i] &= ~NVIC->ICER[i];
+		// Reads of the clear register aren't modelled, so it can be left at zero
+		// to see the next write
+		NVIC->ISER[i] = nvic_enabled[i];
+		NVIC->ICER[i] = 0;
+	}
+}
+
+/*
+ * Preemption level of an interrupt: the group part of its priority
+ */
+static int irq_level(int irq) {
+	uint32_t prigroup = (SCB->AIRCR >> 8) & 7;
+	uint32_t sub_bits = prigroup > 3 ? prigroup - 3 : 0;
+
+	return (NVIC->IP[irq] >> (8 - __NVIC_PRIO_BITS)) >> sub_bits;
+}
+
+/*
+ * Marks the interrupts the peripherals are asking for
+ */
+static void irq_pending(uint32_t pending[3]) {
+	size_t i;
+	int dma, stream;
+
+	pending[0] = pending[1] = pending[2] = 0;
+	for (i = 0; i < 16; i++) {
+		if (exti_pending & (1 << i)) {
+			pending[exti_irqs[i] / 32] |= 1UL << (exti_irqs[i] % 32);
+		}
+	}
+	if (exti_pending & (1UL << EXTI_LINE_RTC_WAKEUP)) {
+		pending[RTC_WKUP_IRQn / 32] |= 1UL << (RTC_WKUP_IRQn % 32);
+	}
+	for (i = 0; i < SIM_TIMERS; i++) {
+		if (timer_irq(&timers[i], timers[i].irq_up)) {
+			pending[timers[i].irq_up / 32] |= 1UL << (timers[i].irq_up % 32);
+		}
+		if (timer_irq(&timers[i], timers[i].irq_cc)) {
+			pending[timers[i].irq_cc / 32] |= 1UL << (timers[i].irq_cc % 32);
+		}
+		if (timer_irq(&timers[i], timers[i].irq_trg)) {
+			pending[timers[i].irq_trg / 32] |= 1UL << (timers[i].irq_trg % 32);
+		}
+	}
+	for (dma = 0; dma < 2; dma++) {
+		if (!dma_regs(dma)->LISR && !dma_regs(dma)->HISR) {
+			continue;
+		}
+		for (stream = 0; stream < 8; stream++) {
+			if (dma_irq(dma, stream)) {
+				pending[dma_irqs[dma][stream] / 32] |= 1UL << (dma_irqs[dma][stream] % 32);
+			}
+		}
+	}
+}
+
+/*
+ * The enabled, pending interrupt that would run next if nothing was masked, or -1
+ */
+static int irq_next(void) {
+	uint32_t pending[3];
+	int best = -1;
+	int word;
+
+	irq_pending(pending);
+	for (word = 0; word < 3; word++) {
+		uint32_t bits = pending[word] & nvic_enabled[word];
+
+		while (bits) {
+			int irq = word * 32 + __builtin_ctz(bits);
+			bits &= bits - 1;
+
+			if (irq_level(irq) < active_level && (best < 0 || NVIC->IP[irq] < NVIC->IP[best])) {
+				best = irq;
+			}
+		}
+	}
+	return best;
+}
+
+/*
+ * Runs interrupts for as long as there are any that can run
+ */
+static void sim_dispatch(void) {
+	while (!masked) {
+		int irq = irq_next();
+		int level;
+		sim_handler_t handler;
+
+		if (call_pending && active_level >= 0) {
+			handler      = call_pending;
+			call_pending = NULL;
+
+			level = active_level;
+			active_level = -1;
+			handler();
+			active_level = level;
+			written = true;
+
+			sim_reconcile();
+			sim_publish();
+			continue;
+		}
+
+		if (irq < 0) {
+			return;
+		}
+
+		handler = sim_vector(irq);
+		if (!handler) {
+			sim_fatal("interrupt %d has no handler", irq);
+		}
+
+		level = active_level;
+		active_level = irq_level(irq);
+		handler();
+		active_level = level;
+		written = true;
+
+		// The handler's last writes haven't been seen yet
+		sim_reconcile();
+		sim_publish();
+	}
+}
+
+/* Time */
+
+static void sim_reconcile(void) {
+	size_t i;
+
+	nvic_reconcile();
+	gpio_reconcile();
+	rcc_reconcile();
+	rtc_reconcile();
+	for (i = 0; i < SIM_TIMERS; i++) {
+		timer_reconcile(&timers[i]);
+	}
+	dma_reconcile();
+	dac_reconcile();
+	exti_reconcile();
+	usart_reconcile();
+	dwt_reconcile();
+}
+
+static void sim_publish(void) {
+	size_t i;
+
+	rcc_publish();
+	rtc_publish();
+	for (i = 0; i < SIM_TIMERS; i++) {
+		timer_publish(&timers[i]);
+	}
+	dma_publish();
+	dac_publish();
+	exti_publish();
+	gpio_publish();
+	dwt_publish();
+}
+
+/*
+ * Time of the next thing to happen: an input, a timer, the RTC's wakeup timer or the DAC
+ */
+static uint64_t sim_next(void) {
+	uint64_t next = inputs_next < inputs_num ? inputs[inputs_next].at : NEVER;
+	uint64_t dac  = dac_next();
+	size_t i;
+
+	if (rtc_wakeup_at < next) {
+		next = rtc_wakeup_at;
+	}
+	if (dac < next) {
+		next = dac;
+	}
+	for (i = 0; i < SIM_TIMERS; i++) {
+		uint64_t at = timer_next(&timers[i]);
+		if (at < next) {
+			next = at;
+		}
+	}
+	return next;
+}
+
+/*
+ * Moves time along, with everything due on the way happening at its own time
+ */
+static void sim_advance(uint64_t to) {
+	uint64_t next;
+	size_t i;
+
+	if (to > end) {
+		to = end;
+	}
+
+	while ((next = sim_next()) <= to) {
+		// More than one thing can be due at once (TIM8 ticks with TIM2 once TIM2 has
+		// started it, and a timer can land on an input or the RTC), and each timer has
+		// to be seen to before any of them has moved on. A compare is only seen coming,
+		// not once its count has been reached, so one left for later would be missed
+		// altogether.
+		bool due[SIM_TIMERS];
+		for (i = 0; i < SIM_TIMERS; i++) {
+			due[i] = timer_next(&timers[i]) == next;
+		}
+
+		now = next;
+		dac_catch_up();
+		for (i = 0; i < SIM_TIMERS; i++) {
+			if (due[i]) {
+				timer_event(&timers[i]);
+			}
+		}
+
+		// Anything else due now is seen to a step at a time, once the timers are done
+		if (next == rtc_wakeup_at) {
+			rtc_event();
+		} else if (inputs_next == inputs_num || next != inputs[inputs_next].at) {
+			// Only the DAC and the timers, which have been seen to
+		} else if (inputs[inputs_next].call) {
+			if (call_pending) {
+				sim_fatal("a call is due before the last one has run%.0d", 0);
+			}
+			call_pending = inputs[inputs_next++].call;
+		} else {
+			uint16_t was = buttons;
+			buttons = inputs[inputs_next++].buttons;
+			// The buttons are on PE8-PE15
+			exti_edges(4, was << 8, buttons << 8);
+		}
+	}
+
+	now = to;
+	dac_catch_up();
+	if (now >= end) {
+		sim_finish();
+	}
+}
+
+/*
+ * Next time anything the firmware can see in a peripheral could change, other than
+ * by the events sim_next() knows about
+ */
+static uint64_t sim_poll_until(uint32_t base) {
+	size_t i;
+
+	for (i = 0; i < SIM_TIMERS; i++) {
+		sim_timer_t *t = &timers[i];
+		if (t->base == base) {
+			return t->running ? t->since + ((now - t->since) / t->tick + 1) * t->tick : NEVER;
+		}
+	}
+	if (base == GPIOD_BASE && lcd_busy_until > now) {
+		return lcd_busy_until;
+	}
+	if (base == RCC_BASE) {
+		return rcc_poll_until();
+	}
+	if (base == RTC_BASE) {
+		return rtc_poll_until();
+	}
+	return NEVER;
+}
+
+void *sim_access(uint32_t base) {
+	uint64_t sysclk = on_pll ? SIM_CORE_HZ : HSI_VALUE;
+	uint64_t step = (SIM_ACCESS_CYCLES * SIM_CORE_HZ / sysclk) << ahb_shifts[(bus_cfgr & RCC_CFGR_HPRE) >> 4];
+	uint64_t to   = now + step;
+	void    *from = __builtin_return_address(0);
+
+	sim_reconcile();
+
+	// The firmware keeps reading the same peripheral from the same place without
+	// writing anything, so it's in a loop waiting for something to change. Nothing it can see will until the next
+	// event or the next tick of what it's reading, so the accesses until then are
+	// skipped, keeping to the same spacing so the one that sees the change is at
+	// the same time as it would have been.
+	if (base == poll_base && from == poll_from && !written) {
+		if (++poll_count >= SIM_POLL_ACCESSES) {
+			uint64_t until = sim_poll_until(base);
+			uint64_t next  = sim_next();
+
+			if (next < until) {
+				until = next;
+			}
+			if (until != NEVER && until > to) {
+				to = now + (until - now + step - 1) / step * step;
+			}
+		}
+	} else {
+		poll_base  = base;
+		poll_from  = from;
+		poll_count = 0;
+	}
+	written = false;
+
+	sim_advance(to);
+	sim_publish();
+	sim_dispatch();
+
+	return (void *) (uintptr_t) base;
+}
+
+void sim_primask(uint32_t mask) {
+	sim_reconcile();
+	sim_publish();
+	masked  = mask != 0;
+	written = true;
+	sim_dispatch();
+}
+
+/*
+ * Sleeps until an interrupt is due. Interrupts wake the processor even if they're
+ * masked, they just don't run until they're unmasked.
+ *
+ * With SLEEPDEEP set it goes into STOP mode instead, unless something is already
+ * waiting to wake it: the clocks are stopped until an EXTI line (a button, or the
+ * RTC) wakes it, which then takes a little while longer.
+ */
+void sim_wfi(void) {
+	uint32_t pwr_cr = REG(PWR_TypeDef, PWR_BASE)->CR;
+	uint64_t start = now;
+	bool     stop;
+
+	sim_reconcile();
+	lcd_report();
+
+	stop = (SCB->SCR & SCB_SCR_SLEEPDEEP_Msk) && irq_next() < 0 && !call_pending;
+	if (stop && (pwr_cr & PWR_CR_PDDS)) {
+		sim_fatal("standby mode isn't modelled%.0d", 0);
+	}
+	if (stop) {
+		rcc_stop();
+	}
+
+	while (irq_next() < 0 && !call_pending) {
+		uint64_t next = sim_next();
+		if (next == NEVER && end == NEVER) {
+			sim_fatal("asleep with nothing to wake it%.0d", 0);
+		}
+		sim_advance(next);
+		sim_publish();
+	}
+
+	if (stop) {
+		sim_advance(now + (pwr_cr & PWR_CR_LPDS ? SIM_STOP_WAKE_LP_CYCLES : SIM_STOP_WAKE_CYCLES));
+		stopped += now - start;
+	}
+
+	if (!(REG(DBGMCU_TypeDef, DBGMCU_BASE)->CR & (stop ? DBGMCU_CR_DBG_STOP : DBGMCU_CR_DBG_SLEEP))) {
+		asleep += now - start;
+	}
+
+	sim_publish();
+	sim_dispatch();
+}
+
+/* Set-up */
+
+static void sim_map(uint32_t base, size_t size, int flags, int fd) {
+	void *at = mmap((void *) (uintptr_t) base, size, PROT_READ | PROT_WRITE,
+	                flags | MAP_FIXED_NOREPLACE, fd, 0);
+
+	if (at != (void *) (uintptr_t) base) {
+		sim_fatal("can't map the registers at 0x%08x", (int) base);
+	}
+}
+
+/*
+ * Maps the GPIO registers twice, read-only where the firmware sees them, and sets up
+ * the fault handling that lets the firmware's writes through one at a time
+ */
+static void sim_map_gpio(void) {
+	struct sigaction action = { .sa_flags = SA_SIGINFO };
+	int fd = memfd_create("gpio", 0);
+
+	if (fd < 0 || ftruncate(fd, GPIO_SIZE) != 0) {
+		sim_fatal("can't create the GPIO registers%.0d", 0);
+	}
+	sim_map(GPIO_BASE, GPIO_SIZE, MAP_SHARED, fd);
+	gpio_alias = mmap(NULL, GPIO_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (gpio_alias == MAP_FAILED) {
+		sim_fatal("can't map the GPIO registers%.0d", 0);
+	}
+	close(fd);
+	mprotect((void *) GPIO_BASE, GPIO_SIZE, PROT_READ);
+
+	action.sa_sigaction = gpio_fault;
+	sigaction(SIGSEGV, &action, NULL);
+	action.sa_sigaction = gpio_stepped;
+	sigaction(SIGTRAP, &action, NULL);
+}
+
+/*
+ * Maps the registers and puts them in the state they're in after reset. The clocks
+ * are left for SystemInit() to set up, as on the board (see system_stm32f4xx.c), so
+ * it has to be run before the firmware's main().
+ */
+void sim_init(const sim_observer_t *watcher) {
+	RCC_TypeDef *rcc = REG(RCC_TypeDef, RCC_BASE);
+	size_t i;
+
+	// The DMA is given 32-bit addresses, so everything has to be in the bottom 4GB
+	if ((uintptr_t) &now > UINT32_MAX) {
+		sim_fatal("the simulation must be linked at a fixed address (-no-pie)%.0d", 0);
+	}
+
+	sim_map(PERIPH_BASE, GPIO_BASE - PERIPH_BASE, MAP_PRIVATE | MAP_ANONYMOUS, -1);
+	sim_map(GPIO_BASE + GPIO_SIZE, PERIPH_BASE + 0x30000 - (GPIO_BASE + GPIO_SIZE), MAP_PRIVATE | MAP_ANONYMOUS, -1);
+	sim_map(0xE0000000, 0x100000, MAP_PRIVATE | MAP_ANONYMOUS, -1);
+	sim_map_gpio();
+
+	if (watcher) {
+		observer = *watcher;
+	}
+
+	// Running from the HSI, with nothing divided down
+	rcc->CR      = RCC_CR_HSION | RCC_CR_HSIRDY;
+	rcc->PLLCFGR = RCC_PLLCFGR_RESET;
+	rcc->CFGR    = RCC_CFGR_SW_HSI | RCC_CFGR_SWS_HSI;
+	bus_cfgr     = rcc->CFGR & RCC_CFGR_BUSES;
+
+	for (i = 0; i < SIM_TIMERS; i++) {
+		timer_regs(&timers[i])->ARR = timers[i].max;
+		timers[i].tick = timer_div(&timers[i]);
+	}
+	dac_timer_regs()->ARR = 0xFFFF;
+
+	REG(USART_TypeDef, USART2_BASE)->DR = USART_DR_TAKEN;
+	REG(DBGMCU_TypeDef, DBGMCU_BASE)->IDCODE = 0x10016413;
+
+	memset(lcd_ddram, ' ', sizeof(lcd_ddram));
+
+	sim_publish();
+}
+
+/*
+ * Stops the simulation (and the program) after this many more cycles
+ */
+void sim_run_for(uint64_t cycles) {
+	end = now + cycles;
+}
+
+static void sim_input(uint64_t cycles, uint8_t held, void (*call)(void)) {
+	// Once they've all happened, the room can be used again
+	if (inputs_next == inputs_num) {
+		inputs_num  = 0;
+		inputs_next = 0;
+	}
+	if (inputs_num == sizeof(inputs) / sizeof(inputs[0])) {
+		sim_fatal("more than %d inputs", (int) inputs_num);
+	}
+	if (inputs_num > 0 && cycles < inputs[inputs_num - 1].at) {
+		sim_fatal("inputs out of time order%.0d", 0);
+	}
+	inputs[inputs_num].at      = cycles;
+	inputs[inputs_num].buttons = held;
+	inputs[inputs_num].call    = call;
+	inputs_num++;
+}
+
+/*
+ * Sets which buttons are held down from a given time. Inputs must be given in time
+ * order.
+ */
+void sim_buttons_at(uint64_t cycles, uint8_t held) {
+	sim_input(cycles, held, NULL);
+}
+
+/*
+ * Calls a firmware function at a given time, as if from an interrupt that nothing
+ * else can preempt (so it sees the firmware as a handler would). It waits while
+ * interrupts are masked, like an interrupt would.
+ */
+void sim_call_at(uint64_t cycles, void (*call)(void)) {
+	sim_input(cycles, 0, call);
+}
+
+uint64_t sim_now(void) {
+	return now;
+}
+
+/*
+ * Time spent in STOP mode so far
+ */
+uint64_t sim_stopped(void) {
+	return stopped;
+}
+
+/*
+ * Time spent so far with the core at its full 168MHz, asleep or not
+ */
+uint64_t sim_full_speed(void) {
+	return full_speed + (rcc_full_speed() ? now - full_speed_since : 0);
+}
+
+const sim_faults_t *sim_faults(void) {
+	return &faults;
+}
@@ -0,0 +1,39 @@
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdint.h>
+
+// Core clock the simulated board runs at. Virtual time is counted in these cycles.
+#define SIM_CORE_HZ 168000000ULL
+
+// Things the simulation reports as they happen (any can be left NULL)
+typedef struct {
+	// The beat LEDs (PD8-PD15) changed
+	void (*leds)(uint64_t cycles, uint8_t pattern);
+	// The LCD shows something different (reported when the firmware next goes to sleep)
+	void (*lcd)(uint64_t cycles, const char *row0, const char *row1);
+	// A character was sent on USART2
+	void (*serial)(uint64_t cycles, char c);
+	// The DAC's channel 2 output (PA5) changed, to a 12-bit value
+	void (*dac)(uint64_t cycles, uint16_t value);
+	// The end of the run has been reached, just before the program exits (unless
+	// this calls sim_run_for() to carry on)
+	void (*end)(uint64_t cycles);
+} sim_observer_t;
+
+// Counts of things the firmware did wrong, for checking at the end of a run
+typedef struct {
+	uint32_t lcd_busy_writes; // LCD written to before it had finished the last command
+	uint32_t dma_errors;      // DMA transfers the bus matrix wouldn't have allowed
+} sim_faults_t;
+
+void     sim_init(const sim_observer_t *observer);
+void     sim_run_for(uint64_t cycles);
+void     sim_buttons_at(uint64_t cycles, uint8_t buttons);
+void     sim_call_at(uint64_t cycles, void (*call)(void));
+uint64_t sim_now(void);
+uint64_t sim_stopped(void);
+uint64_t sim_full_speed(void);
+const sim_faults_t *sim_faults(void);
+
+#endif /*_SIM_H_*/
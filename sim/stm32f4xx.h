@@ -0,0 +1,1013 @@
+/*
+ * Stand-in for the STM32F4xx device header, for building the firmware on a PC
+ * against the simulated board (see sim.c).
+ *
+ * Only the peripherals the firmware and the drivers it uses touch are here. The
+ * register layouts and addresses are the same as the real device (some code, like
+ * lcd.c, uses the addresses directly), but each peripheral pointer goes through
+ * sim_access() first, so the simulation sees every access and can move time along.
+ */
+#ifndef __STM32F4xx_H
+#define __STM32F4xx_H
+
+#include <stdint.h>
+
+#if !defined (STM32F40XX)
+ #define STM32F40XX
+#endif
+
+#define HSE_VALUE    ((uint32_t)8000000)
+#define HSI_VALUE    ((uint32_t)16000000)
+
+#define __CM4_REV              0x0001
+#define __MPU_PRESENT          1
+#define __NVIC_PRIO_BITS       4
+#define __Vendor_SysTickConfig 0
+#define __FPU_PRESENT          1
+
+typedef enum IRQn
+{
+  NonMaskableInt_IRQn         = -14,
+  MemoryManagement_IRQn       = -12,
+  BusFault_IRQn               = -11,
+  UsageFault_IRQn             = -10,
+  SVCall_IRQn                 = -5,
+  DebugMonitor_IRQn           = -4,
+  PendSV_IRQn                 = -2,
+  SysTick_IRQn                = -1,
+  WWDG_IRQn                   = 0,
+  PVD_IRQn                    = 1,
+  TAMP_STAMP_IRQn             = 2,
+  RTC_WKUP_IRQn               = 3,
+  FLASH_IRQn                  = 4,
+  RCC_IRQn                    = 5,
+  EXTI0_IRQn                  = 6,
+  EXTI1_IRQn                  = 7,
+  EXTI2_IRQn                  = 8,
+  EXTI3_IRQn                  = 9,
+  EXTI4_IRQn                  = 10,
+  DMA1_Stream0_IRQn           = 11,
+  DMA1_Stream1_IRQn           = 12,
+  DMA1_Stream2_IRQn           = 13,
+  DMA1_Stream3_IRQn           = 14,
+  DMA1_Stream4_IRQn           = 15,
+  DMA1_Stream5_IRQn           = 16,
+  DMA1_Stream6_IRQn           = 17,
+  ADC_IRQn                    = 18,
+  CAN1_TX_IRQn                = 19,
+  CAN1_RX0_IRQn               = 20,
+  CAN1_RX1_IRQn               = 21,
+  CAN1_SCE_IRQn               = 22,
+  EXTI9_5_IRQn                = 23,
+  TIM1_BRK_TIM9_IRQn          = 24,
+  TIM1_UP_TIM10_IRQn          = 25,
+  TIM1_TRG_COM_TIM11_IRQn     = 26,
+  TIM1_CC_IRQn                = 27,
+  TIM2_IRQn                   = 28,
+  TIM3_IRQn                   = 29,
+  TIM4_IRQn                   = 30,
+  I2C1_EV_IRQn                = 31,
+  I2C1_ER_IRQn                = 32,
+  I2C2_EV_IRQn                = 33,
+  I2C2_ER_IRQn                = 34,
+  SPI1_IRQn                   = 35,
+  SPI2_IRQn                   = 36,
+  USART1_IRQn                 = 37,
+  USART2_IRQn                 = 38,
+  USART3_IRQn                 = 39,
+  EXTI15_10_IRQn              = 40,
+  RTC_Alarm_IRQn              = 41,
+  OTG_FS_WKUP_IRQn            = 42,
+  TIM8_BRK_TIM12_IRQn         = 43,
+  TIM8_UP_TIM13_IRQn          = 44,
+  TIM8_TRG_COM_TIM14_IRQn     = 45,
+  TIM8_CC_IRQn                = 46,
+  DMA1_Stream7_IRQn           = 47,
+  FSMC_IRQn                   = 48,
+  SDIO_IRQn                   = 49,
+  TIM5_IRQn                   = 50,
+  SPI3_IRQn                   = 51,
+  UART4_IRQn                  = 52,
+  UART5_IRQn                  = 53,
+  TIM6_DAC_IRQn               = 54,
+  TIM7_IRQn                   = 55,
+  DMA2_Stream0_IRQn           = 56,
+  DMA2_Stream1_IRQn           = 57,
+  DMA2_Stream2_IRQn           = 58,
+  DMA2_Stream3_IRQn           = 59,
+  DMA2_Stream4_IRQn           = 60,
+  ETH_IRQn                    = 61,
+  ETH_WKUP_IRQn               = 62,
+  CAN2_TX_IRQn                = 63,
+  CAN2_RX0_IRQn               = 64,
+  CAN2_RX1_IRQn               = 65,
+  CAN2_SCE_IRQn               = 66,
+  OTG_FS_IRQn                 = 67,
+  DMA2_Stream5_IRQn           = 68,
+  DMA2_Stream6_IRQn           = 69,
+  DMA2_Stream7_IRQn           = 70,
+  USART6_IRQn                 = 71,
+  I2C3_EV_IRQn                = 72,
+  I2C3_ER_IRQn                = 73,
+  OTG_HS_EP1_OUT_IRQn         = 74,
+  OTG_HS_EP1_IN_IRQn          = 75,
+  OTG_HS_WKUP_IRQn            = 76,
+  OTG_HS_IRQn                 = 77,
+  DCMI_IRQn                   = 78,
+  CRYP_IRQn                   = 79,
+  HASH_RNG_IRQn               = 80,
+  FPU_IRQn                    = 81
+} IRQn_Type;
+
+// The core intrinsics are ARM instructions, so the ones the firmware uses are renamed
+// out of the way while the CMSIS header is included and replaced by the simulation's.
+// The ones that are macros there are just defined again afterwards.
+#define __WFI          __cmsis_WFI
+#define __WFE          __cmsis_WFE
+#define __disable_irq  __cmsis_disable_irq
+#define __enable_irq   __cmsis_enable_irq
+#define __DMB          __cmsis_DMB
+#define __DSB          __cmsis_DSB
+#define __ISB          __cmsis_ISB
+#define __CLZ          __cmsis_CLZ
+#define __SMLAD        __cmsis_SMLAD
+#define __QADD16       __cmsis_QADD16
+#include "core_cm4.h"
+#undef __WFI
+#undef __WFE
+#undef __disable_irq
+#undef __enable_irq
+#undef __DMB
+#undef __DSB
+#undef __ISB
+#undef __CLZ
+#undef __SMLAD
+#undef __QADD16
+#undef __SSAT
+#undef __PKHBT
+
+void  sim_wfi(void);
+void  sim_primask(uint32_t masked);
+void *sim_access(uint32_t base);
+
+#define __WFI()         sim_wfi()
+#define __WFE()         sim_wfi()
+#define __disable_irq() sim_primask(1)
+#define __enable_irq()  sim_primask(0)
+#define __DMB()         __sync_synchronize()
+#define __DSB()         __sync_synchronize()
+#define __ISB()         __sync_synchronize()
+#define __CLZ(value)    ((uint8_t) ((value) ? __builtin_clz(value) : 32))
+
+// The DSP instructions work on a signed half-word in each half of a word, and have to
+// come out exactly as they do on the board, so what the simulation plays can be
+// compared with it bit for bit. These go by the instructions' descriptions in the
+// ARMv7-M Architecture Reference Manual.
+static inline int32_t sim_ssat(int32_t value, unsigned bits) {
+	int32_t max = (int32_t) ((1u << (bits - 1)) - 1);
+
+	return value > max ? max : value < -max - 1 ? -max - 1 : value;
+}
+
+static inline uint32_t sim_qadd16(uint32_t x, uint32_t y) {
+	int32_t low  = sim_ssat((int16_t) x + (int16_t) y, 16);
+	int32_t high = sim_ssat((int16_t) (x >> 16) + (int16_t) (y >> 16), 16);
+
+	return (uint16_t) low | (uint32_t) (uint16_t) high << 16;
+}
+
+// The sum wraps round, as it does on the board (where it sets the Q flag as well)
+static inline uint32_t sim_smlad(uint32_t x, uint32_t y, uint32_t sum) {
+	return sum + (uint32_t) ((int16_t) x * (int16_t) y) +
+	       (uint32_t) ((int16_t) (x >> 16) * (int16_t) (y >> 16));
+}
+
+#define __SSAT(value, bits)    sim_ssat(value, bits)
+#define __QADD16(x, y)         sim_qadd16(x, y)
+#define __SMLAD(x, y, sum)     sim_smlad(x, y, sum)
+#define __PKHBT(low, high, shift) \
+	(((uint32_t) (low) & 0x0000FFFF) | (((uint32_t) (high) << (shift)) & 0xFFFF0000))
+
+extern uint32_t SystemCoreClock;
+void SystemInit(void);
+void SystemCoreClockUpdate(void);
+
+typedef enum {RESET = 0, SET = !RESET} FlagStatus, ITStatus;
+typedef enum {DISABLE = 0, ENABLE = !DISABLE} FunctionalState;
+#define IS_FUNCTIONAL_STATE(STATE) (((STATE) == DISABLE) || ((STATE) == ENABLE))
+typedef enum {ERROR = 0, SUCCESS = !ERROR} ErrorStatus;
+
+/* Peripheral registers */
+
+typedef struct
+{
+  __IO uint32_t IMR;
+  __IO uint32_t EMR;
+  __IO uint32_t RTSR;
+  __IO uint32_t FTSR;
+  __IO uint32_t SWIER;
+  __IO uint32_t PR;
+} EXTI_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t IDCODE;
+  __IO uint32_t CR;
+  __IO uint32_t APB1FZ;
+  __IO uint32_t APB2FZ;
+} DBGMCU_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t CR;
+  __IO uint32_t SWTRIGR;
+  __IO uint32_t DHR12R1;
+  __IO uint32_t DHR12L1;
+  __IO uint32_t DHR8R1;
+  __IO uint32_t DHR12R2;
+  __IO uint32_t DHR12L2;
+  __IO uint32_t DHR8R2;
+  __IO uint32_t DHR12RD;
+  __IO uint32_t DHR12LD;
+  __IO uint32_t DHR8RD;
+  __IO uint32_t DOR1;
+  __IO uint32_t DOR2;
+  __IO uint32_t SR;
+} DAC_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t CR;
+  __IO uint32_t NDTR;
+  __IO uint32_t PAR;
+  __IO uint32_t M0AR;
+  __IO uint32_t M1AR;
+  __IO uint32_t FCR;
+} DMA_Stream_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t LISR;
+  __IO uint32_t HISR;
+  __IO uint32_t LIFCR;
+  __IO uint32_t HIFCR;
+} DMA_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t MODER;
+  __IO uint32_t OTYPER;
+  __IO uint32_t OSPEEDR;
+  __IO uint32_t PUPDR;
+  __IO uint32_t IDR;
+  __IO uint32_t ODR;
+  __IO uint16_t BSRRL;
+  __IO uint16_t BSRRH;
+  __IO uint32_t LCKR;
+  __IO uint32_t AFR[2];
+} GPIO_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t TR;
+  __IO uint32_t DR;
+  __IO uint32_t CR;
+  __IO uint32_t ISR;
+  __IO uint32_t PRER;
+  __IO uint32_t WUTR;
+  __IO uint32_t CALIBR;
+  __IO uint32_t ALRMAR;
+  __IO uint32_t ALRMBR;
+  __IO uint32_t WPR;
+  __IO uint32_t SSR;
+  __IO uint32_t SHIFTR;
+  __IO uint32_t TSTR;
+  __IO uint32_t TSDR;
+  __IO uint32_t TSSSR;
+  __IO uint32_t CALR;
+  __IO uint32_t TAFCR;
+  __IO uint32_t ALRMASSR;
+  __IO uint32_t ALRMBSSR;
+  uint32_t      RESERVED7;
+  __IO uint32_t BKP0R;
+  __IO uint32_t BKP1R;
+  __IO uint32_t BKP2R;
+  __IO uint32_t BKP3R;
+  __IO uint32_t BKP4R;
+  __IO uint32_t BKP5R;
+  __IO uint32_t BKP6R;
+  __IO uint32_t BKP7R;
+  __IO uint32_t BKP8R;
+  __IO uint32_t BKP9R;
+  __IO uint32_t BKP10R;
+  __IO uint32_t BKP11R;
+  __IO uint32_t BKP12R;
+  __IO uint32_t BKP13R;
+  __IO uint32_t BKP14R;
+  __IO uint32_t BKP15R;
+  __IO uint32_t BKP16R;
+  __IO uint32_t BKP17R;
+  __IO uint32_t BKP18R;
+  __IO uint32_t BKP19R;
+} RTC_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t MEMRMP;
+  __IO uint32_t PMC;
+  __IO uint32_t EXTICR[4];
+  uint32_t      RESERVED[2];
+  __IO uint32_t CMPCR;
+} SYSCFG_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t CR;
+  __IO uint32_t CSR;
+} PWR_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t ACR;
+  __IO uint32_t KEYR;
+  __IO uint32_t OPTKEYR;
+  __IO uint32_t SR;
+  __IO uint32_t CR;
+  __IO uint32_t OPTCR;
+} FLASH_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t CR;
+  __IO uint32_t PLLCFGR;
+  __IO uint32_t CFGR;
+  __IO uint32_t CIR;
+  __IO uint32_t AHB1RSTR;
+  __IO uint32_t AHB2RSTR;
+  __IO uint32_t AHB3RSTR;
+  uint32_t      RESERVED0;
+  __IO uint32_t APB1RSTR;
+  __IO uint32_t APB2RSTR;
+  uint32_t      RESERVED1[2];
+  __IO uint32_t AHB1ENR;
+  __IO uint32_t AHB2ENR;
+  __IO uint32_t AHB3ENR;
+  uint32_t      RESERVED2;
+  __IO uint32_t APB1ENR;
+  __IO uint32_t APB2ENR;
+  uint32_t      RESERVED3[2];
+  __IO uint32_t AHB1LPENR;
+  __IO uint32_t AHB2LPENR;
+  __IO uint32_t AHB3LPENR;
+  uint32_t      RESERVED4;
+  __IO uint32_t APB1LPENR;
+  __IO uint32_t APB2LPENR;
+  uint32_t      RESERVED5[2];
+  __IO uint32_t BDCR;
+  __IO uint32_t CSR;
+  uint32_t      RESERVED6[2];
+  __IO uint32_t SSCGR;
+  __IO uint32_t PLLI2SCFGR;
+} RCC_TypeDef;
+
+typedef struct
+{
+  __IO uint16_t CR1;
+  uint16_t      RESERVED0;
+  __IO uint16_t CR2;
+  uint16_t      RESERVED1;
+  __IO uint16_t SMCR;
+  uint16_t      RESERVED2;
+  __IO uint16_t DIER;
+  uint16_t      RESERVED3;
+  __IO uint16_t SR;
+  uint16_t      RESERVED4;
+  __IO uint16_t EGR;
+  uint16_t      RESERVED5;
+  __IO uint16_t CCMR1;
+  uint16_t      RESERVED6;
+  __IO uint16_t CCMR2;
+  uint16_t      RESERVED7;
+  __IO uint16_t CCER;
+  uint16_t      RESERVED8;
+  __IO uint32_t CNT;
+  __IO uint16_t PSC;
+  uint16_t      RESERVED9;
+  __IO uint32_t ARR;
+  __IO uint16_t RCR;
+  uint16_t      RESERVED10;
+  __IO uint32_t CCR1;
+  __IO uint32_t CCR2;
+  __IO uint32_t CCR3;
+  __IO uint32_t CCR4;
+  __IO uint16_t BDTR;
+  uint16_t      RESERVED11;
+  __IO uint16_t DCR;
+  uint16_t      RESERVED12;
+  __IO uint16_t DMAR;
+  uint16_t      RESERVED13;
+  __IO uint16_t OR;
+  uint16_t      RESERVED14;
+} TIM_TypeDef;
+
+typedef struct
+{
+  __IO uint16_t SR;
+  uint16_t      RESERVED0;
+  __IO uint16_t DR;
+  uint16_t      RESERVED1;
+  __IO uint16_t BRR;
+  uint16_t      RESERVED2;
+  __IO uint16_t CR1;
+  uint16_t      RESERVED3;
+  __IO uint16_t CR2;
+  uint16_t      RESERVED4;
+  __IO uint16_t CR3;
+  uint16_t      RESERVED5;
+  __IO uint16_t GTPR;
+  uint16_t      RESERVED6;
+} USART_TypeDef;
+
+/* Memory map */
+
+#define FLASH_BASE            ((uint32_t)0x08000000)
+#define SRAM_BASE             ((uint32_t)0x20000000)
+#define PERIPH_BASE           ((uint32_t)0x40000000)
+#define PERIPH_BB_BASE        ((uint32_t)0x42000000)
+
+#define APB1PERIPH_BASE       PERIPH_BASE
+#define APB2PERIPH_BASE       (PERIPH_BASE + 0x00010000)
+#define AHB1PERIPH_BASE       (PERIPH_BASE + 0x00020000)
+#define AHB2PERIPH_BASE       (PERIPH_BASE + 0x10000000)
+
+#define TIM2_BASE             (APB1PERIPH_BASE + 0x0000)
+#define TIM3_BASE             (APB1PERIPH_BASE + 0x0400)
+#define TIM4_BASE             (APB1PERIPH_BASE + 0x0800)
+#define TIM5_BASE             (APB1PERIPH_BASE + 0x0C00)
+#define TIM6_BASE             (APB1PERIPH_BASE + 0x1000)
+#define TIM7_BASE             (APB1PERIPH_BASE + 0x1400)
+#define TIM12_BASE            (APB1PERIPH_BASE + 0x1800)
+#define TIM13_BASE            (APB1PERIPH_BASE + 0x1C00)
+#define TIM14_BASE            (APB1PERIPH_BASE + 0x2000)
+#define RTC_BASE              (APB1PERIPH_BASE + 0x2800)
+#define USART2_BASE           (APB1PERIPH_BASE + 0x4400)
+#define USART3_BASE           (APB1PERIPH_BASE + 0x4800)
+#define UART4_BASE            (APB1PERIPH_BASE + 0x4C00)
+#define UART5_BASE            (APB1PERIPH_BASE + 0x5000)
+#define PWR_BASE              (APB1PERIPH_BASE + 0x7000)
+#define DAC_BASE              (APB1PERIPH_BASE + 0x7400)
+
+#define TIM1_BASE             (APB2PERIPH_BASE + 0x0000)
+#define TIM8_BASE             (APB2PERIPH_BASE + 0x0400)
+#define USART1_BASE           (APB2PERIPH_BASE + 0x1000)
+#define USART6_BASE           (APB2PERIPH_BASE + 0x1400)
+#define SYSCFG_BASE           (APB2PERIPH_BASE + 0x3800)
+#define EXTI_BASE             (APB2PERIPH_BASE + 0x3C00)
+#define TIM9_BASE             (APB2PERIPH_BASE + 0x4000)
+#define TIM10_BASE            (APB2PERIPH_BASE + 0x4400)
+#define TIM11_BASE            (APB2PERIPH_BASE + 0x4800)
+
+#define GPIOA_BASE            (AHB1PERIPH_BASE + 0x0000)
+#define GPIOB_BASE            (AHB1PERIPH_BASE + 0x0400)
+#define GPIOC_BASE            (AHB1PERIPH_BASE + 0x0800)
+#define GPIOD_BASE            (AHB1PERIPH_BASE + 0x0C00)
+#define GPIOE_BASE            (AHB1PERIPH_BASE + 0x1000)
+#define GPIOF_BASE            (AHB1PERIPH_BASE + 0x1400)
+#define GPIOG_BASE            (AHB1PERIPH_BASE + 0x1800)
+#define GPIOH_BASE            (AHB1PERIPH_BASE + 0x1C00)
+#define GPIOI_BASE            (AHB1PERIPH_BASE + 0x2000)
+#define RCC_BASE              (AHB1PERIPH_BASE + 0x3800)
+#define FLASH_R_BASE          (AHB1PERIPH_BASE + 0x3C00)
+#define DMA1_BASE             (AHB1PERIPH_BASE + 0x6000)
+#define DMA1_Stream0_BASE     (DMA1_BASE + 0x010)
+#define DMA1_Stream1_BASE     (DMA1_BASE + 0x028)
+#define DMA1_Stream2_BASE     (DMA1_BASE + 0x040)
+#define DMA1_Stream3_BASE     (DMA1_BASE + 0x058)
+#define DMA1_Stream4_BASE     (DMA1_BASE + 0x070)
+#define DMA1_Stream5_BASE     (DMA1_BASE + 0x088)
+#define DMA1_Stream6_BASE     (DMA1_BASE + 0x0A0)
+#define DMA1_Stream7_BASE     (DMA1_BASE + 0x0B8)
+#define DMA2_BASE             (AHB1PERIPH_BASE + 0x6400)
+#define DMA2_Stream0_BASE     (DMA2_BASE + 0x010)
+#define DMA2_Stream1_BASE     (DMA2_BASE + 0x028)
+#define DMA2_Stream2_BASE     (DMA2_BASE + 0x040)
+#define DMA2_Stream3_BASE     (DMA2_BASE + 0x058)
+#define DMA2_Stream4_BASE     (DMA2_BASE + 0x070)
+#define DMA2_Stream5_BASE     (DMA2_BASE + 0x088)
+#define DMA2_Stream6_BASE     (DMA2_BASE + 0x0A0)
+#define DMA2_Stream7_BASE     (DMA2_BASE + 0x0B8)
+
+#define DBGMCU_BASE           ((uint32_t)0xE0042000)
+
+/* Peripheral declarations */
+
+#define TIM2                ((TIM_TypeDef *) sim_access(TIM2_BASE))
+#define TIM3                ((TIM_TypeDef *) sim_access(TIM3_BASE))
+#define TIM4                ((TIM_TypeDef *) sim_access(TIM4_BASE))
+#define TIM5                ((TIM_TypeDef *) sim_access(TIM5_BASE))
+#define TIM6                ((TIM_TypeDef *) sim_access(TIM6_BASE))
+#define TIM7                ((TIM_TypeDef *) sim_access(TIM7_BASE))
+#define TIM12               ((TIM_TypeDef *) sim_access(TIM12_BASE))
+#define TIM13               ((TIM_TypeDef *) sim_access(TIM13_BASE))
+#define TIM14               ((TIM_TypeDef *) sim_access(TIM14_BASE))
+#define RTC                 ((RTC_TypeDef *) sim_access(RTC_BASE))
+#define USART2              ((USART_TypeDef *) sim_access(USART2_BASE))
+#define USART3              ((USART_TypeDef *) sim_access(USART3_BASE))
+#define UART4               ((USART_TypeDef *) sim_access(UART4_BASE))
+#define UART5               ((USART_TypeDef *) sim_access(UART5_BASE))
+#define PWR                 ((PWR_TypeDef *) sim_access(PWR_BASE))
+#define DAC                 ((DAC_TypeDef *) sim_access(DAC_BASE))
+#define TIM1                ((TIM_TypeDef *) sim_access(TIM1_BASE))
+#define TIM8                ((TIM_TypeDef *) sim_access(TIM8_BASE))
+#define USART1              ((USART_TypeDef *) sim_access(USART1_BASE))
+#define USART6              ((USART_TypeDef *) sim_access(USART6_BASE))
+#define SYSCFG              ((SYSCFG_TypeDef *) sim_access(SYSCFG_BASE))
+#define EXTI                ((EXTI_TypeDef *) sim_access(EXTI_BASE))
+#define TIM9                ((TIM_TypeDef *) sim_access(TIM9_BASE))
+#define TIM10               ((TIM_TypeDef *) sim_access(TIM10_BASE))
+#define TIM11               ((TIM_TypeDef *) sim_access(TIM11_BASE))
+#define GPIOA               ((GPIO_TypeDef *) sim_access(GPIOA_BASE))
+#define GPIOB               ((GPIO_TypeDef *) sim_access(GPIOB_BASE))
+#define GPIOC               ((GPIO_TypeDef *) sim_access(GPIOC_BASE))
+#define GPIOD               ((GPIO_TypeDef *) sim_access(GPIOD_BASE))
+#define GPIOE               ((GPIO_TypeDef *) sim_access(GPIOE_BASE))
+#define GPIOF               ((GPIO_TypeDef *) sim_access(GPIOF_BASE))
+#define GPIOG               ((GPIO_TypeDef *) sim_access(GPIOG_BASE))
+#define GPIOH               ((GPIO_TypeDef *) sim_access(GPIOH_BASE))
+#define GPIOI               ((GPIO_TypeDef *) sim_access(GPIOI_BASE))
+#define RCC                 ((RCC_TypeDef *) sim_access(RCC_BASE))
+#define FLASH               ((FLASH_TypeDef *) sim_access(FLASH_R_BASE))
+#define DMA1                ((DMA_TypeDef *) sim_access(DMA1_BASE))
+#define DMA1_Stream0        ((DMA_Stream_TypeDef *) sim_access(DMA1_Stream0_BASE))
+#define DMA1_Stream1        ((DMA_Stream_TypeDef *) sim_access(DMA1_Stream1_BASE))
+#define DMA1_Stream2        ((DMA_Stream_TypeDef *) sim_access(DMA1_Stream2_BASE))
+#define DMA1_Stream3        ((DMA_Stream_TypeDef *) sim_access(DMA1_Stream3_BASE))
+#define DMA1_Stream4        ((DMA_Stream_TypeDef *) sim_access(DMA1_Stream4_BASE))
+#define DMA1_Stream5        ((DMA_Stream_TypeDef *) sim_access(DMA1_Stream5_BASE))
+#define DMA1_Stream6        ((DMA_Stream_TypeDef *) sim_access(DMA1_Stream6_BASE))
+#define DMA1_Stream7        ((DMA_Stream_TypeDef *) sim_access(DMA1_Stream7_BASE))
+#define DMA2                ((DMA_TypeDef *) sim_access(DMA2_BASE))
+#define DMA2_Stream0        ((DMA_Stream_TypeDef *) sim_access(DMA2_Stream0_BASE))
+#define DMA2_Stream1        ((DMA_Stream_TypeDef *) sim_access(DMA2_Stream1_BASE))
+#define DMA2_Stream2        ((DMA_Stream_TypeDef *) sim_access(DMA2_Stream2_BASE))
+#define DMA2_Stream3        ((DMA_Stream_TypeDef *) sim_access(DMA2_Stream3_BASE))
+#define DMA2_Stream4        ((DMA_Stream_TypeDef *) sim_access(DMA2_Stream4_BASE))
+#define DMA2_Stream5        ((DMA_Stream_TypeDef *) sim_access(DMA2_Stream5_BASE))
+#define DMA2_Stream6        ((DMA_Stream_TypeDef *) sim_access(DMA2_Stream6_BASE))
+#define DMA2_Stream7        ((DMA_Stream_TypeDef *) sim_access(DMA2_Stream7_BASE))
+#define DBGMCU              ((DBGMCU_TypeDef *) sim_access(DBGMCU_BASE))
+
+/* Register bits */
+
+/* TIM */
+#define  TIM_CR1_CEN                         ((uint16_t)0x0001)
+#define  TIM_CR1_UDIS                        ((uint16_t)0x0002)
+#define  TIM_CR1_URS                         ((uint16_t)0x0004)
+#define  TIM_CR1_OPM                         ((uint16_t)0x0008)
+#define  TIM_CR1_DIR                         ((uint16_t)0x0010)
+#define  TIM_CR1_CMS                         ((uint16_t)0x0060)
+#define  TIM_CR1_ARPE                        ((uint16_t)0x0080)
+#define  TIM_CR1_CKD                         ((uint16_t)0x0300)
+
+#define  TIM_CR2_CCPC                        ((uint16_t)0x0001)
+#define  TIM_CR2_CCUS                        ((uint16_t)0x0004)
+#define  TIM_CR2_CCDS                        ((uint16_t)0x0008)
+#define  TIM_CR2_MMS                         ((uint16_t)0x0070)
+#define  TIM_CR2_MMS_0                       ((uint16_t)0x0010)
+#define  TIM_CR2_MMS_1                       ((uint16_t)0x0020)
+#define  TIM_CR2_MMS_2                       ((uint16_t)0x0040)
+#define  TIM_CR2_TI1S                        ((uint16_t)0x0080)
+#define  TIM_CR2_OIS1                        ((uint16_t)0x0100)
+#define  TIM_CR2_OIS1N                       ((uint16_t)0x0200)
+#define  TIM_CR2_OIS2                        ((uint16_t)0x0400)
+#define  TIM_CR2_OIS2N                       ((uint16_t)0x0800)
+#define  TIM_CR2_OIS3                        ((uint16_t)0x1000)
+#define  TIM_CR2_OIS3N                       ((uint16_t)0x2000)
+#define  TIM_CR2_OIS4                        ((uint16_t)0x4000)
+
+#define  TIM_SMCR_SMS                        ((uint16_t)0x0007)
+#define  TIM_SMCR_SMS_0                      ((uint16_t)0x0001)
+#define  TIM_SMCR_SMS_1                      ((uint16_t)0x0002)
+#define  TIM_SMCR_SMS_2                      ((uint16_t)0x0004)
+#define  TIM_SMCR_TS                         ((uint16_t)0x0070)
+#define  TIM_SMCR_TS_0                       ((uint16_t)0x0010)
+#define  TIM_SMCR_TS_1                       ((uint16_t)0x0020)
+#define  TIM_SMCR_TS_2                       ((uint16_t)0x0040)
+#define  TIM_SMCR_MSM                        ((uint16_t)0x0080)
+#define  TIM_SMCR_ETF                        ((uint16_t)0x0F00)
+#define  TIM_SMCR_ETPS                       ((uint16_t)0x3000)
+#define  TIM_SMCR_ECE                        ((uint16_t)0x4000)
+#define  TIM_SMCR_ETP                        ((uint16_t)0x8000)
+
+#define  TIM_DIER_UIE                        ((uint16_t)0x0001)
+#define  TIM_DIER_CC1IE                      ((uint16_t)0x0002)
+#define  TIM_DIER_CC2IE                      ((uint16_t)0x0004)
+#define  TIM_DIER_CC3IE                      ((uint16_t)0x0008)
+#define  TIM_DIER_CC4IE                      ((uint16_t)0x0010)
+#define  TIM_DIER_COMIE                      ((uint16_t)0x0020)
+#define  TIM_DIER_TIE                        ((uint16_t)0x0040)
+#define  TIM_DIER_BIE                        ((uint16_t)0x0080)
+#define  TIM_DIER_UDE                        ((uint16_t)0x0100)
+#define  TIM_DIER_CC1DE                      ((uint16_t)0x0200)
+#define  TIM_DIER_CC2DE                      ((uint16_t)0x0400)
+#define  TIM_DIER_CC3DE                      ((uint16_t)0x0800)
+#define  TIM_DIER_CC4DE                      ((uint16_t)0x1000)
+#define  TIM_DIER_COMDE                      ((uint16_t)0x2000)
+#define  TIM_DIER_TDE                        ((uint16_t)0x4000)
+
+#define  TIM_SR_UIF                          ((uint16_t)0x0001)
+#define  TIM_SR_CC1IF                        ((uint16_t)0x0002)
+#define  TIM_SR_CC2IF                        ((uint16_t)0x0004)
+#define  TIM_SR_CC3IF                        ((uint16_t)0x0008)
+#define  TIM_SR_CC4IF                        ((uint16_t)0x0010)
+#define  TIM_SR_COMIF                        ((uint16_t)0x0020)
+#define  TIM_SR_TIF                          ((uint16_t)0x0040)
+#define  TIM_SR_BIF                          ((uint16_t)0x0080)
+#define  TIM_SR_CC1OF                        ((uint16_t)0x0200)
+#define  TIM_SR_CC2OF                        ((uint16_t)0x0400)
+#define  TIM_SR_CC3OF                        ((uint16_t)0x0800)
+#define  TIM_SR_CC4OF                        ((uint16_t)0x1000)
+
+#define  TIM_EGR_UG                          ((uint8_t)0x01)
+#define  TIM_EGR_CC1G                        ((uint8_t)0x02)
+#define  TIM_EGR_CC2G                        ((uint8_t)0x04)
+#define  TIM_EGR_CC3G                        ((uint8_t)0x08)
+#define  TIM_EGR_CC4G                        ((uint8_t)0x10)
+#define  TIM_EGR_COMG                        ((uint8_t)0x20)
+#define  TIM_EGR_TG                          ((uint8_t)0x40)
+#define  TIM_EGR_BG                          ((uint8_t)0x80)
+
+#define  TIM_CCMR1_CC1S                      ((uint16_t)0x0003)
+#define  TIM_CCMR1_CC1S_0                    ((uint16_t)0x0001)
+#define  TIM_CCMR1_CC1S_1                    ((uint16_t)0x0002)
+#define  TIM_CCMR1_OC1FE                     ((uint16_t)0x0004)
+#define  TIM_CCMR1_OC1PE                     ((uint16_t)0x0008)
+#define  TIM_CCMR1_OC1M                      ((uint16_t)0x0070)
+#define  TIM_CCMR1_OC1CE                     ((uint16_t)0x0080)
+#define  TIM_CCMR1_CC2S                      ((uint16_t)0x0300)
+#define  TIM_CCMR1_CC2S_0                    ((uint16_t)0x0100)
+#define  TIM_CCMR1_CC2S_1                    ((uint16_t)0x0200)
+#define  TIM_CCMR1_OC2FE                     ((uint16_t)0x0400)
+#define  TIM_CCMR1_OC2PE                     ((uint16_t)0x0800)
+#define  TIM_CCMR1_OC2M                      ((uint16_t)0x7000)
+#define  TIM_CCMR1_OC2CE                     ((uint16_t)0x8000)
+#define  TIM_CCMR1_IC1PSC                    ((uint16_t)0x000C)
+#define  TIM_CCMR1_IC1F                      ((uint16_t)0x00F0)
+#define  TIM_CCMR1_IC2PSC                    ((uint16_t)0x0C00)
+#define  TIM_CCMR1_IC2F                      ((uint16_t)0xF000)
+
+#define  TIM_CCMR2_CC3S                      ((uint16_t)0x0003)
+#define  TIM_CCMR2_OC3FE                     ((uint16_t)0x0004)
+#define  TIM_CCMR2_OC3PE                     ((uint16_t)0x0008)
+#define  TIM_CCMR2_OC3M                      ((uint16_t)0x0070)
+#define  TIM_CCMR2_OC3CE                     ((uint16_t)0x0080)
+#define  TIM_CCMR2_CC4S                      ((uint16_t)0x0300)
+#define  TIM_CCMR2_OC4FE                     ((uint16_t)0x0400)
+#define  TIM_CCMR2_OC4PE                     ((uint16_t)0x0800)
+#define  TIM_CCMR2_OC4M                      ((uint16_t)0x7000)
+#define  TIM_CCMR2_OC4CE                     ((uint16_t)0x8000)
+#define  TIM_CCMR2_IC3PSC                    ((uint16_t)0x000C)
+#define  TIM_CCMR2_IC3F                      ((uint16_t)0x00F0)
+#define  TIM_CCMR2_IC4PSC                    ((uint16_t)0x0C00)
+#define  TIM_CCMR2_IC4F                      ((uint16_t)0xF000)
+
+#define  TIM_CCER_CC1E                       ((uint16_t)0x0001)
+#define  TIM_CCER_CC1P                       ((uint16_t)0x0002)
+#define  TIM_CCER_CC1NE                      ((uint16_t)0x0004)
+#define  TIM_CCER_CC1NP                      ((uint16_t)0x0008)
+#define  TIM_CCER_CC2E                       ((uint16_t)0x0010)
+#define  TIM_CCER_CC2P                       ((uint16_t)0x0020)
+#define  TIM_CCER_CC2NE                      ((uint16_t)0x0040)
+#define  TIM_CCER_CC2NP                      ((uint16_t)0x0080)
+#define  TIM_CCER_CC3E                       ((uint16_t)0x0100)
+#define  TIM_CCER_CC3P                       ((uint16_t)0x0200)
+#define  TIM_CCER_CC3NE                      ((uint16_t)0x0400)
+#define  TIM_CCER_CC3NP                      ((uint16_t)0x0800)
+#define  TIM_CCER_CC4E                       ((uint16_t)0x1000)
+#define  TIM_CCER_CC4P                       ((uint16_t)0x2000)
+#define  TIM_CCER_CC4NP                      ((uint16_t)0x8000)
+
+#define  TIM_BDTR_MOE                        ((uint16_t)0x8000)
+
+/* DAC */
+#define  DAC_CR_EN1                          ((uint32_t)0x00000001)
+#define  DAC_CR_BOFF1                        ((uint32_t)0x00000002)
+#define  DAC_CR_TEN1                         ((uint32_t)0x00000004)
+#define  DAC_CR_TSEL1                        ((uint32_t)0x00000038)
+#define  DAC_CR_WAVE1                        ((uint32_t)0x000000C0)
+#define  DAC_CR_MAMP1                        ((uint32_t)0x00000F00)
+#define  DAC_CR_DMAEN1                       ((uint32_t)0x00001000)
+#define  DAC_CR_DMAUDRIE1                    ((uint32_t)0x00002000)
+#define  DAC_CR_EN2                          ((uint32_t)0x00010000)
+#define  DAC_CR_BOFF2                        ((uint32_t)0x00020000)
+#define  DAC_CR_TEN2                         ((uint32_t)0x00040000)
+#define  DAC_CR_TSEL2                        ((uint32_t)0x00380000)
+#define  DAC_CR_WAVE2                        ((uint32_t)0x00C00000)
+#define  DAC_CR_MAMP2                        ((uint32_t)0x0F000000)
+#define  DAC_CR_DMAEN2                       ((uint32_t)0x10000000)
+#define  DAC_CR_DMAUDRIE2                    ((uint32_t)0x20000000)
+
+#define  DAC_SWTRIGR_SWTRIG1                 ((uint32_t)0x00000001)
+#define  DAC_SWTRIGR_SWTRIG2                 ((uint32_t)0x00000002)
+
+#define  DAC_SR_DMAUDR1                      ((uint32_t)0x00002000)
+#define  DAC_SR_DMAUDR2                      ((uint32_t)0x20000000)
+
+/* DMA */
+#define  DMA_SxCR_CHSEL                      ((uint32_t)0x0E000000)
+#define  DMA_SxCR_MBURST                     ((uint32_t)0x01800000)
+#define  DMA_SxCR_PBURST                     ((uint32_t)0x00600000)
+#define  DMA_SxCR_ACK                        ((uint32_t)0x00100000)
+#define  DMA_SxCR_CT                         ((uint32_t)0x00080000)
+#define  DMA_SxCR_DBM                        ((uint32_t)0x00040000)
+#define  DMA_SxCR_PL                         ((uint32_t)0x00030000)
+#define  DMA_SxCR_PINCOS                     ((uint32_t)0x00008000)
+#define  DMA_SxCR_MSIZE                      ((uint32_t)0x00006000)
+#define  DMA_SxCR_PSIZE                      ((uint32_t)0x00001800)
+#define  DMA_SxCR_MINC                       ((uint32_t)0x00000400)
+#define  DMA_SxCR_PINC                       ((uint32_t)0x00000200)
+#define  DMA_SxCR_CIRC                       ((uint32_t)0x00000100)
+#define  DMA_SxCR_DIR                        ((uint32_t)0x000000C0)
+#define  DMA_SxCR_DIR_0                      ((uint32_t)0x00000040)
+#define  DMA_SxCR_DIR_1                      ((uint32_t)0x00000080)
+#define  DMA_SxCR_PFCTRL                     ((uint32_t)0x00000020)
+#define  DMA_SxCR_TCIE                       ((uint32_t)0x00000010)
+#define  DMA_SxCR_HTIE                       ((uint32_t)0x00000008)
+#define  DMA_SxCR_TEIE                       ((uint32_t)0x00000004)
+#define  DMA_SxCR_DMEIE                      ((uint32_t)0x00000002)
+#define  DMA_SxCR_EN                         ((uint32_t)0x00000001)
+
+#define  DMA_SxFCR_FEIE                      ((uint32_t)0x00000080)
+#define  DMA_SxFCR_FS                        ((uint32_t)0x00000038)
+#define  DMA_SxFCR_DMDIS                     ((uint32_t)0x00000004)
+#define  DMA_SxFCR_FTH                       ((uint32_t)0x00000003)
+
+#define  DMA_LISR_TCIF0                      ((uint32_t)0x00000020)
+#define  DMA_LISR_HTIF0                      ((uint32_t)0x00000010)
+#define  DMA_LISR_TEIF0                      ((uint32_t)0x00000008)
+#define  DMA_LISR_DMEIF0                     ((uint32_t)0x00000004)
+#define  DMA_LISR_FEIF0                      ((uint32_t)0x00000001)
+
+/* GPIO */
+#define  GPIO_MODER_MODER0                   ((uint32_t)0x00000003)
+#define  GPIO_MODER_MODER2                   ((uint32_t)0x00000030)
+#define  GPIO_MODER_MODER2_0                 ((uint32_t)0x00000010)
+#define  GPIO_MODER_MODER2_1                 ((uint32_t)0x00000020)
+#define  GPIO_OTYPER_OT_0                    ((uint32_t)0x00000001)
+#define  GPIO_OSPEEDER_OSPEEDR0              ((uint32_t)0x00000003)
+#define  GPIO_PUPDR_PUPDR0                   ((uint32_t)0x00000003)
+
+/* RCC */
+#define  RCC_CR_HSION                        ((uint32_t)0x00000001)
+#define  RCC_CR_HSIRDY                       ((uint32_t)0x00000002)
+#define  RCC_CR_HSITRIM                      ((uint32_t)0x000000F8)
+#define  RCC_CR_HSICAL                       ((uint32_t)0x0000FF00)
+#define  RCC_CR_HSEON                        ((uint32_t)0x00010000)
+#define  RCC_CR_HSERDY                       ((uint32_t)0x00020000)
+#define  RCC_CR_HSEBYP                       ((uint32_t)0x00040000)
+#define  RCC_CR_CSSON                        ((uint32_t)0x00080000)
+#define  RCC_CR_PLLON                        ((uint32_t)0x01000000)
+#define  RCC_CR_PLLRDY                       ((uint32_t)0x02000000)
+#define  RCC_CR_PLLI2SON                     ((uint32_t)0x04000000)
+#define  RCC_CR_PLLI2SRDY                    ((uint32_t)0x08000000)
+
+#define  RCC_PLLCFGR_PLLM                    ((uint32_t)0x0000003F)
+#define  RCC_PLLCFGR_PLLN                    ((uint32_t)0x00007FC0)
+#define  RCC_PLLCFGR_PLLP                    ((uint32_t)0x00030000)
+#define  RCC_PLLCFGR_PLLSRC                  ((uint32_t)0x00400000)
+#define  RCC_PLLCFGR_PLLSRC_HSE              ((uint32_t)0x00400000)
+#define  RCC_PLLCFGR_PLLSRC_HSI              ((uint32_t)0x00000000)
+#define  RCC_PLLCFGR_PLLQ                    ((uint32_t)0x0F000000)
+
+#define  RCC_CFGR_SW                         ((uint32_t)0x00000003)
+#define  RCC_CFGR_SW_HSI                     ((uint32_t)0x00000000)
+#define  RCC_CFGR_SW_HSE                     ((uint32_t)0x00000001)
+#define  RCC_CFGR_SW_PLL                     ((uint32_t)0x00000002)
+#define  RCC_CFGR_SWS                        ((uint32_t)0x0000000C)
+#define  RCC_CFGR_SWS_HSI                    ((uint32_t)0x00000000)
+#define  RCC_CFGR_SWS_HSE                    ((uint32_t)0x00000004)
+#define  RCC_CFGR_SWS_PLL                    ((uint32_t)0x00000008)
+#define  RCC_CFGR_HPRE                       ((uint32_t)0x000000F0)
+#define  RCC_CFGR_HPRE_DIV1                  ((uint32_t)0x00000000)
+#define  RCC_CFGR_HPRE_DIV2                  ((uint32_t)0x00000080)
+#define  RCC_CFGR_PPRE1                      ((uint32_t)0x00001C00)
+#define  RCC_CFGR_PPRE1_DIV1                 ((uint32_t)0x00000000)
+#define  RCC_CFGR_PPRE1_DIV2                 ((uint32_t)0x00001000)
+#define  RCC_CFGR_PPRE1_DIV4                 ((uint32_t)0x00001400)
+#define  RCC_CFGR_PPRE2                      ((uint32_t)0x0000E000)
+#define  RCC_CFGR_PPRE2_DIV1                 ((uint32_t)0x00000000)
+#define  RCC_CFGR_PPRE2_DIV2                 ((uint32_t)0x00008000)
+#define  RCC_CFGR_PPRE2_DIV4                 ((uint32_t)0x0000A000)
+#define  RCC_CFGR_RTCPRE                     ((uint32_t)0x001F0000)
+
+#define  RCC_BDCR_LSEON                      ((uint32_t)0x00000001)
+#define  RCC_BDCR_LSERDY                     ((uint32_t)0x00000002)
+#define  RCC_BDCR_LSEBYP                     ((uint32_t)0x00000004)
+#define  RCC_BDCR_RTCSEL                     ((uint32_t)0x00000300)
+#define  RCC_BDCR_RTCSEL_0                   ((uint32_t)0x00000100)
+#define  RCC_BDCR_RTCSEL_1                   ((uint32_t)0x00000200)
+#define  RCC_BDCR_RTCEN                      ((uint32_t)0x00008000)
+#define  RCC_BDCR_BDRST                      ((uint32_t)0x00010000)
+
+#define  RCC_CSR_LSION                       ((uint32_t)0x00000001)
+#define  RCC_CSR_LSIRDY                      ((uint32_t)0x00000002)
+#define  RCC_CSR_RMVF                        ((uint32_t)0x01000000)
+
+#define  RCC_AHB1ENR_GPIOAEN                 ((uint32_t)0x00000001)
+#define  RCC_AHB1ENR_GPIOBEN                 ((uint32_t)0x00000002)
+#define  RCC_AHB1ENR_GPIOCEN                 ((uint32_t)0x00000004)
+#define  RCC_AHB1ENR_GPIODEN                 ((uint32_t)0x00000008)
+#define  RCC_AHB1ENR_GPIOEEN                 ((uint32_t)0x00000010)
+#define  RCC_AHB1ENR_DMA1EN                  ((uint32_t)0x00200000)
+#define  RCC_AHB1ENR_DMA2EN                  ((uint32_t)0x00400000)
+
+#define  RCC_APB1ENR_TIM2EN                  ((uint32_t)0x00000001)
+#define  RCC_APB1ENR_TIM3EN                  ((uint32_t)0x00000002)
+#define  RCC_APB1ENR_TIM4EN                  ((uint32_t)0x00000004)
+#define  RCC_APB1ENR_TIM5EN                  ((uint32_t)0x00000008)
+#define  RCC_APB1ENR_TIM14EN                 ((uint32_t)0x00000100)
+#define  RCC_APB1ENR_USART2EN                ((uint32_t)0x00020000)
+#define  RCC_APB1ENR_PWREN                   ((uint32_t)0x10000000)
+
+#define  RCC_APB2ENR_TIM1EN                  ((uint32_t)0x00000001)
+#define  RCC_APB2ENR_TIM8EN                  ((uint32_t)0x00000002)
+#define  RCC_APB2ENR_SYSCFGEN                ((uint32_t)0x00004000)
+
+#define  HSE_STARTUP_TIMEOUT                 ((uint16_t)0x0500)
+
+/* FLASH */
+#define  FLASH_ACR_LATENCY_5WS               ((uint32_t)0x00000005)
+#define  FLASH_ACR_PRFTEN                    ((uint32_t)0x00000100)
+#define  FLASH_ACR_ICEN                      ((uint32_t)0x00000200)
+#define  FLASH_ACR_DCEN                      ((uint32_t)0x00000400)
+
+/* PWR */
+#define  PWR_CR_LPDS                         ((uint32_t)0x00000001)
+#define  PWR_CR_PDDS                         ((uint32_t)0x00000002)
+#define  PWR_CR_CWUF                         ((uint32_t)0x00000004)
+#define  PWR_CR_CSBF                         ((uint32_t)0x00000008)
+#define  PWR_CR_PVDE                         ((uint32_t)0x00000010)
+#define  PWR_CR_PLS                          ((uint32_t)0x000000E0)
+#define  PWR_CR_DBP                          ((uint32_t)0x00000100)
+#define  PWR_CR_FPDS                         ((uint32_t)0x00000200)
+#define  PWR_CR_VOS                          ((uint32_t)0x00004000)
+
+#define  PWR_CSR_WUF                         ((uint32_t)0x00000001)
+#define  PWR_CSR_SBF                         ((uint32_t)0x00000002)
+#define  PWR_CSR_PVDO                        ((uint32_t)0x00000004)
+#define  PWR_CSR_BRR                         ((uint32_t)0x00000008)
+#define  PWR_CSR_EWUP                        ((uint32_t)0x00000100)
+#define  PWR_CSR_BRE                         ((uint32_t)0x00000200)
+#define  PWR_CSR_VOSRDY                      ((uint32_t)0x00004000)
+
+/* RTC */
+#define  RTC_TR_PM                           ((uint32_t)0x00400000)
+#define  RTC_TR_HT                           ((uint32_t)0x00300000)
+#define  RTC_TR_HU                           ((uint32_t)0x000F0000)
+#define  RTC_TR_MNT                          ((uint32_t)0x00007000)
+#define  RTC_TR_MNU                          ((uint32_t)0x00000F00)
+#define  RTC_TR_ST                           ((uint32_t)0x00000070)
+#define  RTC_TR_SU                           ((uint32_t)0x0000000F)
+
+#define  RTC_DR_YT                           ((uint32_t)0x00F00000)
+#define  RTC_DR_YU                           ((uint32_t)0x000F0000)
+#define  RTC_DR_WDU                          ((uint32_t)0x0000E000)
+#define  RTC_DR_MT                           ((uint32_t)0x00001000)
+#define  RTC_DR_MU                           ((uint32_t)0x00000F00)
+#define  RTC_DR_DT                           ((uint32_t)0x00000030)
+#define  RTC_DR_DU                           ((uint32_t)0x0000000F)
+
+#define  RTC_CR_COE                          ((uint32_t)0x00800000)
+#define  RTC_CR_OSEL                         ((uint32_t)0x00600000)
+#define  RTC_CR_POL                          ((uint32_t)0x00100000)
+#define  RTC_CR_COSEL                        ((uint32_t)0x00080000)
+#define  RTC_CR_BCK                          ((uint32_t)0x00040000)
+#define  RTC_CR_SUB1H                        ((uint32_t)0x00020000)
+#define  RTC_CR_ADD1H                        ((uint32_t)0x00010000)
+#define  RTC_CR_TSIE                         ((uint32_t)0x00008000)
+#define  RTC_CR_WUTIE                        ((uint32_t)0x00004000)
+#define  RTC_CR_ALRBIE                       ((uint32_t)0x00002000)
+#define  RTC_CR_ALRAIE                       ((uint32_t)0x00001000)
+#define  RTC_CR_TSE                          ((uint32_t)0x00000800)
+#define  RTC_CR_WUTE                         ((uint32_t)0x00000400)
+#define  RTC_CR_ALRBE                        ((uint32_t)0x00000200)
+#define  RTC_CR_ALRAE                        ((uint32_t)0x00000100)
+#define  RTC_CR_DCE                          ((uint32_t)0x00000080)
+#define  RTC_CR_FMT                          ((uint32_t)0x00000040)
+#define  RTC_CR_BYPSHAD                      ((uint32_t)0x00000020)
+#define  RTC_CR_REFCKON                      ((uint32_t)0x00000010)
+#define  RTC_CR_TSEDGE                       ((uint32_t)0x00000008)
+#define  RTC_CR_WUCKSEL                      ((uint32_t)0x00000007)
+
+#define  RTC_ISR_RECALPF                     ((uint32_t)0x00010000)
+#define  RTC_ISR_TAMP1F                      ((uint32_t)0x00002000)
+#define  RTC_ISR_TSOVF                       ((uint32_t)0x00001000)
+#define  RTC_ISR_TSF                         ((uint32_t)0x00000800)
+#define  RTC_ISR_WUTF                        ((uint32_t)0x00000400)
+#define  RTC_ISR_ALRBF                       ((uint32_t)0x00000200)
+#define  RTC_ISR_ALRAF                       ((uint32_t)0x00000100)
+#define  RTC_ISR_INIT                        ((uint32_t)0x00000080)
+#define  RTC_ISR_INITF                       ((uint32_t)0x00000040)
+#define  RTC_ISR_RSF                         ((uint32_t)0x00000020)
+#define  RTC_ISR_INITS                       ((uint32_t)0x00000010)
+#define  RTC_ISR_SHPF                        ((uint32_t)0x00000008)
+#define  RTC_ISR_WUTWF                       ((uint32_t)0x00000004)
+#define  RTC_ISR_ALRBWF                      ((uint32_t)0x00000002)
+#define  RTC_ISR_ALRAWF                      ((uint32_t)0x00000001)
+
+#define  RTC_PRER_PREDIV_A                   ((uint32_t)0x007F0000)
+#define  RTC_PRER_PREDIV_S                   ((uint32_t)0x00007FFF)
+
+#define  RTC_WUTR_WUT                        ((uint32_t)0x0000FFFF)
+
+#define  RTC_ALRMAR_WDSEL                    ((uint32_t)0x40000000)
+#define  RTC_ALRMAR_DT                       ((uint32_t)0x30000000)
+#define  RTC_ALRMAR_DU                       ((uint32_t)0x0F000000)
+#define  RTC_ALRMAR_PM                       ((uint32_t)0x00400000)
+#define  RTC_ALRMAR_HT                       ((uint32_t)0x00300000)
+#define  RTC_ALRMAR_HU                       ((uint32_t)0x000F0000)
+#define  RTC_ALRMAR_MNT                      ((uint32_t)0x00007000)
+#define  RTC_ALRMAR_MNU                      ((uint32_t)0x00000F00)
+#define  RTC_ALRMAR_ST                       ((uint32_t)0x00000070)
+#define  RTC_ALRMAR_SU                       ((uint32_t)0x0000000F)
+
+#define  RTC_TAFCR_ALARMOUTTYPE              ((uint32_t)0x00040000)
+#define  RTC_TAFCR_TSINSEL                   ((uint32_t)0x00020000)
+#define  RTC_TAFCR_TAMPINSEL                 ((uint32_t)0x00010000)
+#define  RTC_TAFCR_TAMPPUDIS                 ((uint32_t)0x00008000)
+#define  RTC_TAFCR_TAMPPRCH                  ((uint32_t)0x00006000)
+#define  RTC_TAFCR_TAMPFLT                   ((uint32_t)0x00001800)
+#define  RTC_TAFCR_TAMPFREQ                  ((uint32_t)0x00000700)
+#define  RTC_TAFCR_TAMPTS                    ((uint32_t)0x00000080)
+#define  RTC_TAFCR_TAMPIE                    ((uint32_t)0x00000004)
+
+#define  RTC_ALRMASSR_SS                     ((uint32_t)0x00007FFF)
+#define  RTC_ALRMBSSR_SS                     ((uint32_t)0x00007FFF)
+
+/* SYSCFG */
+#define  SYSCFG_CMPCR_READY                  ((uint32_t)0x00000100)
+
+/* USART */
+#define  USART_SR_PE                         ((uint16_t)0x0001)
+#define  USART_SR_FE                         ((uint16_t)0x0002)
+#define  USART_SR_NE                         ((uint16_t)0x0004)
+#define  USART_SR_ORE                        ((uint16_t)0x0008)
+#define  USART_SR_IDLE                       ((uint16_t)0x0010)
+#define  USART_SR_RXNE                       ((uint16_t)0x0020)
+#define  USART_SR_TC                         ((uint16_t)0x0040)
+#define  USART_SR_TXE                        ((uint16_t)0x0080)
+#define  USART_SR_LBD                        ((uint16_t)0x0100)
+#define  USART_SR_CTS                        ((uint16_t)0x0200)
+
+#define  USART_CR1_SBK                       ((uint16_t)0x0001)
+#define  USART_CR1_RWU                       ((uint16_t)0x0002)
+#define  USART_CR1_RE                        ((uint16_t)0x0004)
+#define  USART_CR1_TE                        ((uint16_t)0x0008)
+#define  USART_CR1_IDLEIE                    ((uint16_t)0x0010)
+#define  USART_CR1_RXNEIE                    ((uint16_t)0x0020)
+#define  USART_CR1_TCIE                      ((uint16_t)0x0040)
+#define  USART_CR1_TXEIE                     ((uint16_t)0x0080)
+#define  USART_CR1_PEIE                      ((uint16_t)0x0100)
+#define  USART_CR1_PS                        ((uint16_t)0x0200)
+#define  USART_CR1_PCE                       ((uint16_t)0x0400)
+#define  USART_CR1_WAKE                      ((uint16_t)0x0800)
+#define  USART_CR1_M                         ((uint16_t)0x1000)
+#define  USART_CR1_UE                        ((uint16_t)0x2000)
+#define  USART_CR1_OVER8                     ((uint16_t)0x8000)
+
+#define  USART_CR2_ADD                       ((uint16_t)0x000F)
+#define  USART_CR2_LBDL                      ((uint16_t)0x0020)
+#define  USART_CR2_LBDIE                     ((uint16_t)0x0040)
+#define  USART_CR2_LBCL                      ((uint16_t)0x0100)
+#define  USART_CR2_CPHA                      ((uint16_t)0x0200)
+#define  USART_CR2_CPOL                      ((uint16_t)0x0400)
+#define  USART_CR2_CLKEN                     ((uint16_t)0x0800)
+#define  USART_CR2_STOP                      ((uint16_t)0x3000)
+#define  USART_CR2_LINEN                     ((uint16_t)0x4000)
+
+#define  USART_CR3_EIE                       ((uint16_t)0x0001)
+#define  USART_CR3_IREN                      ((uint16_t)0x0002)
+#define  USART_CR3_IRLP                      ((uint16_t)0x0004)
+#define  USART_CR3_HDSEL                     ((uint16_t)0x0008)
+#define  USART_CR3_NACK                      ((uint16_t)0x0010)
+#define  USART_CR3_SCEN                      ((uint16_t)0x0020)
+#define  USART_CR3_DMAR                      ((uint16_t)0x0040)
+#define  USART_CR3_DMAT                      ((uint16_t)0x0080)
+#define  USART_CR3_RTSE                      ((uint16_t)0x0100)
+#define  USART_CR3_CTSE                      ((uint16_t)0x0200)
+#define  USART_CR3_CTSIE                     ((uint16_t)0x0400)
+#define  USART_CR3_ONEBIT                    ((uint16_t)0x0800)
+
+#define  USART_GTPR_PSC                      ((uint16_t)0x00FF)
+#define  USART_GTPR_GT                       ((uint16_t)0xFF00)
+
+/* DBGMCU */
+#define  DBGMCU_CR_DBG_SLEEP                 ((uint32_t)0x00000001)
+#define  DBGMCU_CR_DBG_STOP                  ((uint32_t)0x00000002)
+#define  DBGMCU_CR_DBG_STANDBY               ((uint32_t)0x00000004)
+
+#ifdef USE_STDPERIPH_DRIVER
+  #include "stm32f4xx_conf.h"
+#endif
+
+#endif /* __STM32F4xx_H */
@@ -0,0 +1,21 @@
+/*
+ * Library configuration for the simulation build: just the drivers the firmware uses
+ */
+#ifndef __STM32F4xx_CONF_H
+#define __STM32F4xx_CONF_H
+
+#include "stm32f4xx_dac.h"
+#include "stm32f4xx_dma.h"
+#include "stm32f4xx_exti.h"
+#include "stm32f4xx_gpio.h"
+#include "stm32f4xx_pwr.h"
+#include "stm32f4xx_rcc.h"
+#include "stm32f4xx_rtc.h"
+#include "stm32f4xx_syscfg.h"
+#include "stm32f4xx_tim.h"
+#include "stm32f4xx_usart.h"
+#include "misc.h"
+
+#define assert_param(expr) ((void)0)
+
+#endif /* __STM32F4xx_CONF_H */
@@ -0,0 +1,632 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "sim.h"
+
+// Runs the firmware at every tempo (1-999BPM) in every time signature and measures
+// the beats it plays against the ideal grid. Prints one line per combination, tab
+// separated, in a fixed order so reports from two versions can be diffed:
+//
+//   sig  bpm  beats  period_ns  period_ppm  drift_ns  max_err_ns  half_err_ns  click_err_ns  accents  faults
+//
+//   beats        beat onsets measured: the given number of bars after the one the
+//                sync starts, and the beat after them
+//   period_ns    mean period between them
+//   period_ppm   its error from 60/bpm, in parts per million
+//   drift_ns     how far the last onset is from where the grid puts it, i.e. the
+//                error accumulated over the bars
+//   max_err_ns   worst error of any onset from the grid
+//   half_err_ns  worst error of the LEDs going off from half-way through the beat
+//   click_err_ns worst distance from an onset, or the LEDs going off, to the nearest
+//                click the DAC played (there's a quieter one half-way through each beat)
+//   accents      onsets where the downbeat pattern was or wasn't shown wrongly
+//   faults       LCD busy writes and DMA errors
+//
+// Then it does the same for some runs that change the settings with the buttons, as
+// a user would, rather than setting them directly: presses of up, down and the time
+// signature buttons followed by a sync, and sequences of taps. These are one line
+// each, with what was pressed and the settings it should have left, and a last
+// column for whether the LCD shows them:
+//
+//   presses  sig  bpm  beats  ...  faults  screen
+//
+// Measuring starts once the sync button has been released, by which time the firmware
+// has certainly seen it and played the downbeat (which can't always be seen: the
+// LEDs may already be showing it). The grid is anchored at the first onset after
+// that, since the time it takes the firmware to react to the button isn't what's
+// being measured, and the onsets carry on through the bar from its second beat.
+// After taps there's no sync: measuring starts once the last tap has been released,
+// and the grid is the one the taps were on, with the first tap on a downbeat.
+//
+// Whether the LCD shows the settings the buttons should have left is checked after
+// the run, by setting the ones it started from directly and then the ones it should
+// have left: the screen has to change, then come back to what it was.
+//
+// Workers, one per core unless given, each simulate the firmware starting up once
+// and then run combination after combination on the same board, as a user would
+// set one after another. Each run starts on the next 10ms after the last one
+// finished, which is a whole number of time base ticks, DAC samples, audio blocks
+// and button polls, so what came before can't change what a run measures: the
+// report is the same whichever worker runs what, and in whatever order.
+//
+// The combinations are shared out with work stealing. Each worker starts with an
+// even share, as a range of them, and takes them from the front. Once it has run
+// out it steals the back half of whichever worker's range has most left, so the
+// slow tempos (which come first) don't hold everything up.
+//
+// Usage: metronome-sweep [-j workers] [-n bars] [-b min-max]
+
+// From the firmware
+void set_tempo(uint16_t bpm);
+void set_timesig(size_t signature);
+extern const char timesig_labels[9][4];
+extern bool lcd_update_pending;
+
+// The firmware's main(), renamed when it's built for the simulation, and the clock
+// set-up the startup code runs before it (see system_stm32f4xx.c)
+int  firmware_main(void);
+void SystemInit(void);
+
+#define SIGNATURES  9
+#define MAX_BPM     999
+#define DEFAULT_BARS 2
+#define MAX_WORKERS 256
+
+// The buttons (see main.c)
+#define BUTTON_TAP      (1 << 0)
+#define BUTTON_UP       (1 << 1)
+#define BUTTON_DOWN     (1 << 2)
+#define BUTTON_SYNC     (1 << 3)
+#define BUTTON_SIG_UP   (1 << 6)
+#define BUTTON_SIG_DOWN (1 << 7)
+
+// Most onsets that can be measured, i.e. the most bars times the most beats in a bar
+#define MAX_BARS    16
+#define MAX_ONSETS  (MAX_BARS * 9 + 1)
+
+// The grid is kept in whole microseconds, and the LED timer counts them, so an onset
+// can be up to a couple of microseconds off the ideal grid without anything being wrong
+#define TOLERANCE_NS 2000.0
+
+// A click goes on the audio sample nearest its beat, so it can be half a sample
+// either side of the LEDs as well
+#define CLICK_TOLERANCE_NS (TOLERANCE_NS + 1e9 / 48000 / 2)
+
+// The DAC's mid-scale, which is silence, and how long it has to stay there before
+// the output leaving it counts as a new click
+#define DAC_SILENCE      2048
+#define DAC_QUIET_CYCLES (SIM_CORE_HZ / 1000)
+
+// Downbeats show all the LEDs
+#define DOWNBEAT    0xFF
+
+// When things happen in each run, from its start: the tempo and time signature are
+// set (as if from an interrupt, rather than pressing the buttons hundreds of times),
+// then the sync button is pressed to start the bar
+#define SYNC_AT     (SIM_CORE_HZ / 10)
+#define SYNC_HOLD   (SIM_CORE_HZ / 50)
+
+// When the first run starts, once the firmware has started up, and what each one
+// after it starts on a multiple of
+#define FIRST_AT    (SIM_CORE_HZ / 10)
+#define RUN_ALIGN   (SIM_CORE_HZ / 100)
+
+// How long a button's held for in the runs from the buttons, unless it's held on purpose
+#define PRESS_HOLD_MS 100
+#define MAX_PRESSES   8
+#define MS            (SIM_CORE_HZ / 1000)
+
+typedef struct {
+	unsigned at_ms;   // From the start of the run
+	uint8_t  buttons;
+	unsigned hold_ms; // 0 for PRESS_HOLD_MS
+} sweep_press_t;
+
+// A run from the buttons: the settings it starts from, what's pressed (up to the
+// first entry with no buttons), and the settings they should leave it at, which
+// have to be different
+typedef struct {
+	const char   *name;
+	unsigned      from_sig;
+	unsigned      from_bpm;
+	sweep_press_t presses[MAX_PRESSES];
+	unsigned      sig;
+	unsigned      bpm;
+	bool          tapped;
+} sweep_presses_t;
+
+static const sweep_presses_t sweep_presses[] = {
+	{ "up x3", 3, 120,
+	  { { 100, BUTTON_UP }, { 400, BUTTON_UP }, { 700, BUTTON_UP }, { 1000, BUTTON_SYNC } },
+	  3, 123, false },
+	{ "down, sig+ x2", 3, 120,
+	  { { 100, BUTTON_DOWN }, { 400, BUTTON_SIG_UP }, { 700, BUTTON_SIG_UP }, { 1000, BUTTON_SYNC } },
+	  5, 119, false },
+	{ "up held, sig-", 3, 120,
+	  { { 100, BUTTON_UP, 800 }, { 1100, BUTTON_SIG_DOWN }, { 1400, BUTTON_SYNC } },
+	  2, 130, false },
+	{ "down held x2", 8, 75,
+	  { { 100, BUTTON_DOWN, 800 }, { 1100, BUTTON_DOWN, 800 }, { 2100, BUTTON_SYNC } },
+	  8, 60, false },
+	{ "taps", 3, 120,
+	  { { 100, BUTTON_TAP }, { 700, BUTTON_TAP }, { 1300, BUTTON_TAP }, { 1900, BUTTON_TAP },
+	    { 2500, BUTTON_TAP } },
+	  3, 100, true },
+	{ "taps, one fumbled", 2, 90,
+	  { { 100, BUTTON_TAP }, { 600, BUTTON_TAP }, { 1100, BUTTON_TAP }, { 1680, BUTTON_TAP },
+	    { 2100, BUTTON_TAP }, { 2600, BUTTON_TAP } },
+	  2, 120, true },
+};
+
+#define PRESS_RUNS (sizeof(sweep_presses) / sizeof(sweep_presses[0]))
+
+typedef struct {
+	bool     done;
+	uint32_t beats;
+	double   period_ns;
+	double   period_ppm;
+	double   drift_ns;
+	double   max_err_ns;
+	double   half_err_ns;
+	double   click_err_ns;
+	uint32_t accents;
+	uint32_t faults;
+	bool     screen_wrong;
+} sweep_result_t;
+
+// Shared between all the processes. Each worker's combinations still to run are
+// numbers first to end-1, packed into one word (first in the bottom half) so that a
+// range can be taken from in one compare-and-swap, by its worker or a thief.
+typedef struct {
+	uint64_t       ranges[MAX_WORKERS];
+	sweep_result_t results[SIGNATURES][MAX_BPM + 1];
+	sweep_result_t pressed[PRESS_RUNS];
+} sweep_shared_t;
+
+static sweep_shared_t *shared;
+
+static unsigned bars = DEFAULT_BARS;
+static unsigned bpm_min = 1;
+static unsigned bpm_max = MAX_BPM;
+static long     workers;
+
+// The worker this process is, the combination it's running (and the presses, if
+// it's from the buttons), when that started, when measuring it starts, and what it
+// has seen. The grid's anchored at a downbeat if there's one known (0 if not).
+static long     worker_num;
+static unsigned job_sig;
+static unsigned job_bpm;
+static const sweep_presses_t *job_presses;
+static sweep_result_t *job_result;
+static uint32_t job_beats;
+static uint64_t job_at = FIRST_AT;
+static uint64_t job_from = UINT64_MAX;
+static uint64_t job_anchor;
+static uint32_t job_faults;
+static uint64_t onsets[MAX_ONSETS];
+static uint8_t  onset_patterns[MAX_ONSETS];
+static uint64_t offs[MAX_ONSETS];
+static uint32_t onsets_num = 0;
+static uint32_t offs_num = 0;
+static uint8_t  last_pattern = 0;
+static uint64_t clicks[2 * MAX_ONSETS + 1];
+static uint32_t clicks_num = 0;
+static uint16_t dac_value = DAC_SILENCE;
+static uint64_t dac_since = 0;
+
+// What the LCD shows, whether it has changed since the last check, and what it
+// showed at the end of the last run from the buttons
+static char     screen[2][17];
+static bool     screen_changed;
+static char     pressed_screen[2][17];
+
+static void job_next(void);
+
+static void on_leds(uint64_t cycles, uint8_t pattern) {
+	if (cycles >= job_from) {
+		// A sync can start a beat while the last one's still showing
+		if (pattern && pattern != last_pattern && onsets_num < MAX_ONSETS) {
+			onset_patterns[onsets_num] = pattern;
+			onsets[onsets_num++] = cycles;
+		} else if (!pattern && last_pattern && onsets_num > 0 && offs_num < MAX_ONSETS) {
+			offs[offs_num++] = cycles;
+		}
+	}
+	last_pattern = pattern;
+}
+
+static void on_dac(uint64_t cycles, uint16_t value) {
+	if (cycles >= job_from && dac_value == DAC_SILENCE && value != DAC_SILENCE &&
+	    cycles - dac_since >= DAC_QUIET_CYCLES && clicks_num < 2 * MAX_ONSETS + 1) {
+		clicks[clicks_num++] = cycles;
+	}
+	dac_value = value;
+	dac_since = cycles;
+}
+
+static void on_lcd(uint64_t cycles, const char *row0, const char *row1) {
+	snprintf(screen[0], sizeof(screen[0]), "%s", row0);
+	snprintf(screen[1], sizeof(screen[1]), "%s", row1);
+	screen_changed = true;
+}
+
+/*
+ * Distance from a time to the nearest click, in cycles
+ */
+static double click_distance(uint64_t at) {
+	double nearest = INFINITY;
+	uint32_t i;
+
+	for (i = 0; i < clicks_num; i++) {
+		double distance = fabs((double) clicks[i] - (double) at);
+		if (distance < nearest) {
+			nearest = distance;
+		}
+	}
+	return nearest;
+}
+
+static void job_unset(void);
+static void job_check(void);
+
+/*
+ * Works the results out from the onsets at the end of the run, then has the next
+ * one start
+ */
+static void on_end(uint64_t cycles) {
+	sweep_result_t *result = job_result;
+	const sim_faults_t *faults = sim_faults();
+	// Ideal period, in cycles
+	double period = 60.0 * SIM_CORE_HZ / job_bpm;
+	// Where the onsets are measured from, which beat that is from a downbeat, and
+	// which the first onset is. After a sync, that's the first onset itself, the
+	// bar's second beat; after taps, it's the first tap.
+	uint64_t anchor = onsets[0];
+	double   anchor_beat = 1, first = 1;
+	uint32_t i;
+
+	if (job_anchor && onsets_num > 0) {
+		anchor      = job_anchor;
+		anchor_beat = 0;
+		first       = round((double) (onsets[0] - anchor) / period);
+	}
+
+	result->beats  = onsets_num;
+	result->faults = faults->lcd_busy_writes + faults->dma_errors - job_faults;
+
+	for (i = 0; i < onsets_num; i++) {
+		double err = (double) (onsets[i] - anchor) - (first + i - anchor_beat) * period;
+		if (fabs(err) > result->max_err_ns) {
+			result->max_err_ns = fabs(err);
+		}
+		if (i + 1 == onsets_num) {
+			result->drift_ns = err;
+		}
+		if ((onset_patterns[i] == DOWNBEAT) != ((uint32_t) (first + i) % job_beats == 0)) {
+			result->accents++;
+		}
+		if (click_distance(onsets[i]) > result->click_err_ns) {
+			result->click_err_ns = click_distance(onsets[i]);
+		}
+	}
+	for (i = 0; i < offs_num && i < onsets_num; i++) {
+		double err = fabs((double) (offs[i] - anchor) - (first + i - anchor_beat + 0.5) * period);
+		if (err > result->half_err_ns) {
+			result->half_err_ns = err;
+		}
+		if (click_distance(offs[i]) > result->click_err_ns) {
+			result->click_err_ns = click_distance(offs[i]);
+		}
+	}
+
+	if (onsets_num > 1) {
+		double mean = (double) (onsets[onsets_num - 1] - onsets[0]) / (onsets_num - 1);
+		result->period_ns  = mean;
+		result->period_ppm = (mean - period) / period * 1e6;
+	}
+
+	// Everything so far has been in cycles
+	result->period_ns   *= 1e9 / SIM_CORE_HZ;
+	result->drift_ns    *= 1e9 / SIM_CORE_HZ;
+	result->max_err_ns  *= 1e9 / SIM_CORE_HZ;
+	result->half_err_ns *= 1e9 / SIM_CORE_HZ;
+	result->click_err_ns *= 1e9 / SIM_CORE_HZ;
+	result->done = true;
+
+	// Carrying on until it has, with time for the LCD to be checked first if it's
+	// to be
+	job_at = (cycles / RUN_ALIGN + 1) * RUN_ALIGN;
+	if (job_presses) {
+		memcpy(pressed_screen, screen, sizeof(screen));
+		sim_call_at(job_at, job_unset);
+		sim_call_at(job_at + RUN_ALIGN, job_check);
+		job_at += 2 * RUN_ALIGN;
+	}
+	sim_call_at(job_at, job_next);
+	sim_run_for(job_at + RUN_ALIGN - cycles);
+}
+
+static uint64_t range_of(uint32_t first, uint32_t end) {
+	return (uint64_t) end << 32 | first;
+}
+
+/*
+ * Takes the next combination from this worker's range, or if that's empty, steals
+ * the back half of whichever range has most left. Returns false once there are
+ * none left anywhere.
+ */
+static bool job_take(uint32_t *job) {
+	uint64_t *own = &shared->ranges[worker_num];
+
+	for (;;) {
+		uint64_t range = __atomic_load_n(own, __ATOMIC_ACQUIRE);
+		uint32_t first = (uint32_t) range, end = (uint32_t) (range >> 32);
+		uint32_t most = 0, split;
+		long     victim = 0, w;
+
+		if (first < end) {
+			if (__atomic_compare_exchange_n(own, &range, range_of(first + 1, end), false,
+			                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				*job = first;
+				return true;
+			}
+			continue;
+		}
+
+		for (w = 0; w < workers; w++) {
+			range = __atomic_load_n(&shared->ranges[w], __ATOMIC_ACQUIRE);
+			if ((uint32_t) (range >> 32) - (uint32_t) range > most) {
+				most   = (uint32_t) (range >> 32) - (uint32_t) range;
+				victim = w;
+			}
+		}
+		if (most == 0) {
+			return false;
+		}
+
+		// Only thieves change a range once it's empty, and they leave empty ones alone,
+		// so this worker's own can just be written
+		range = __atomic_load_n(&shared->ranges[victim], __ATOMIC_ACQUIRE);
+		first = (uint32_t) range;
+		end   = (uint32_t) (range >> 32);
+		split = first + (end - first) / 2;
+		if (first < end && __atomic_compare_exchange_n(&shared->ranges[victim], &range,
+		                                               range_of(first, split), false,
+		                                               __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(own, range_of(split, end), __ATOMIC_RELEASE);
+		}
+	}
+}
+
+/*
+ * Starts a combination off, or a run from the buttons that should end up at it
+ */
+static void job_start(unsigned sig, unsigned bpm, const sweep_presses_t *presses) {
+	const sim_faults_t *faults = sim_faults();
+	double period = 60.0 * SIM_CORE_HZ / bpm;
+	const sweep_press_t *press;
+
+	job_sig     = sig;
+	job_bpm     = bpm;
+	job_presses = presses;
+	job_result  = presses ? &shared->pressed[presses - sweep_presses] : &shared->results[sig][bpm];
+	job_beats   = atoi(timesig_labels[sig]);
+	job_faults  = faults->lcd_busy_writes + faults->dma_errors;
+	job_anchor  = 0;
+	job_from    = UINT64_MAX; // Nothing counts while the settings are being changed
+	onsets_num  = 0;
+	offs_num    = 0;
+	clicks_num  = 0;
+
+	if (!presses) {
+		set_tempo(bpm);
+		set_timesig(sig);
+		lcd_update_pending = true;
+
+		sim_buttons_at(job_at + SYNC_AT, BUTTON_SYNC);
+		sim_buttons_at(job_at + SYNC_AT + SYNC_HOLD, 0);
+		job_from = job_at + SYNC_AT + SYNC_HOLD;
+	} else {
+		set_tempo(presses->from_bpm);
+		set_timesig(presses->from_sig);
+		lcd_update_pending = true;
+
+		for (press = presses->presses; press->buttons; press++) {
+			sim_buttons_at(job_at + press->at_ms * MS, press->buttons);
+			job_from = job_at + (press->at_ms + (press->hold_ms ? press->hold_ms : PRESS_HOLD_MS)) * MS;
+			sim_buttons_at(job_from, 0);
+		}
+		if (presses->tapped) {
+			job_anchor = job_at + presses->presses[0].at_ms * MS;
+		}
+	}
+
+	// Long enough for the beat after the last bar, and the LEDs going off after it
+	sim_run_for(job_from + (uint64_t) ((bars * job_beats + 1.75) * period) - sim_now());
+}
+
+/*
+ * After a run from the buttons, puts the settings back to what they were before it
+ * directly, which the screen has to change for
+ */
+static void job_unset(void) {
+	set_tempo(job_presses->from_bpm);
+	set_timesig(job_presses->from_sig);
+	lcd_update_pending = true;
+	screen_changed     = false;
+}
+
+/*
+ * Then sets what the buttons should have directly, which has to bring the screen
+ * back to what they left it showing
+ */
+static void job_check(void) {
+	job_result->screen_wrong = !screen_changed;
+	set_tempo(job_bpm);
+	set_timesig(job_sig);
+	lcd_update_pending = true;
+}
+
+/*
+ * Called in each worker once the firmware has started up, and after each run.
+ * Starts the next one, those from the buttons and then the combinations, slowest
+ * (lowest tempo) first, so the long ones don't all end up at the end. If there are
+ * none left, the worker's done.
+ */
+static void job_next(void) {
+	uint32_t job;
+
+	if (job_presses) {
+		job_result->screen_wrong |= memcmp(screen, pressed_screen, sizeof(screen)) != 0;
+		job_presses = NULL;
+	}
+
+	if (!job_take(&job)) {
+		exit(0);
+	}
+	if (job < PRESS_RUNS) {
+		job_start(sweep_presses[job].sig, sweep_presses[job].bpm, &sweep_presses[job]);
+	} else {
+		job -= PRESS_RUNS;
+		job_start(job % SIGNATURES, bpm_min + job / SIGNATURES, NULL);
+	}
+}
+
+static void worker(void) {
+	static const sim_observer_t observer = { on_leds, on_lcd, NULL, on_dac, on_end };
+
+	sim_init(&observer);
+	sim_call_at(FIRST_AT, job_next);
+	SystemInit();
+	firmware_main();
+	exit(2);
+}
+
+// Totals over the report
+static unsigned failed = 0, off_grid = 0, accents = 0, clicks_off = 0, screens_wrong = 0;
+static double   worst = 0.0;
+
+/*
+ * Prints a run's measurements, after whatever says which run it was, and adds them
+ * to the totals
+ */
+static void report(const sweep_result_t *r, unsigned sig) {
+	unsigned expected = bars * atoi(timesig_labels[sig]) + 1;
+
+	if (!r->done) {
+		printf("\tfailed");
+		failed++;
+		return;
+	}
+	printf("\t%u\t%.0f\t%.3f\t%.0f\t%.0f\t%.0f\t%.0f\t%u\t%u",
+	       r->beats, r->period_ns, r->period_ppm,
+	       r->drift_ns, r->max_err_ns, r->half_err_ns, r->click_err_ns, r->accents, r->faults);
+
+	if (r->beats != expected || r->faults) {
+		failed++;
+	}
+	if (r->max_err_ns > worst) {
+		worst = r->max_err_ns;
+	}
+	if (r->max_err_ns > TOLERANCE_NS || r->half_err_ns > TOLERANCE_NS) {
+		off_grid++;
+	}
+	if (r->click_err_ns > CLICK_TOLERANCE_NS) {
+		clicks_off++;
+	}
+	accents += r->accents;
+}
+
+static void usage(const char *program) {
+	fprintf(stderr, "usage: %s [-j workers] [-n bars] [-b min-max]\n", program);
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	unsigned jobs, sig, bpm;
+	long i;
+	int opt;
+
+	workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers > MAX_WORKERS) {
+		workers = MAX_WORKERS;
+	}
+	while ((opt = getopt(argc, argv, "j:n:b:")) != -1) {
+		switch (opt) {
+			case 'j': workers = strtol(optarg, NULL, 10); break;
+			case 'n': bars = strtoul(optarg, NULL, 10); break;
+			case 'b':
+				if (sscanf(optarg, "%u-%u", &bpm_min, &bpm_max) != 2) {
+					usage(argv[0]);
+				}
+				break;
+			default:  usage(argv[0]);
+		}
+	}
+	if (workers < 1 || workers > MAX_WORKERS || bars < 1 || bars > MAX_BARS ||
+	    bpm_min < 1 || bpm_max > MAX_BPM || bpm_min > bpm_max) {
+		usage(argv[0]);
+	}
+
+	shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		perror("metronome-sweep");
+		return 2;
+	}
+	fflush(stdout);
+
+	// An even share each to start with
+	jobs = PRESS_RUNS + (bpm_max - bpm_min + 1) * SIGNATURES;
+	for (i = 0; i < workers; i++) {
+		shared->ranges[i] = range_of((uint32_t) (jobs * i / workers), (uint32_t) (jobs * (i + 1) / workers));
+	}
+
+	for (i = 0; i < workers; i++) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			worker_num = i;
+			worker();
+			_exit(0);
+		}
+		if (pid < 0) {
+			perror("metronome-sweep");
+			return 2;
+		}
+	}
+	while (wait(NULL) > 0);
+
+	printf("sig\tbpm\tbeats\tperiod_ns\tperiod_ppm\tdrift_ns\tmax_err_ns\thalf_err_ns\tclick_err_ns\taccents\tfaults\n");
+	for (sig = 0; sig < SIGNATURES; sig++) {
+		for (bpm = bpm_min; bpm <= bpm_max; bpm++) {
+			printf("%s\t%u", timesig_labels[sig], bpm);
+			report(&shared->results[sig][bpm], sig);
+			printf("\n");
+		}
+	}
+
+	printf("presses\tsig\tbpm\tbeats\tperiod_ns\tperiod_ppm\tdrift_ns\tmax_err_ns\thalf_err_ns\tclick_err_ns\taccents\tfaults\tscreen\n");
+	for (i = 0; i < (long) PRESS_RUNS; i++) {
+		const sweep_presses_t *presses = &sweep_presses[i];
+		const sweep_result_t  *r = &shared->pressed[i];
+
+		printf("%s\t%s\t%u", presses->name, timesig_labels[presses->sig], presses->bpm);
+		report(r, presses->sig);
+		if (r->done) {
+			printf("\t%s", r->screen_wrong ? "wrong" : "ok");
+			screens_wrong += r->screen_wrong;
+		}
+		printf("\n");
+	}
+
+	printf("# %u combinations and %u runs from the buttons, %u failed, %u off the grid, %u accents wrong, "
+	       "%u clicks off, %u screens wrong, worst error %.0fns\n",
+	       jobs - (unsigned) PRESS_RUNS, (unsigned) PRESS_RUNS, failed, off_grid, accents, clicks_off,
+	       screens_wrong, worst);
+
+	return failed || off_grid || accents || clicks_off || screens_wrong ? 1 : 0;
+}
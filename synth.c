@@ -0,0 +1,225 @@
+#include <stddef.h>
+#include <stm32f4xx.h>
+#include "synth.h"
+#include "adpcm.h"
+#include "samples.h"
+
+// Works out the clicks' samples, a block at a time, for the DAC (see audio.c).
+//
+// The synthesised clicks are short wavetables, one for each kind of click, worked
+// out once at start-up, and a voice plays one by stepping through it at a gain of its
+// own. The tables hold 16-bit samples, 16 times finer than the DAC's, so a quiet
+// click keeps its shape. Between the tables, and before the first, are a block's
+// worth of zeros, so a voice that starts or finishes part-way through a block can be
+// read right across it: its part of the block just comes out silent.
+//
+// The sampled sounds are too long to keep like that, so they stay in flash as ADPCM
+// (see samples.c), and a voice playing one decodes just the block's worth it needs
+// each time, into a block of its own with the silence either side filled in. So
+// they cost the same to play, a block at a time, however long they are: one sample
+// decoded for each one played, and never more than a block's worth for each voice.
+// Every kind of click is the same sound, at its own gain.
+//
+// The voices are mixed in pairs with the Cortex-M4's DSP instructions. A sample from
+// each voice of the pair goes into one word, and __SMLAD multiplies both by their
+// gains and adds them up in one go. The result is saturated back to 16 bits with
+// __SSAT, two output samples go into a word, and __QADD16 adds both to the mix at
+// once, saturating each. So a block of 32 samples is 16 words of mix, and the whole
+// of it goes to the DAC two samples at a time as well. The simulation has the same
+// instructions in plain C (see sim/stm32f4xx.h), so what it plays is exactly what
+// the board does.
+
+// Samples in each wavetable: 16ms, by when every click has died away below the DAC's
+// resolution. Each dies away long before the next half-beat even at 999BPM, so more
+// than one voice only overlap after a tempo change or a sync (or with a sampled
+// sound, which can ring on for longer).
+#define SYNTH_LENGTH 768
+
+// Room for the tables, and the zeros before, between and after them
+#define SYNTH_STRIDE      (AUDIO_BLOCK + SYNTH_LENGTH)
+#define SYNTH_TABLES_SIZE (AUDIO_CLICKS * SYNTH_STRIDE + AUDIO_BLOCK)
+
+// Voices that can be sounding at once. Must be even, as they're mixed in pairs. When
+// there are more clicks than that the oldest is cut short.
+#define SYNTH_VOICES 4
+
+// Each synthesised click is a tone dying away over a millisecond or two: the impulse
+// response of a resonator, y[n] = a1*y[n-1] - a2*y[n-2], with a1 = 2r.cos(w) and
+// a2 = r^2 in Q14 (w for the pitch, and r for the time constant). The impulse is
+// picked so each peaks at about the same level.
+#define SYNTH_Q 14
+
+typedef struct {
+	int32_t a1;
+	int32_t a2;
+	int32_t impulse;
+} synth_resonator_t;
+
+static const synth_resonator_t synth_resonators[AUDIO_CLICKS] = {
+	[AUDIO_ACCENT]      = { 29960, 16046, 11056 }, // 3kHz, 2ms
+	[AUDIO_BEAT]        = { 31323, 16046,  7680 }, // 2kHz, 2ms
+	[AUDIO_SUBDIVISION] = { 27793, 15715, 14500 }  // 4kHz, 1ms
+};
+
+// How loud each kind of click is, in Q15, whatever it sounds like
+static const int16_t synth_gains[AUDIO_CLICKS] = {
+	[AUDIO_ACCENT]      = 32767, // Full
+	[AUDIO_BEAT]        = 19661, // 0.6
+	[AUDIO_SUBDIVISION] = 11469  // 0.35
+};
+
+// The sampled sounds
+static const adpcm_sound_t *const synth_samples[AUDIO_SOUNDS] = {
+	[AUDIO_WOODBLOCK] = &samples_woodblock,
+	[AUDIO_COWBELL]   = &samples_cowbell
+};
+
+// A click that's playing, or waiting to
+typedef struct {
+	const int16_t *table;  // Its wavetable, if it's synthesised (otherwise NULL)
+	adpcm_state_t  adpcm;  // How far it has been decoded, if it's sampled
+	int32_t        at;     // Sample of it the next block starts on (negative before it starts)
+	uint32_t       length; // Samples in it (0 when the voice is free)
+	int16_t        gain;   // Q15
+} synth_voice_t;
+
+static int16_t       synth_tables[SYNTH_TABLES_SIZE];
+static synth_voice_t synth_voices[SYNTH_VOICES];
+
+/*
+ * Plays a click in one of the sounds, a number of samples after the start of the
+ * next block. Must be called from an interrupt at the same priority as the DAC's DMA
+ * (see audio_click()).
+ */
+void synth_play(uint32_t delay, audio_sound_t sound, audio_click_t click) {
+	synth_voice_t *voice = &synth_voices[0];
+
+	// Take a free voice, or if there isn't one, the one that has been playing longest
+	for (size_t v = 0; v < SYNTH_VOICES; v++) {
+		if (synth_voices[v].length == 0) {
+			voice = &synth_voices[v];
+			break;
+		}
+		if (synth_voices[v].at > voice->at) {
+			voice = &synth_voices[v];
+		}
+	}
+
+	if (sound == AUDIO_SYNTHESISED) {
+		voice->table  = &synth_tables[AUDIO_BLOCK + click * SYNTH_STRIDE];
+		voice->length = SYNTH_LENGTH;
+	} else {
+		voice->table  = NULL;
+		voice->length = synth_samples[sound]->length;
+		adpcm_start(&voice->adpcm, synth_samples[sound]);
+	}
+	voice->at   = -(int32_t) delay;
+	voice->gain = synth_gains[click];
+}
+
+/*
+ * A voice's samples for the next block. If it has any in it they're from its
+ * wavetable, or decoded into the block given, otherwise they're the zeros before the
+ * first table.
+ */
+static const int16_t *synth_block(synth_voice_t *voice, int16_t *decoded) {
+	int32_t lead, count;
+
+	if (voice->length == 0 || voice->at <= -AUDIO_BLOCK) {
+		return synth_tables;
+	}
+	if (voice->table != NULL) {
+		return voice->table + voice->at;
+	}
+
+	// Silence before it starts, and after it finishes
+	lead  = voice->at < 0 ? -voice->at : 0;
+	count = (int32_t) voice->length - (voice->at + lead);
+	if (count > AUDIO_BLOCK - lead) {
+		count = AUDIO_BLOCK - lead;
+	}
+
+	for (int32_t n = 0; n < lead; n++) {
+		decoded[n] = 0;
+	}
+	adpcm_decode(&voice->adpcm, decoded + lead, (size_t) count);
+	for (int32_t n = lead + count; n < AUDIO_BLOCK; n++) {
+		decoded[n] = 0;
+	}
+	return decoded;
+}
+
+/*
+ * Mixes a block of two voices into the mix, at their gains (one in each half-word)
+ */
+static void synth_mix_pair(uint32_t *mix, const int16_t *a, const int16_t *b, uint32_t gains) {
+	for (size_t n = 0; n < AUDIO_BLOCK / 2; n++) {
+		int32_t first  = (int32_t) __SMLAD(__PKHBT(a[2 * n],     b[2 * n],     16), gains, 0);
+		int32_t second = (int32_t) __SMLAD(__PKHBT(a[2 * n + 1], b[2 * n + 1], 16), gains, 0);
+
+		mix[n] = __QADD16(mix[n], __PKHBT(__SSAT(first >> 15, 16), __SSAT(second >> 15, 16), 16));
+	}
+}
+
+/*
+ * Works out the next block of samples for the DAC, two to a word, mixing in whatever
+ * clicks are due in it. Returns whether there were any playing or waiting to.
+ */
+bool synth_render(uint32_t *block) {
+	uint32_t mix[AUDIO_BLOCK / 2] = { 0 };
+	bool     sounding = false;
+
+	for (size_t v = 0; v < SYNTH_VOICES; v += 2) {
+		synth_voice_t *a = &synth_voices[v];
+		synth_voice_t *b = &synth_voices[v + 1];
+		int16_t decoded[2][AUDIO_BLOCK];
+
+		if (a->length == 0 && b->length == 0) {
+			continue;
+		}
+		synth_mix_pair(mix, synth_block(a, decoded[0]), synth_block(b, decoded[1]),
+		               __PKHBT(a->gain, b->gain, 16));
+	}
+
+	for (size_t v = 0; v < SYNTH_VOICES; v++) {
+		synth_voice_t *voice = &synth_voices[v];
+
+		if (voice->length == 0) {
+			continue;
+		}
+		sounding = true;
+
+		voice->at += AUDIO_BLOCK;
+		if (voice->at >= (int32_t) voice->length) {
+			voice->length = 0;
+		}
+	}
+
+	// Each half-word down to the DAC's 12 bits (the top of the other one's shifted out
+	// of the way), then from signed to the DAC's offset binary, where 0x800 is silence
+	for (size_t n = 0; n < AUDIO_BLOCK / 2; n++) {
+		block[n] = ((mix[n] >> 4) & 0x0FFF0FFF) ^ 0x08000800;
+	}
+
+	return sounding;
+}
+
+/*
+ * Works out the wavetables
+ */
+void synth_init(void) {
+	for (size_t c = 0; c < AUDIO_CLICKS; c++) {
+		const synth_resonator_t *resonator = &synth_resonators[c];
+		int16_t *table = &synth_tables[AUDIO_BLOCK + c * SYNTH_STRIDE];
+		int32_t  y1 = 0, y2 = 0;
+
+		for (size_t n = 0; n < SYNTH_LENGTH; n++) {
+			int32_t y = n == 0 ? resonator->impulse :
+			            ((resonator->a1 * y1) >> SYNTH_Q) - ((resonator->a2 * y2) >> SYNTH_Q);
+
+			y2 = y1;
+			y1 = y;
+			table[n] = (int16_t) y;
+		}
+	}
+}
@@ -0,0 +1,12 @@
+#ifndef _SYNTH_H_
+#define _SYNTH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "audio.h"
+
+void synth_init(void);
+void synth_play(uint32_t delay, audio_sound_t sound, audio_click_t click);
+bool synth_render(uint32_t *block);
+
+#endif /*_SYNTH_H_*/
@@ -0,0 +1,368 @@
+#include "tap.h"
+#include <stdbool.h>
+
+// Recent taps, in a ring so a new one just replaces the oldest, along with the beat
+// each was put on (counting from whichever tap was oldest at the last full fit) and
+// whether it was on the beat (see tap_fit())
+static uint64_t taps[MAX_TAP_TEMPO_SAMPLES];
+static uint32_t tap_beats[MAX_TAP_TEMPO_SAMPLES];
+static bool     tap_good[MAX_TAP_TEMPO_SAMPLES];
+static uint32_t taps_num  = 0; // How many of the ring are in use
+static uint32_t taps_next = 0; // Where the next one goes (the oldest, when full)
+
+// Whether there's a sequence going (i.e. whether there are any taps in the ring),
+// and when it started. The first tap is taken to be a downbeat.
+static bool     tapping   = false;
+static uint64_t sequence_start_us = 0;
+
+// How much the last fit can be trusted, as a percentage (see tap_confidence())
+static uint8_t  confidence = 0;
+
+// The least-squares sums over the taps on the beat: how many there are, and their
+// beats k and times t, both counted from the oldest tap in the ring. They're kept up
+// to date as taps come into the ring and drop out of it, so a tap on the line costs
+// the same however many taps there are (see tap_follow()); only one off it needs the
+// full fit. Counted from the oldest tap they stay as small as the fit's own (see
+// below), so the same bounds apply.
+static int64_t  fit_n = 0, fit_k = 0, fit_kk = 0, fit_t = 0, fit_kt = 0;
+static bool     fit_valid  = false; // Whether they give a line
+static int32_t  fit_period = 0;     // Its slope, to the nearest microsecond
+
+// The line the last fit found, if it could be trusted (see tap_line())
+static bool     line_valid    = false;
+static uint64_t line_beat_us  = 0; // Where it puts the newest tap
+static uint64_t line_period_q = 0; // Its slope, as 32.32 fixed-point microseconds
+
+// Working space for the fit. It's kept here rather than on the stack, which is only
+// 1KB (see startup_stm32f4xx.s) and is shared with the interrupts. The times are
+// relative to the oldest tap, so (with every interval under
+// TAP_TEMPO_FORGET_THRESHOLD) they're under 48,000,000us and fit 32 bits.
+static int32_t  times[MAX_TAP_TEMPO_SAMPLES];   // When each tap was
+static uint32_t beats[MAX_TAP_TEMPO_SAMPLES];   // Which beat each tap was on
+static int32_t  scratch[MAX_TAP_TEMPO_SAMPLES]; // For finding medians in
+
+static uint16_t tap_solve(int32_t period);
+
+/*
+ * Gets where in the ring the i'th oldest tap is
+ */
+static uint32_t tap_index(uint32_t i) {
+	return (taps_next + MAX_TAP_TEMPO_SAMPLES - taps_num + i) % MAX_TAP_TEMPO_SAMPLES;
+}
+
+/*
+ * Gets the i'th oldest tap in the ring
+ */
+static uint64_t tap_at(uint32_t i) {
+	return taps[tap_index(i)];
+}
+
+/*
+ * Finds the median of some values (reordering them). An insertion sort is fine
+ * for so few, and its worst case is still only a few hundred comparisons.
+ */
+static int32_t median(int32_t *values, uint32_t num) {
+	uint32_t i, j;
+
+	for (i = 1; i < num; i++) {
+		int32_t value = values[i];
+		for (j = i; j > 0 && values[j - 1] > value; j--) {
+			values[j] = values[j - 1];
+		}
+		values[j] = value;
+	}
+
+	return num % 2 ? values[num / 2] : (values[num / 2 - 1] + values[num / 2]) / 2;
+}
+
+/*
+ * Fits a straight line through the taps in the ring - tap time against beat number,
+ * whose slope is the beat period - and works out the tempo from it. The fit has to
+ * cope with the odd fumbled tap (early, late, doubled or missed), so it's done in
+ * two steps:
+ *
+ *  - A rough line is found from medians, which one or two bad taps can't move far:
+ *    its slope is the median interval, each tap is put on the beat nearest to where
+ *    that slope puts it after the tap before, and the line goes through the median
+ *    of the taps' offsets from their beats.
+ *  - The taps more than a fraction of a beat off the rough line are thrown out, and
+ *    a least-squares line fitted through the rest gives the period. It takes every
+ *    good tap into account, so is more accurate than the median.
+ *
+ * This is O(n^2) in the number of taps, so it's only done when a tap doesn't fit
+ * the line the others make (see tap_follow()).
+ *
+ * Returns the tempo, or 0 if there aren't enough taps. The number of the newest
+ * taps in a row that were thrown out is left in *outliers_last.
+ */
+static uint16_t tap_fit(uint32_t *outliers_last) {
+	int32_t  period, offset, tolerance;
+	uint64_t first = tap_at(0);
+	uint32_t i;
+
+	*outliers_last = 0;
+	line_valid     = false;
+	fit_valid      = false;
+	if (taps_num < 2) {
+		return 0;
+	}
+
+	for (i = 0; i < taps_num; i++) {
+		times[i] = (int32_t) (tap_at(i) - first);
+	}
+
+	// The rough period is the median interval
+	for (i = 1; i < taps_num; i++) {
+		scratch[i - 1] = times[i] - times[i - 1];
+	}
+	period = median(scratch, taps_num - 1);
+	if (period < TAP_TEMPO_MIN_INTERVAL) {
+		return 0;
+	}
+
+	// Put each tap on a beat. One that's too close to the last to be the next beat
+	// (a double tap) goes on the same beat, and one that's two beats after the last
+	// (a missed tap) goes two beats on, so one bad tap doesn't shift all the others.
+	beats[0] = 0;
+	for (i = 1; i < taps_num; i++) {
+		beats[i] = beats[i - 1] + (times[i] - times[i - 1] + period / 2) / period;
+	}
+
+	// The rough line goes through the median offset from the beats
+	for (i = 0; i < taps_num; i++) {
+		scratch[i] = times[i] - (int32_t) beats[i] * period;
+	}
+	offset    = median(scratch, taps_num);
+	tolerance = period / TAP_TEMPO_OUTLIER_FRACTION;
+
+	// Fit through the taps close enough to the rough line
+	fit_n = fit_k = fit_kk = fit_t = fit_kt = 0;
+	for (i = 0; i < taps_num; i++) {
+		int32_t error = times[i] - offset - (int32_t) beats[i] * period;
+
+		tap_beats[tap_index(i)] = beats[i];
+		tap_good[tap_index(i)]  = error <= tolerance && error >= -tolerance;
+		if (!tap_good[tap_index(i)]) {
+			(*outliers_last)++;
+			continue;
+		}
+		*outliers_last = 0;
+
+		fit_n++;
+		fit_k  += beats[i];
+		fit_kk += (int64_t) beats[i] * beats[i];
+		fit_t  += times[i];
+		fit_kt += (int64_t) beats[i] * times[i];
+	}
+
+	return tap_solve(period);
+}
+
+/*
+ * Works out the tempo and the line from the least-squares sums. If there's no line
+ * to fit (fewer than two good taps, or all on the same beat), the tempo comes from
+ * the given period instead.
+ */
+static uint16_t tap_solve(int32_t period) {
+	int64_t  n = fit_n;
+	int64_t  num, den;
+	uint64_t first = tap_at(0);
+
+	line_valid = false;
+	fit_valid  = false;
+
+	// The least-squares slope is num / den. With at most 800 beats (the shortest
+	// period there can be) in at most 48s, both fit in 64 bits, as does a minute
+	// times den below.
+	num = n * fit_kt - fit_k * fit_t;
+	den = n * fit_kk - fit_k * fit_k;
+
+	// Only enough good taps to tell a bad tap from the beat can be trusted
+	confidence = n >= TAP_TEMPO_LOCK_TAPS ? (uint8_t) (100 * n / taps_num) : 0;
+
+	if (n < 2 || den <= 0 || num <= 0) {
+		return (uint16_t) ((TAP_US_PER_MINUTE + period / 2) / period);
+	}
+
+	// The good taps can still be closer together than the median, so keep the slope
+	// to a tempo that can be shown (1-999BPM)
+	if (num < (int64_t) TAP_TEMPO_MIN_INTERVAL * den) {
+		num = (int64_t) TAP_TEMPO_MIN_INTERVAL * den;
+	} else if (num > (int64_t) TAP_US_PER_MINUTE * den) {
+		num = (int64_t) TAP_US_PER_MINUTE * den;
+	}
+	fit_valid  = true;
+	fit_period = (int32_t) ((num + den / 2) / den);
+
+	// Where the line puts the newest tap: it goes through the mean of the good taps,
+	// so that's the mean time plus the slope times how many beats on from the mean
+	// beat the tap is. Everything is scaled up by n * den so it can all be divided
+	// (and rounded) at once at the end; with the bounds above it stays well within
+	// 64 bits. The period is split into whole microseconds and a binary fraction,
+	// 16 bits at a time so the remainder never needs shifting past 64 bits.
+	if (confidence > 0) {
+		int64_t  scale = n * den;
+		int64_t  beat  = n * (tap_beats[tap_index(taps_num - 1)] - tap_beats[tap_index(0)]) - fit_k;
+		uint64_t rem   = (uint64_t) (num % den);
+		uint32_t frac;
+
+		frac  = (uint32_t) ((rem << 16) / (uint64_t) den) << 16;
+		rem   = (rem << 16) % (uint64_t) den;
+		frac |= (uint32_t) ((rem << 16) / (uint64_t) den);
+
+		line_beat_us  = first + (uint64_t) ((fit_t * den + num * beat + scale / 2) / scale);
+		line_period_q = ((uint64_t) (num / den) << 32) | frac;
+		line_valid    = true;
+	}
+
+	// BPM is a minute over the period, rounded to the nearest
+	return (uint16_t) (((int64_t) TAP_US_PER_MINUTE * den + num / 2) / num);
+}
+
+/*
+ * Drops the oldest tap from the full ring, taking it out of the least-squares sums
+ * and counting them from the next oldest instead. As the oldest tap is where they're
+ * counted from, it adds nothing to them but its count; moving where they're counted
+ * from is just expanding the squares.
+ */
+static void tap_forget_oldest(void) {
+	uint32_t oldest = tap_index(0), next = tap_index(1);
+	int64_t  dk = tap_beats[next] - tap_beats[oldest];
+	int64_t  dt = (int64_t) (taps[next] - taps[oldest]);
+
+	if (tap_good[oldest]) {
+		fit_n--;
+	}
+	fit_kk -= 2 * dk * fit_k - fit_n * dk * dk;
+	fit_kt -= dk * fit_t + dt * fit_k - fit_n * dk * dt;
+	fit_k  -= fit_n * dk;
+	fit_t  -= fit_n * dt;
+}
+
+/*
+ * Adds the newest tap to the least-squares sums if it's on the beat where the line
+ * through the others puts it, i.e. within the same tolerance the full fit uses, and
+ * works out the tempo again from them, all in constant time.
+ *
+ * Returns false, leaving the sums alone, if there's no line yet or the tap is off
+ * it, so the full fit is needed (see tap_fit()).
+ */
+static bool tap_follow(uint16_t *bpm) {
+	uint32_t newest = tap_index(taps_num - 1), last = tap_index(taps_num - 2);
+	int64_t  num, den, scale, k, t, error;
+
+	if (!fit_valid || taps_num < 2) {
+		return false;
+	}
+
+	// Put it on the beat nearest to where the line's period puts it after the last.
+	// A double tap (on the same beat) is left for the full fit to sort out.
+	tap_beats[newest] = tap_beats[last] +
+	                    (uint32_t) ((taps[newest] - taps[last] + fit_period / 2) / fit_period);
+	if (tap_beats[newest] == tap_beats[last]) {
+		return false;
+	}
+
+	// How far the tap is from the line, scaled up by n * den as in tap_solve()
+	num   = fit_n * fit_kt - fit_k * fit_t;
+	den   = fit_n * fit_kk - fit_k * fit_k;
+	scale = fit_n * den;
+	k     = tap_beats[newest] - tap_beats[tap_index(0)];
+	t     = (int64_t) (taps[newest] - tap_at(0));
+	error = t * scale - fit_t * den - num * (fit_n * k - fit_k);
+	if (error > fit_period / TAP_TEMPO_OUTLIER_FRACTION * scale ||
+	    error < -(fit_period / TAP_TEMPO_OUTLIER_FRACTION * scale)) {
+		return false;
+	}
+
+	tap_good[newest] = true;
+	fit_n++;
+	fit_k  += k;
+	fit_kk += k * k;
+	fit_t  += t;
+	fit_kt += k * t;
+
+	*bpm = tap_solve(fit_period);
+	return true;
+}
+
+/*
+ * Records a tap and works out the tempo from the recent taps, up to a maximum
+ * number of them (see tap_fit()).
+ *
+ * Taps must happen within a certain time threshold of each other in order to be
+ * considered part of the same sequence. Returns 0 if this tap starts a new
+ * sequence, as there's no tempo to give yet.
+ */
+uint16_t tap_record(uint64_t now_us) {
+	uint32_t outliers_last;
+	uint16_t bpm;
+
+	if (!tapping || now_us - tap_at(taps_num - 1) >= TAP_TEMPO_FORGET_THRESHOLD) {
+		taps_num   = 0;
+		taps_next  = 0;
+		confidence = 0;
+		fit_valid  = false;
+		tapping    = true;
+		sequence_start_us = now_us;
+	}
+
+	// Once the ring is full the new tap takes the place of the oldest
+	if (taps_num == MAX_TAP_TEMPO_SAMPLES) {
+		tap_forget_oldest();
+	} else {
+		taps_num++;
+	}
+	taps[taps_next] = now_us;
+	if (++taps_next == MAX_TAP_TEMPO_SAMPLES) {
+		taps_next = 0;
+	}
+
+	// A tap on the beat just updates the fit; only one off it needs it done again
+	outliers_last = 0;
+	if (!tap_follow(&bpm)) {
+		bpm = tap_fit(&outliers_last);
+	}
+
+	// One bad tap is a fumble, but two in a row means the tempo has changed. Forget
+	// everything before them so it doesn't take half the ring to change it. The new
+	// tempo's bars are counted from the last tap at the old one.
+	if (outliers_last >= 2 && taps_num > 3) {
+		taps_num = 3;
+		sequence_start_us = tap_at(0);
+		bpm = tap_fit(&outliers_last);
+	}
+
+	return bpm;
+}
+
+/*
+ * How much the tempo from the last tap can be trusted, as a percentage: the share of
+ * the taps it was worked out from that were on the beat, or 0 if there weren't
+ * enough good taps to be sure which those were.
+ */
+uint8_t tap_confidence(void) {
+	return confidence;
+}
+
+/*
+ * Gives the beat grid the taps are on, if the tempo from the last tap can be trusted:
+ * when the beat of the newest tap was (which can be a little before or after the tap
+ * itself), the period as 32.32 fixed-point microseconds, and which beat of the
+ * sequence it was, counting the first tap as beat 0.
+ *
+ * Returns false, leaving them alone, if there isn't a trusted grid.
+ */
+bool tap_line(uint64_t *beat_us, uint64_t *period_q, uint32_t *beat_num) {
+	uint64_t period_us = (line_period_q + (1ULL << 31)) >> 32;
+
+	if (!line_valid) {
+		return false;
+	}
+
+	*beat_us  = line_beat_us;
+	*period_q = line_period_q;
+	*beat_num = line_beat_us > sequence_start_us ?
+	            (uint32_t) ((line_beat_us - sequence_start_us + period_us / 2) / period_us) : 0;
+	return true;
+}
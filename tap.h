@@ -0,0 +1,46 @@
+#ifndef _TAP_H_
+#define _TAP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Whether taps set the beat (which beat of the bar is on the first tap, and when the
+// following beats fall) as well as the tempo, so there's no need to sync after
+// tapping. Set to 0 for taps to change the tempo only.
+#ifndef TAP_PHASE_LOCK
+#define TAP_PHASE_LOCK 1
+#endif
+
+// Max number of recent taps to fit the tap tempo to
+#define MAX_TAP_TEMPO_SAMPLES 32
+
+// Number of microseconds before a tap is counted as a new sequence rather
+// than part of the previous sequence. 1.5s means a lower limit of 40BPM
+// which seems reasonable. If the user wants to go lower, they can still manually
+// lower the BPM with the up/down buttons
+#define TAP_TEMPO_FORGET_THRESHOLD 1500000
+
+// Shortest interval between taps that can be a beat, in microseconds: 999BPM, the
+// most the display can show, rounded up to a whole microsecond
+#define TAP_TEMPO_MIN_INTERVAL 60061
+
+// Taps further than this fraction of a beat from where the others put them are
+// taken to be fumbled, and left out of the tempo
+#define TAP_TEMPO_OUTLIER_FRACTION 8
+
+// Number of taps on the beat needed before the tempo can be trusted, i.e. before a
+// fumbled tap can be told apart from the beat
+#define TAP_TEMPO_LOCK_TAPS 3
+
+// Percentage of the taps that must be on the beat for the beat grid to be moved onto
+// them (see tap_confidence()). With fewer, the taps only set the tempo.
+#define TAP_TEMPO_LOCK_CONFIDENCE 75
+
+// Number of microseconds in a minute, for working out BPM from a tap interval
+#define TAP_US_PER_MINUTE 60000000UL
+
+uint16_t tap_record(uint64_t now_us);
+uint8_t  tap_confidence(void);
+bool     tap_line(uint64_t *beat_us, uint64_t *period_q, uint32_t *beat_num);
+
+#endif /*_TAP_H_*/
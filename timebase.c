@@ -0,0 +1,104 @@
+#include <stm32f4xx_rcc.h>
+#include <stm32f4xx_tim.h>
+#include <stm32f4xx.h>
+#include "timebase.h"
+#include "clock.h"
+
+// The system time is TIM2, free-running through its full 32 bits at 1MHz, with the
+// number of times it has wrapped around kept here as the top 32 bits. The counter
+// alone would wrap after 71 minutes, which is shorter than a long rehearsal; with
+// 64 bits there's nominally 585,000 years of run-time, which should be plenty.
+//
+// TIM2 is used rather than the DWT cycle counter because the core clock (and so the
+// cycle counter) stops while the processor sleeps, and TIM2 also drives the beat
+// compares, so everything works from the same count.
+//
+// The two halves can't be read in one go on a Cortex-M4, so timebase_now() takes
+// care that they always agree with each other (see below).
+static volatile uint32_t timebase_wraps = 0;
+
+/*
+ * Gives the system time since startup in microseconds. Safe to call from the main
+ * loop and from any interrupt, at any priority, including with interrupts masked.
+ *
+ * The wrap count acts like the sequence number of a seqlock: if it changes while
+ * the counter is being read then the interrupt has run in between, so just read
+ * everything again. That alone isn't enough inside an interrupt (or with interrupts
+ * masked), because the wrap interrupt can't run to count a wrap that has just
+ * happened. In that case the update flag is still up, so count it here instead - but
+ * only if the counter was read after the wrap (i.e. it's small), not just before it.
+ */
+uint64_t timebase_now(void) {
+	uint32_t wraps, count, wrap_pending;
+
+	do {
+		wraps        = timebase_wraps;
+		count        = TIM2->CNT;
+		wrap_pending = TIM2->SR & TIM_SR_UIF;
+	} while (wraps != timebase_wraps);
+
+	if (wrap_pending && count < 0x80000000) {
+		wraps++;
+	}
+
+	return ((uint64_t) wraps << 32) | count;
+}
+
+/*
+ * Counts the wrap if TIM2 has wrapped. Must be called from the TIM2 interrupt before
+ * anything else that looks at the time.
+ *
+ * The count and the flag must change together, otherwise an interrupt that preempts
+ * this one in between would see the wrap twice (or not at all) in timebase_now().
+ */
+void timebase_irq(void) {
+	if (TIM_GetITStatus(TIM2, TIM_IT_Update) != RESET) {
+		__disable_irq();
+		timebase_wraps++;
+		TIM_ClearITPendingBit(TIM2, TIM_IT_Update);
+		__enable_irq();
+	}
+}
+
+/*
+ * Puts the system time forward. For when TIM2 has been stopped along with the clocks
+ * and something else has kept the time meanwhile (see power.c). Must be called with
+ * interrupts masked. Compares the counter jumps past don't match; it's up to the
+ * caller to raise them.
+ */
+void timebase_advance(uint64_t us) {
+	uint64_t now;
+
+	TIM_Cmd(TIM2, DISABLE);
+	now = timebase_now() + us;
+
+	TIM2->CNT      = (uint32_t) now;
+	timebase_wraps = (uint32_t) (now >> 32);
+	TIM_ClearITPendingBit(TIM2, TIM_IT_Update);
+	TIM_Cmd(TIM2, ENABLE);
+}
+
+/*
+ * Sets up TIM2 to count microseconds through the whole 32 bits and starts it. The
+ * TIM2 interrupt itself is set up along with the compare channels that share it.
+ * The timers' clock is the same whichever profile the clocks are in (see clock.c),
+ * so the prescaler never has to change after this.
+ */
+void timebase_init(void) {
+	RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM2, ENABLE);
+
+	TIM_TimeBaseInitTypeDef init_data; 
+	init_data.TIM_Prescaler     = clock_timer_hz(TIM2) / TIMEBASE_HZ - 1;
+	init_data.TIM_CounterMode   = TIM_CounterMode_Up;
+	init_data.TIM_Period        = 0xFFFFFFFF;
+	init_data.TIM_ClockDivision = TIM_CKD_DIV1;
+	init_data.TIM_RepetitionCounter = 0;
+	TIM_TimeBaseInit(TIM2, &init_data);
+
+	// Initialising the time base raises the update flag, which would otherwise be
+	// counted as a wrap
+	TIM_ClearITPendingBit(TIM2, TIM_IT_Update);
+
+	TIM_Cmd(TIM2, ENABLE);
+	TIM_ITConfig(TIM2, TIM_IT_Update, ENABLE);
+}
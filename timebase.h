@@ -0,0 +1,14 @@
+#ifndef _TIMEBASE_H_
+#define _TIMEBASE_H_
+
+#include <stdint.h>
+
+// Rate the time base counts at (one tick per microsecond)
+#define TIMEBASE_HZ 1000000
+
+void     timebase_init(void);
+void     timebase_irq(void);
+uint64_t timebase_now(void);
+void     timebase_advance(uint64_t us);
+
+#endif /*_TIMEBASE_H_*/
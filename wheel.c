@@ -0,0 +1,233 @@
+#include <stddef.h>
+#include <stm32f4xx_tim.h>
+#include <stm32f4xx.h>
+#include "wheel.h"
+#include "timebase.h"
+
+// Timers for anything that has to happen at a given time but isn't worth a compare
+// channel of its own, all on TIM2's compare channel 2: it's pointed at the earliest
+// of them, and when it matches, everything that's due is called back from the TIM2
+// interrupt.
+//
+// They're kept in a hierarchical timing wheel. Each level is a ring of slots, each
+// slot a list of the timers due during it; level 0's slots are a microsecond long,
+// and each level up's are WHEEL_SLOTS times as long as the one below's. A timer goes
+// in the lowest level where it's in the same one of the next level up's slots as
+// now, so it's never more than one slot's turn away. As the wheel comes round to
+// each higher slot its timers are spread down into the levels below, until they reach
+// level 0 and go off. So arming and cancelling a timer are just adding it to and
+// taking it out of a list, however many there are and however far ahead they are.
+//
+// Which slots have anything in them is kept as a bitmap per level, so finding the
+// next thing to do is a count of leading zeros per level rather than stepping
+// through empty slots a microsecond at a time.
+//
+// The wheel only turns when the interrupt comes, to the time of each thing it does
+// in turn, so it's always at or behind the time base. Everything here must be called
+// from the TIM2 interrupt, or at its priority, or with interrupts masked.
+#define WHEEL_NEVER UINT64_MAX
+
+static wheel_timer_t *wheel_slots[WHEEL_LEVELS][WHEEL_SLOTS];
+static uint32_t       wheel_occupied[WHEEL_LEVELS];
+
+// The time the wheel has turned to
+static uint64_t wheel_now_us = 0;
+
+// Whether timers are being called back, in which case the compare is only set
+// once they're all done
+static bool wheel_dispatching = false;
+
+/*
+ * Which of a level's slots a time is in
+ */
+static uint8_t wheel_slot_of(uint64_t at_us, uint8_t level) {
+	return (uint8_t) ((at_us >> (WHEEL_SLOT_BITS * level)) & (WHEEL_SLOTS - 1));
+}
+
+/*
+ * Puts a timer in the slot for its time. One that's already due goes in level 0's
+ * slot for now, so it's called back next.
+ */
+static void wheel_insert(wheel_timer_t *timer) {
+	const uint8_t top = WHEEL_LEVELS - 1;
+	uint64_t at_us = timer->at_us > wheel_now_us ? timer->at_us : wheel_now_us;
+	uint8_t  level = 0;
+	wheel_timer_t **head;
+
+	while (level < top &&
+	       (at_us >> (WHEEL_SLOT_BITS * (level + 1))) != (wheel_now_us >> (WHEEL_SLOT_BITS * (level + 1)))) {
+		level++;
+	}
+
+	timer->level = level;
+	timer->slot  = wheel_slot_of(at_us, level);
+
+	// The top level has nothing above it, so wraps round: anything a whole turn of
+	// it or more ahead waits in the slot that comes round last, and is put back in
+	// from there
+	if (level == top &&
+	    (at_us >> (WHEEL_SLOT_BITS * top)) - (wheel_now_us >> (WHEEL_SLOT_BITS * top)) >= WHEEL_SLOTS) {
+		timer->slot = (wheel_slot_of(wheel_now_us, top) + WHEEL_SLOTS - 1) % WHEEL_SLOTS;
+	}
+
+	head = &wheel_slots[timer->level][timer->slot];
+	timer->next = *head;
+	timer->link = head;
+	if (*head) {
+		(*head)->link = &timer->next;
+	}
+	*head = timer;
+	wheel_occupied[timer->level] |= 1UL << timer->slot;
+}
+
+/*
+ * Takes a timer out of its slot's list
+ */
+static void wheel_remove(wheel_timer_t *timer) {
+	*timer->link = timer->next;
+	if (timer->next) {
+		timer->next->link = timer->link;
+	}
+	if (!wheel_slots[timer->level][timer->slot]) {
+		wheel_occupied[timer->level] &= ~(1UL << timer->slot);
+	}
+}
+
+/*
+ * Finds the next slot with anything in it, and gives the time the wheel gets to it:
+ * when its timers are due, on level 0, or otherwise when they need spreading down.
+ * Below the top level nothing can be in a slot the wheel has already passed, as
+ * it would have been in the level below.
+ */
+static uint64_t wheel_next(uint8_t *level, uint8_t *slot) {
+	uint8_t l;
+
+	for (l = 0; l < WHEEL_LEVELS; l++) {
+		uint8_t  shift   = WHEEL_SLOT_BITS * l;
+		uint64_t turn    = wheel_now_us & ~((1ULL << (shift + WHEEL_SLOT_BITS)) - 1);
+		uint32_t ahead   = wheel_occupied[l] & (0xFFFFFFFFUL << wheel_slot_of(wheel_now_us, l));
+		uint32_t pending = ahead ? ahead : wheel_occupied[l];
+
+		if (!pending) {
+			continue;
+		}
+		if (!ahead) {
+			// Only the top level wraps round: these are next time round
+			turn += 1ULL << (shift + WHEEL_SLOT_BITS);
+		}
+
+		*level = l;
+		*slot  = (uint8_t) (31 - __CLZ(pending & -pending));
+		return turn + ((uint64_t) *slot << shift);
+	}
+
+	return WHEEL_NEVER;
+}
+
+/*
+ * Points the compare at the next thing the wheel has to do, or turns its interrupt
+ * off if there's nothing. If that time has already gone by, the event is raised
+ * straight away rather than waiting for the counter to come round again.
+ */
+static void wheel_program(void) {
+	uint8_t  level, slot;
+	uint64_t next_us = wheel_next(&level, &slot);
+
+	if (next_us == WHEEL_NEVER) {
+		TIM_ITConfig(TIM2, TIM_IT_CC2, DISABLE);
+		return;
+	}
+
+	TIM_SetCompare2(TIM2, (uint32_t) next_us);
+	TIM_ITConfig(TIM2, TIM_IT_CC2, ENABLE);
+	if (timebase_now() >= next_us) {
+		TIM_GenerateEvent(TIM2, TIM_EventSource_CC2);
+	}
+}
+
+/*
+ * Sets a timer to call the callback (from the TIM2 interrupt) at the given time, or
+ * as soon as it can if that has already gone. A timer that's already armed is moved
+ * to the new time.
+ */
+void wheel_arm(wheel_timer_t *timer, uint64_t at_us, void (*callback)(void)) {
+	if (timer->armed) {
+		wheel_remove(timer);
+	}
+	timer->at_us    = at_us;
+	timer->callback = callback;
+	timer->armed    = true;
+	wheel_insert(timer);
+
+	if (!wheel_dispatching) {
+		wheel_program();
+	}
+}
+
+/*
+ * Stops a timer going off, if it hasn't already. The compare is left as it is: if
+ * it was pointed at this timer the interrupt will just find nothing to do.
+ */
+void wheel_cancel(wheel_timer_t *timer) {
+	if (timer->armed) {
+		wheel_remove(timer);
+		timer->armed = false;
+	}
+}
+
+/*
+ * Whether a timer is waiting to go off
+ */
+bool wheel_armed(const wheel_timer_t *timer) {
+	return timer->armed;
+}
+
+/*
+ * Turns the wheel up to now, calling back every timer that's due in order. Called on
+ * TIM2's compare channel 2 interrupt. A callback can arm timers (including its own)
+ * and those that are due now are called back too, before this returns.
+ */
+void wheel_irq(void) {
+	uint64_t now_us = timebase_now();
+	uint8_t  level, slot;
+	uint64_t next_us;
+
+	wheel_dispatching = true;
+
+	while ((next_us = wheel_next(&level, &slot)) <= now_us) {
+		wheel_timer_t *timer;
+
+		wheel_now_us = next_us;
+
+		// Taken out one at a time, so a callback can cancel or re-arm any of the rest
+		while ((timer = wheel_slots[level][slot]) != NULL) {
+			wheel_remove(timer);
+			if (level > 0) {
+				wheel_insert(timer);
+			} else {
+				timer->armed = false;
+				timer->callback();
+			}
+		}
+	}
+
+	wheel_dispatching = false;
+	wheel_program();
+}
+
+/*
+ * Sets up compare channel 2 for the wheel, starting it from now. TIM2 must already
+ * be counting (see timebase_init()); its interrupt is set up along with the other
+ * channels that share it.
+ */
+void wheel_init(void) {
+	TIM_OCInitTypeDef oc_init_data;
+
+	TIM_OCStructInit(&oc_init_data);
+	oc_init_data.TIM_OCMode = TIM_OCMode_Timing;
+	TIM_OC2Init(TIM2, &oc_init_data);
+	TIM_OC2PreloadConfig(TIM2, TIM_OCPreload_Disable);
+	TIM_SetCompare2(TIM2, 0xFFFFFFFF);
+
+	wheel_now_us = timebase_now();
+}
@@ -0,0 +1,34 @@
+#ifndef _WHEEL_H_
+#define _WHEEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// The wheel has WHEEL_LEVELS levels of WHEEL_SLOTS slots each. Each level's slots
+// are WHEEL_SLOTS times as long as the one below's, from a microsecond at the bottom,
+// so between them they cover 2^25us (33 seconds) ahead; anything further than that
+// waits in the top level's furthest slot and is looked at again when it comes round.
+#define WHEEL_LEVELS    5
+#define WHEEL_SLOT_BITS 5
+#define WHEEL_SLOTS     (1 << WHEEL_SLOT_BITS)
+
+// Something to be done at a given time (see wheel_arm()). The caller owns it, so the
+// wheel never has to allocate anything; it mustn't be reused until it has gone off
+// or been cancelled.
+typedef struct wheel_timer {
+	struct wheel_timer  *next;     // The rest of its slot's list
+	struct wheel_timer **link;     // What points to it, so it can be taken out
+	uint64_t             at_us;    // When it's due
+	void               (*callback)(void);
+	uint8_t              level;    // Where it is in the wheel
+	uint8_t              slot;
+	bool                 armed;
+} wheel_timer_t;
+
+void wheel_init(void);
+void wheel_arm(wheel_timer_t *timer, uint64_t at_us, void (*callback)(void));
+void wheel_cancel(wheel_timer_t *timer);
+bool wheel_armed(const wheel_timer_t *timer);
+void wheel_irq(void);
+
+#endif /*_WHEEL_H_*/